@@ -0,0 +1,1144 @@
+#include <cmath>
+#include <random>
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+#include <string>
+#include <vector>
+#include <utility>
+#include <iterator>
+#include <filesystem>
+
+#include <benchmark/benchmark.h>
+
+#include <Source.hpp>
+#include <Detector.hpp>
+
+#include "FR/include/tracker.hpp"
+#include "FR/include/face_reid.hpp"
+#include "FR/include/action_detector.hpp"
+
+/*
+ * Benchmarks of the pipeline parts. Inputs are generated from fixed seeds,
+ * so runs are comparable and need no camera. Benchmarks of detectors that
+ * need models are skipped unless the models are found under cpp-cvl-home.
+ */
+
+/*
+ * exposes the contexts, thumbnails of matches pile up otherwise
+ */
+class CBenchTracker : public CTracker
+{
+  public:
+
+    void ClearThumbnails(void)
+    {
+      for (auto& tc : iTrackingContexts)
+      {
+        tc.iThumbnails.clear();
+      }
+    }
+
+    std::tuple<int, int, int, int> GetCounts(void)
+    {
+      return iCounter->GetCounts();
+    }
+};
+
+/*
+ * a context for every detection of the last frame read into m, on a copy
+ * of m so that the next update sees the frame the contexts were made on
+ */
+static void SeedTracker(CBenchTracker& tracker, CSyntheticScene& scene, const cv::Mat& m)
+{
+  tracker.ClearAllContexts();
+
+  cv::Mat frame = m.clone();
+
+  for (auto& d : scene.GetDetections())
+  {
+    tracker.AddNewTrackingContext(frame, std::get<0>(d));
+  }
+}
+
+static std::string GetBenchVideo(void)
+{
+  static std::string path;
+
+  if (path.empty())
+  {
+    auto file = (std::filesystem::temp_directory_path() / "cvl_bench.avi").string();
+
+    CSyntheticScene scene("synthetic://size=640x360&objects=10&entry=0.05&frames=150");
+
+    cv::VideoWriter writer(file, cv::VideoWriter::fourcc('M', 'J', 'P', 'G'), 30, cv::Size(640, 360));
+
+    if (!writer.isOpened()) return path;
+
+    cv::Mat m;
+
+    while (scene.Read(m))
+    {
+      writer << m;
+    }
+
+    path = file;
+  }
+
+  return path;
+}
+
+static void BM_SourceRead(benchmark::State& state)
+{
+  auto video = GetBenchVideo();
+
+  if (video.empty())
+  {
+    state.SkipWithError("cannot write the video");
+    return;
+  }
+
+  CSource source(video);
+  cv::Mat m;
+
+  for (auto _ : state)
+  {
+    if (!source.Read(m))
+    {
+      state.PauseTiming();
+      source.Rewind();
+      source.Read(m);
+      state.ResumeTiming();
+    }
+
+    benchmark::DoNotOptimize(m.data);
+  }
+
+  state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_SourceRead);
+
+static void BM_DetectBackgroundSubtractor(benchmark::State& state, const char *algo)
+{
+  CSyntheticScene scene("synthetic://size=400x225&objects=10&entry=0.05&box=20");
+  BackgroundSubtractor detector(algo);
+  cv::Mat m;
+
+  for (auto _ : state)
+  {
+    state.PauseTiming();
+    scene.Read(m);
+    state.ResumeTiming();
+
+    benchmark::DoNotOptimize(detector.Detect(m));
+  }
+
+  state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_CAPTURE(BM_DetectBackgroundSubtractor, mog, "mog");
+BENCHMARK_CAPTURE(BM_DetectBackgroundSubtractor, cnt, "cnt");
+BENCHMARK_CAPTURE(BM_DetectBackgroundSubtractor, gmg, "gmg");
+BENCHMARK_CAPTURE(BM_DetectBackgroundSubtractor, gsoc, "gsoc");
+BENCHMARK_CAPTURE(BM_DetectBackgroundSubtractor, lsbp, "lsbp");
+
+static SPCDetector MakePeopleDetector(void) { return std::make_shared<PeopleDetector>(); }
+static SPCDetector MakeFaceDetector(void) { return std::make_shared<FaceDetector>(); }
+static SPCDetector MakeAgeGenderDetector(void) { return std::make_shared<AgeGenderDetector>(); }
+static SPCDetector MakeObjectDetector(void) { return std::make_shared<ObjectDetector>("person"); }
+static SPCDetector MakeIEPeopleDetector(void) { return std::make_shared<IEDetector>("people"); }
+static SPCDetector MakeIEFaceDetector(void) { return std::make_shared<IEDetector>("face"); }
+
+static void BM_DetectModel(benchmark::State& state, SPCDetector (*make)(void), std::vector<std::string> models)
+{
+  for (auto& model : models)
+  {
+    if (!std::filesystem::exists(GetModelHomeDir() + model))
+    {
+      state.SkipWithError(("model not found : " + model).c_str());
+      return;
+    }
+  }
+
+  CSyntheticScene scene("synthetic://size=400x225&objects=10&box=20");
+  auto detector = make();
+  cv::Mat m;
+
+  scene.Read(m);
+
+  for (auto _ : state)
+  {
+    benchmark::DoNotOptimize(detector->Detect(m));
+  }
+
+  state.SetItemsProcessed(state.iterations());
+}
+
+static const std::string kPeopleModel = "person-detection-retail-0013/FP16/person-detection-retail-0013.xml";
+static const std::string kFaceModel = "face-detection-retail-0005/FP16/face-detection-retail-0005.xml";
+static const std::string kAgeGenderModel = "age-gender-recognition-retail-0013/FP16/age-gender-recognition-retail-0013.xml";
+static const std::string kObjectModel = "MobileNetSSD_deploy.caffemodel";
+
+BENCHMARK_CAPTURE(BM_DetectModel, people, MakePeopleDetector, std::vector<std::string>{kPeopleModel});
+BENCHMARK_CAPTURE(BM_DetectModel, face, MakeFaceDetector, std::vector<std::string>{kFaceModel, kAgeGenderModel});
+BENCHMARK_CAPTURE(BM_DetectModel, agegender, MakeAgeGenderDetector, std::vector<std::string>{kAgeGenderModel});
+BENCHMARK_CAPTURE(BM_DetectModel, object, MakeObjectDetector, std::vector<std::string>{kObjectModel});
+BENCHMARK_CAPTURE(BM_DetectModel, ie_people, MakeIEPeopleDetector, std::vector<std::string>{kPeopleModel});
+BENCHMARK_CAPTURE(BM_DetectModel, ie_face, MakeIEFaceDetector, std::vector<std::string>{kFaceModel, kAgeGenderModel});
+
+/*
+ * serves recorded network outputs from Forward, so that the pre and post
+ * processing of Detect are measured without models
+ */
+template <typename T>
+class CRecordedDetector : public T
+{
+  public:
+
+    template <typename... Args>
+    CRecordedDetector(std::vector<cv::Mat> outputs, Args&&... args) :
+      T(std::forward<Args>(args)...), iOutputs(std::move(outputs))
+    {
+    }
+
+    void SetAgeGenderDetector(SPAgeGenderDetector detector)
+    {
+      this->iAgeGenderDetector = detector;
+    }
+
+  protected:
+
+    void Forward(const cv::Mat&, std::vector<cv::Mat>& out) override
+    {
+      out = iOutputs;
+    }
+
+    std::vector<cv::Mat> iOutputs;
+};
+
+/*
+ * SSD detection_out rows [image, label, confidence, x1, y1, x2, y2] of the
+ * ground truth of a synthetic frame, padded to the row count of the models
+ * with rows of image -1. They stand in for outputs recorded from the models
+ */
+static cv::Mat MakeSSDOutput(const Detections& detections, cv::Size size, float label)
+{
+  const int rows = 200;
+
+  cv::Mat out(std::vector<int>{1, 1, rows, 7}, CV_32F, cv::Scalar(0));
+  float *row = out.ptr<float>();
+
+  int n = 0;
+
+  for (auto& d : detections)
+  {
+    if (n == rows) break;
+
+    auto& r = std::get<0>(d);
+
+    float values[7] = {0, label, 0.95f,
+      static_cast<float>(r.x / size.width), static_cast<float>(r.y / size.height),
+      static_cast<float>((r.x + r.width) / size.width), static_cast<float>((r.y + r.height) / size.height)};
+
+    std::copy(values, values + 7, row + 7 * n++);
+  }
+
+  for (; n < rows; n++)
+  {
+    row[7 * n] = -1;
+  }
+
+  return out;
+}
+
+static SPAgeGenderDetector MakeRecordedAgeGenderDetector(void)
+{
+  cv::Mat age(1, 1, CV_32F, cv::Scalar(0.3));
+  cv::Mat gender = (cv::Mat_<float>(1, 2) << 0.2f, 0.8f);
+
+  return std::make_shared<CRecordedDetector<AgeGenderDetector>>(std::vector<cv::Mat>{age, gender});
+}
+
+static SPCDetector MakeRecordedPeopleDetector(const Detections& truth, cv::Size size)
+{
+  return std::make_shared<CRecordedDetector<PeopleDetector>>(
+    std::vector<cv::Mat>{MakeSSDOutput(truth, size, 1)});
+}
+
+static SPCDetector MakeRecordedFaceDetector(const Detections& truth, cv::Size size)
+{
+  auto detector = std::make_shared<CRecordedDetector<FaceDetector>>(
+    std::vector<cv::Mat>{MakeSSDOutput(truth, size, 1)});
+  detector->SetAgeGenderDetector(MakeRecordedAgeGenderDetector());
+  return detector;
+}
+
+static SPCDetector MakeRecordedObjectDetector(const Detections& truth, cv::Size size)
+{
+  return std::make_shared<CRecordedDetector<ObjectDetector>>(
+    std::vector<cv::Mat>{MakeSSDOutput(truth, size, 15)}, "person");
+}
+
+static SPCDetector MakeRecordedIEPeopleDetector(const Detections& truth, cv::Size size)
+{
+  return std::make_shared<CRecordedDetector<IEDetector>>(
+    std::vector<cv::Mat>{MakeSSDOutput(truth, size, 1)}, "people", 200, 7);
+}
+
+static SPCDetector MakeRecordedIEFaceDetector(const Detections& truth, cv::Size size)
+{
+  auto detector = std::make_shared<CRecordedDetector<IEDetector>>(
+    std::vector<cv::Mat>{MakeSSDOutput(truth, size, 1)}, "face", 200, 7);
+  detector->SetAgeGenderDetector(MakeRecordedAgeGenderDetector());
+  return detector;
+}
+
+/*
+ * Detect of the model detectors with the networks replaced by recorded
+ * outputs, runs everywhere. detections should match the objects in frame
+ */
+static void BM_DetectRecorded(benchmark::State& state, SPCDetector (*make)(const Detections&, cv::Size))
+{
+  CSyntheticScene scene("synthetic://size=1280x720&objects=20");
+  cv::Mat m;
+
+  scene.Read(m);
+
+  auto truth = scene.GetDetections();
+  auto detector = make(truth, m.size());
+  size_t found = 0;
+
+  for (auto _ : state)
+  {
+    auto detections = detector->Detect(m);
+    found = detections.size();
+    benchmark::DoNotOptimize(detections.data());
+  }
+
+  state.counters["objects"] = static_cast<double>(truth.size());
+  state.counters["detections"] = static_cast<double>(found);
+
+  state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_CAPTURE(BM_DetectRecorded, people, MakeRecordedPeopleDetector);
+BENCHMARK_CAPTURE(BM_DetectRecorded, face, MakeRecordedFaceDetector);
+BENCHMARK_CAPTURE(BM_DetectRecorded, object, MakeRecordedObjectDetector);
+BENCHMARK_CAPTURE(BM_DetectRecorded, ie_people, MakeRecordedIEPeopleDetector);
+BENCHMARK_CAPTURE(BM_DetectRecorded, ie_face, MakeRecordedIEFaceDetector);
+
+static CSyntheticScene MakeTrackerScene(int n)
+{
+  return CSyntheticScene("synthetic://size=1280x720&objects=" + std::to_string(n) +
+    "&entry=" + std::to_string(n / 240.0));
+}
+
+/*
+ * one update of the contexts on the next frame of a synthetic scene, the
+ * contexts are seeded again from its detections once a tenth of them are
+ * lost or gone. Items are the contexts updated
+ */
+static void BM_TrackerUpdate(benchmark::State& state)
+{
+  const int n = static_cast<int>(state.range(0));
+
+  auto scene = MakeTrackerScene(n);
+  CBenchTracker tracker;
+  cv::Mat m;
+  int64_t updated = 0;
+
+  scene.Read(m);
+  SeedTracker(tracker, scene, m);
+
+  for (auto _ : state)
+  {
+    state.PauseTiming();
+    if (10 * tracker.GetContextCount() < 9 * scene.GetDetections().size())
+    {
+      SeedTracker(tracker, scene, m);
+    }
+    updated += static_cast<int64_t>(tracker.GetContextCount());
+    scene.Read(m);
+    state.ResumeTiming();
+
+    benchmark::DoNotOptimize(tracker.UpdateTrackingContexts(m));
+  }
+
+  state.SetItemsProcessed(updated);
+}
+
+BENCHMARK(BM_TrackerUpdate)->Arg(1)->Arg(10)->Arg(100)->Unit(benchmark::kMillisecond);
+
+/*
+ * the detections of the next frame against contexts seeded on the first
+ */
+static void BM_TrackerMatch(benchmark::State& state)
+{
+  const int n = static_cast<int>(state.range(0));
+
+  auto scene = MakeTrackerScene(n);
+  CBenchTracker tracker;
+  cv::Mat m;
+
+  scene.Read(m);
+  SeedTracker(tracker, scene, m);
+
+  scene.Read(m);
+
+  auto detections = scene.GetDetections();
+
+  for (auto _ : state)
+  {
+    state.PauseTiming();
+    tracker.ClearThumbnails();
+    auto frame_detections = detections;
+    state.ResumeTiming();
+
+    tracker.MatchDetectionWithTrackingContext(frame_detections, m);
+  }
+
+  state.SetItemsProcessed(state.iterations() * detections.size());
+}
+
+BENCHMARK(BM_TrackerMatch)->Arg(1)->Arg(10)->Arg(100);
+
+/*
+ * the FR tracker on the detections of a synthetic scene, fragmentation is
+ * the number of tracks started per object of the scene and 1 at best
+ */
+static void BM_FRTrackerProcess(benchmark::State& state)
+{
+  const int n = static_cast<int>(state.range(0));
+
+  CSyntheticScene scene("synthetic://size=1280x720&pattern=mixed&objects=" + std::to_string(n) +
+    "&entry=" + std::to_string(n / 300.0));
+
+  TrackerParams params;
+  params.forget_delay = 30;
+  params.max_num_objects_in_track = 30;
+
+  Tracker tracker(params);
+  TrackedObjects detections;
+  std::vector<int> track_ids;
+  cv::Mat m;
+  int frame = 0, objects = 0, tracks = 0;
+
+  for (auto _ : state)
+  {
+    state.PauseTiming();
+    scene.Read(m);
+    detections.clear();
+    for (auto& d : scene.GetDetections())
+    {
+      detections.emplace_back(cv::Rect(std::get<0>(d)), 1.0f, TrackedObject::UNKNOWN_LABEL_IDX);
+    }
+    for (auto& o : scene.GetObjects())
+    {
+      objects = std::max(objects, o.id + 1);
+    }
+    state.ResumeTiming();
+
+    tracker.Process(m, detections, ++frame, &track_ids);
+
+    for (auto id : track_ids)
+    {
+      tracks = std::max(tracks, id + 1);
+    }
+  }
+
+  state.counters["objects"] = objects;
+  state.counters["fragmentation"] = objects ? static_cast<double>(tracks) / objects : 0;
+
+  state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_FRTrackerProcess)->Arg(10)->Arg(100)->Iterations(300)->Unit(benchmark::kMillisecond);
+
+static CSource MakeSyntheticSource(int n)
+{
+  return CSource("synthetic://size=1920x1080&pattern=mixed&objects=" + std::to_string(n) +
+    "&entry=" + std::to_string(n / 300.0));
+}
+
+static void ProcessSyntheticFrame(CBenchTracker& tracker, SyntheticDetector& detector, cv::Mat& m)
+{
+  tracker.UpdateTrackingContexts(m);
+
+  auto detections = detector.Detect(m);
+
+  tracker.MatchDetectionWithTrackingContext(detections, m);
+
+  for (auto& d : detections)
+  {
+    if (!std::get<3>(d))
+    {
+      tracker.AddNewTrackingContext(m, std::get<0>(d));
+    }
+  }
+}
+
+/*
+ * detect, track and count a synthetic scene end to end, count_error is the
+ * difference of the up and down counts from the ground truth of the scene
+ */
+static void BM_SyntheticPipeline(benchmark::State& state)
+{
+  const int n = static_cast<int>(state.range(0));
+
+  auto source = MakeSyntheticSource(n);
+  auto scene = source.GetSyntheticScene();
+  SyntheticDetector detector(scene);
+  CBenchTracker tracker;
+  cv::Mat m;
+
+  for (auto _ : state)
+  {
+    state.PauseTiming();
+    tracker.ClearThumbnails();
+    source.Read(m);
+    state.ResumeTiming();
+
+    ProcessSyntheticFrame(tracker, detector, m);
+  }
+
+  auto [up, down, left, right] = tracker.GetCounts();
+  auto [gt_up, gt_down, gt_left, gt_right] = scene->GetCounts();
+
+  state.counters["objects"] = static_cast<double>(scene->GetObjects().size());
+  state.counters["count_error"] = std::abs((up + down) - (gt_up + gt_down));
+
+  state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_SyntheticPipeline)->Arg(100)->Arg(500)->Iterations(100)->Unit(benchmark::kMillisecond);
+
+/*
+ * the synthetic pipeline with and without recording trace events, the
+ * overhead of tracing is the relative difference of the two times and
+ * should stay under 1%. Needs a build with CVL_TRACE
+ */
+static void BM_TraceOverhead(benchmark::State& state)
+{
+#ifdef CVL_TRACE
+  const int n = static_cast<int>(state.range(0));
+  const bool trace = state.range(1) != 0;
+
+  auto source = MakeSyntheticSource(n);
+  SyntheticDetector detector(source.GetSyntheticScene());
+  CBenchTracker tracker;
+  cv::Mat m;
+
+  auto& tracer = CTracer::Get();
+
+  if (trace)
+  {
+    tracer.Start((std::filesystem::temp_directory_path() / "cvl_bench_trace.json").string());
+  }
+  else
+  {
+    tracer.Stop();
+  }
+
+  for (auto _ : state)
+  {
+    state.PauseTiming();
+    tracker.ClearThumbnails();
+    source.Read(m);
+    state.ResumeTiming();
+
+    ProcessSyntheticFrame(tracker, detector, m);
+  }
+
+  tracer.Stop();
+
+  state.SetItemsProcessed(state.iterations());
+#else
+  state.SkipWithError("built without CVL_TRACE");
+#endif
+}
+
+BENCHMARK(BM_TraceOverhead)->ArgNames({"objects", "trace"})->ArgsProduct({{100, 500}, {0, 1}})
+  ->Iterations(100)->Unit(benchmark::kMillisecond);
+
+/*
+ * one update of every object of a synthetic scene against the reference
+ * line and random zones, the cost should follow the number of tracks and
+ * barely the zones. count_error is the difference of the reference line
+ * counts from the ground truth of the scene
+ */
+static void BM_CounterProcessTrail(benchmark::State& state)
+{
+  const int tracks = static_cast<int>(state.range(0));
+  const int zones = static_cast<int>(state.range(1));
+
+  CSyntheticScene scene("synthetic://size=1280x720&pattern=mixed&objects=" + std::to_string(tracks) +
+    "&entry=" + std::to_string(tracks / 300.0));
+
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> unit(0, 1);
+
+  CCounter counter;
+
+  for (int z = 0; z < zones; z++)
+  {
+    auto cx = unit(rng), cy = unit(rng);
+    auto name = "z" + std::to_string(z);
+
+    if (z % 2)
+    {
+      counter.SetZones("line " + name + " " + std::to_string(cx) + "," + std::to_string(cy) + " " +
+        std::to_string(std::min(cx + 0.1f, 1.0f)) + "," + std::to_string(std::min(cy + 0.05f, 1.0f)));
+    }
+    else
+    {
+      counter.SetZones("polygon " + name + " " + std::to_string(cx) + "," + std::to_string(cy) + " " +
+        std::to_string(std::min(cx + 0.1f, 1.0f)) + "," + std::to_string(cy) + " " +
+        std::to_string(cx) + "," + std::to_string(std::min(cy + 0.1f, 1.0f)));
+    }
+  }
+
+  std::vector<cv::Rect2d> trail(1);
+  std::vector<int> ids, previous, lost;
+  cv::Mat m;
+  int64_t updates = 0;
+
+  for (auto _ : state)
+  {
+    state.PauseTiming();
+    scene.Read(m);
+    previous.swap(ids);
+    ids.clear();
+    state.ResumeTiming();
+
+    for (auto& o : scene.GetObjects())
+    {
+      trail[0] = o.GetBox();
+      ids.push_back(o.id);
+      benchmark::DoNotOptimize(counter.ProcessTrail(o.id, trail, m));
+    }
+
+    // objects are kept in the order of their ids
+    lost.clear();
+    std::set_difference(previous.begin(), previous.end(), ids.begin(), ids.end(), std::back_inserter(lost));
+
+    for (auto id : lost)
+    {
+      counter.RemoveTrack(id);
+    }
+
+    updates += static_cast<int64_t>(ids.size());
+  }
+
+  auto [up, down, left, right] = counter.GetCounts();
+  auto [gt_up, gt_down, gt_left, gt_right] = scene.GetCounts();
+
+  state.counters["count_error"] = std::abs((up + down) - (gt_up + gt_down));
+
+  state.SetItemsProcessed(updates);
+}
+
+BENCHMARK(BM_CounterProcessTrail)->ArgNames({"tracks", "zones"})->ArgsProduct({{100, 1000}, {0, 16, 256}})
+  ->Iterations(500);
+
+static void BM_KuhnMunkres(benchmark::State& state)
+{
+  const int n = static_cast<int>(state.range(0));
+
+  cv::Mat dissimilarity(n, n, CV_32F);
+  cv::RNG(1).fill(dissimilarity, cv::RNG::UNIFORM, 0.0f, 1.0f);
+
+  KuhnMunkres matcher(state.range(1) != 0);
+  std::vector<size_t> assignment;
+
+  for (auto _ : state)
+  {
+    matcher.Solve(dissimilarity, &assignment);
+    benchmark::DoNotOptimize(assignment.data());
+  }
+}
+
+BENCHMARK(BM_KuhnMunkres)->ArgNames({"n", "greedy"})->ArgsProduct({{10, 50, 200}, {0, 1}});
+
+static double AssignmentCost(const cv::Mat& dissimilarity, const std::vector<size_t>& assignment)
+{
+  double cost = 0;
+
+  for (size_t i = 0; i < assignment.size(); i++)
+  {
+    if (assignment[i] < static_cast<size_t>(dissimilarity.cols))
+    {
+      cost += dissimilarity.at<float>(static_cast<int>(i), static_cast<int>(assignment[i]));
+    }
+  }
+
+  return cost;
+}
+
+/*
+ * optimal cost of a small problem over all permutations of the larger side
+ */
+static double BruteForceAssignmentCost(const cv::Mat& dissimilarity)
+{
+  const bool transposed = dissimilarity.rows > dissimilarity.cols;
+  const int n = std::min(dissimilarity.rows, dissimilarity.cols);
+
+  std::vector<int> perm(std::max(dissimilarity.rows, dissimilarity.cols));
+  for (size_t k = 0; k < perm.size(); k++) perm[k] = static_cast<int>(k);
+
+  double best = std::numeric_limits<double>::infinity();
+
+  do
+  {
+    double cost = 0;
+    for (int k = 0; k < n; k++)
+    {
+      cost += transposed ? dissimilarity.at<float>(perm[k], k) : dissimilarity.at<float>(k, perm[k]);
+    }
+    best = std::min(best, cost);
+  } while (std::next_permutation(perm.begin(), perm.end()));
+
+  return best;
+}
+
+/*
+ * Tracks against the detections of the next frame, which are the tracks
+ * moved a little, in another order and with some clutter, costed like the
+ * motion term of the FR tracker. The solver is warm started with the pairs
+ * of KuhnMunkres::NearestHint, hinted is the share of rows it pairs. The
+ * solutions are checked against cold solves, and small random problems
+ * against brute force.
+ */
+static void BM_KuhnMunkresWarmStart(benchmark::State& state)
+{
+  const int n = static_cast<int>(state.range(0));
+  const bool hint = state.range(1) != 0;
+  const int clutter = std::max(1, n / 8);
+
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> x(0, 1280), y(0, 720), jitter(-4, 4), unit(0, 1);
+
+  KuhnMunkres matcher, reference;
+  std::vector<size_t> assignment, expected;
+
+  for (int trial = 0; trial < 200; trial++)
+  {
+    cv::Mat small(1 + rng() % 7, 1 + rng() % 7, CV_32F);
+    for (int i = 0; i < small.rows; i++)
+    {
+      for (int j = 0; j < small.cols; j++)
+      {
+        // coarse costs in every other trial, so that there are ties
+        small.at<float>(i, j) = trial % 2 ? unit(rng) : static_cast<float>(rng() % 4) / 4;
+      }
+    }
+
+    matcher.NearestHint(small, &assignment);
+    matcher.Solve(small, &assignment);
+
+    if (std::abs(AssignmentCost(small, assignment) - BruteForceAssignmentCost(small)) > 1e-4)
+    {
+      state.SkipWithError("warm started solution differs from brute force");
+      return;
+    }
+  }
+
+  std::vector<cv::Point2f> tracks(n), detections;
+  for (auto& t : tracks)
+  {
+    t = cv::Point2f(x(rng), y(rng));
+    detections.emplace_back(t.x + jitter(rng), t.y + jitter(rng));
+  }
+  for (int k = 0; k < clutter; k++)
+  {
+    detections.emplace_back(x(rng), y(rng));
+  }
+  std::shuffle(detections.begin(), detections.end(), rng);
+
+  cv::Mat dissimilarity(n, static_cast<int>(detections.size()), CV_32F);
+  for (int i = 0; i < dissimilarity.rows; i++)
+  {
+    for (int j = 0; j < dissimilarity.cols; j++)
+    {
+      auto d = tracks[i] - detections[j];
+      dissimilarity.at<float>(i, j) = 1.0f - std::exp(-(d.x * d.x + d.y * d.y) / (2 * 40.0f * 40.0f));
+    }
+  }
+
+  reference.Solve(dissimilarity, &expected);
+
+  matcher.NearestHint(dissimilarity, &assignment);
+
+  auto hinted = std::count_if(assignment.begin(), assignment.end(),
+    [&](size_t col) { return col < static_cast<size_t>(dissimilarity.cols); });
+
+  for (auto _ : state)
+  {
+    if (hint)
+    {
+      matcher.NearestHint(dissimilarity, &assignment);
+    }
+    else
+    {
+      assignment.clear();
+    }
+
+    matcher.Solve(dissimilarity, &assignment);
+    benchmark::DoNotOptimize(assignment.data());
+  }
+
+  if (std::abs(AssignmentCost(dissimilarity, assignment) - AssignmentCost(dissimilarity, expected)) > 1e-3)
+  {
+    state.SkipWithError("warm started solution differs from the cold one");
+    return;
+  }
+
+  state.counters["hinted"] = hint ? static_cast<double>(hinted) / n : 0.0;
+}
+
+BENCHMARK(BM_KuhnMunkresWarmStart)->ArgNames({"n", "hint"})->ArgsProduct({{10, 50, 200}, {0, 1}});
+
+/*
+ * Gallery of random reid embeddings and faces of a frame that are noisy
+ * copies of some of them. Recall is the share of faces recognized as the
+ * identity they were copied from, which shows what the ANN index loses.
+ */
+static void BM_GalleryGetIDs(benchmark::State& state)
+{
+  const int gallery_size = static_cast<int>(state.range(0));
+  const bool ann = state.range(1) != 0;
+  const int dim = 256;
+  const int num_faces = 16;
+
+  cv::RNG rng(1);
+
+  std::vector<GalleryObject> identities;
+  for (int i = 0; i < gallery_size; i++)
+  {
+    cv::Mat embedding(dim, 1, CV_32F);
+    rng.fill(embedding, cv::RNG::NORMAL, 0.0f, 1.0f);
+    identities.emplace_back(std::vector<cv::Mat>{embedding / cv::norm(embedding)}, std::to_string(i), i);
+  }
+
+  std::vector<cv::Mat> faces;
+  std::vector<int> expected;
+  for (int i = 0; i < num_faces; i++)
+  {
+    int id = rng.uniform(0, gallery_size);
+    cv::Mat noise(dim, 1, CV_32F);
+    rng.fill(noise, cv::RNG::NORMAL, 0.0f, 0.02f);
+    faces.push_back(identities[id].embeddings[0] + noise);
+    expected.push_back(id);
+  }
+
+  EmbeddingsGallery gallery(identities, 0.7, false, ann ? 1 : 0);
+
+  std::vector<int> ids;
+
+  for (auto _ : state)
+  {
+    ids = gallery.GetIDsByEmbeddings(faces);
+    benchmark::DoNotOptimize(ids.data());
+  }
+
+  int recognized = 0;
+  for (int i = 0; i < num_faces; i++)
+  {
+    recognized += ids[i] == expected[i];
+  }
+
+  state.counters["recall"] = static_cast<double>(recognized) / num_faces;
+  state.SetItemsProcessed(state.iterations() * num_faces);
+}
+
+BENCHMARK(BM_GalleryGetIDs)->ArgNames({"gallery", "ann"})->ArgsProduct({{100, 1000, 10000}, {0, 1}});
+
+/*
+ * Candidates of an SSD head: clusters of jittered boxes around people
+ */
+static void BM_SoftNonMaxSuppression(benchmark::State& state)
+{
+  const int n = static_cast<int>(state.range(0));
+  const bool hard = state.range(1) != 0;
+
+  std::mt19937 rng(1);
+  std::uniform_int_distribution<int> cx(100, 1180), cy(100, 620), side(40, 120), jitter(-8, 8);
+  std::uniform_real_distribution<float> score(0.4f, 1.0f);
+
+  DetectedActions detections;
+  while (static_cast<int>(detections.size()) < n)
+  {
+    cv::Rect person(cx(rng), cy(rng), side(rng), side(rng));
+
+    for (int k = 0; k < 20 && static_cast<int>(detections.size()) < n; k++)
+    {
+      cv::Rect rect(person.x + jitter(rng), person.y + jitter(rng),
+                    person.width + jitter(rng), person.height + jitter(rng));
+      detections.emplace_back(rect, 0, score(rng), 1.0f);
+    }
+  }
+
+  std::vector<int> indices;
+
+  for (auto _ : state)
+  {
+    SoftNonMaxSuppression(detections, 0.6f, 200, 0.4f, hard, 0.45f, &indices);
+    benchmark::DoNotOptimize(indices.data());
+  }
+
+  state.SetItemsProcessed(state.iterations() * n);
+}
+
+BENCHMARK(BM_SoftNonMaxSuppression)->ArgNames({"n", "hard"})->ArgsProduct({{100, 1000, 5000}, {0, 1}});
+
+/*
+ * Outputs of the person/action SSD for one 680x400 frame, in the blob layout
+ * of either network version. They stand in for recorded outputs: about 2% of
+ * the candidates pass the detection threshold, as on a scene with people.
+ */
+struct CActionOutputs
+{
+  cv::Size input{680, 400};
+  std::vector<cv::Size> heads;
+  cv::Mat loc;
+  cv::Mat conf;
+  cv::Mat priorboxes;
+  std::vector<cv::Mat> add_conf;
+};
+
+static CActionOutputs MakeActionOutputs(const ActionDetectorConfig& config, bool new_network)
+{
+  CActionOutputs out;
+  const auto& anchors = new_network ? config.new_anchors : config.old_anchors;
+  const int classes = static_cast<int>(config.num_action_classes);
+
+  int candidates = 0;
+  for (size_t h = 0; h < anchors.size(); h++)
+  {
+    int step = new_network ? config.new_det_heads[h].step : 16;
+    out.heads.emplace_back(out.input.width / step, out.input.height / step);
+    candidates += anchors[h] * out.heads[h].area();
+  }
+
+  std::mt19937 rng(1);
+  std::normal_distribution<float> logit(0.f, 1.5f), offset(0.f, 1.f);
+  std::uniform_real_distribution<float> low(0.f, 0.3f), high(0.4f, 1.f), unit(0.f, 1.f);
+
+  out.loc.create(candidates, 4, CV_32F);
+  out.conf.create(candidates, 2, CV_32F);
+  for (int p = 0; p < candidates; p++)
+  {
+    float positive = unit(rng) < 0.02f ? high(rng) : low(rng);
+    out.conf.at<float>(p, 0) = 1.f - positive;
+    out.conf.at<float>(p, 1) = positive;
+    for (int k = 0; k < 4; k++)
+    {
+      out.loc.at<float>(p, k) = offset(rng);
+    }
+  }
+
+  /* the old version reads all priors and then all variances from one blob */
+  if (!new_network)
+  {
+    out.priorboxes.create(2 * candidates, 4, CV_32F);
+    for (int p = 0; p < candidates; p++)
+    {
+      int pos = p / anchors[0];
+      float cx = (pos % out.heads[0].width + 0.5f) / out.heads[0].width;
+      float cy = (pos / out.heads[0].width + 0.5f) / out.heads[0].height;
+      float half = 0.02f * (1 + p % anchors[0]);
+      float prior[4] = {cx - half, cy - 2 * half, cx + half, cy + 2 * half};
+      for (int k = 0; k < 4; k++)
+      {
+        out.priorboxes.at<float>(p, k) = prior[k];
+        out.priorboxes.at<float>(candidates + p, k) = config.variances[k];
+      }
+    }
+  }
+
+  /* one blob per anchor, classes outermost in the new version and innermost in the old one */
+  for (size_t h = 0; h < anchors.size(); h++)
+  {
+    for (int a = 0; a < anchors[h]; a++)
+    {
+      int area = out.heads[h].area();
+      cv::Mat blob = new_network ? cv::Mat(classes, area, CV_32F) : cv::Mat(area, classes, CV_32F);
+      for (int r = 0; r < blob.rows; r++)
+      {
+        for (int c = 0; c < blob.cols; c++)
+        {
+          blob.at<float>(r, c) = logit(rng);
+        }
+      }
+      out.add_conf.push_back(blob);
+    }
+  }
+
+  return out;
+}
+
+/*
+ * The per-candidate decode that ActionDetection::GetDetections replaced: it
+ * finds the head of every candidate by a linear search and takes one exp per
+ * action class and per box side
+ */
+static DetectedActions ScalarActionDetections(const ActionDetectorConfig& config, bool new_network,
+                                              const CActionOutputs& out, const cv::Size& frame_size)
+{
+  const auto& anchors = new_network ? config.new_anchors : config.old_anchors;
+  const int classes = static_cast<int>(config.num_action_classes);
+  const bool binary_task = classes == 2;
+  const float scale = new_network ? config.new_action_scale : config.old_action_scale;
+
+  std::vector<int> head_ranges(1, 0), glob_anchor_base;
+  for (size_t h = 0; h < anchors.size(); h++)
+  {
+    glob_anchor_base.push_back(h ? glob_anchor_base.back() + anchors[h - 1] : 0);
+    head_ranges.push_back(head_ranges.back() + anchors[h] * out.heads[h].area());
+  }
+  const int candidates = head_ranges.back();
+
+  const float* loc = out.loc.ptr<float>(0);
+  const float* conf = out.conf.ptr<float>(0);
+  const float* priors = new_network ? nullptr : out.priorboxes.ptr<float>(0);
+
+  DetectedActions valid;
+
+  for (int p = 0; p < candidates; p++)
+  {
+    const float detection_conf = conf[p * 2 + 1];
+    if (detection_conf < config.detection_confidence_threshold)
+    {
+      continue;
+    }
+
+    int h = 0;
+    while (p >= head_ranges[h + 1])
+    {
+      h++;
+    }
+    const int head_p = p - head_ranges[h];
+    const int anchor = head_p % anchors[h];
+    const int pos = head_p / anchors[h];
+
+    const float* anchor_conf = out.add_conf[glob_anchor_base[h] + anchor].ptr<float>(0);
+    const int shift = new_network ? pos : pos * classes;
+    const int step = new_network ? out.heads[h].area() : 1;
+
+    int label = -1;
+    float max_exp = 0.f, sum_exp = 0.f;
+    for (int c = 0; c < classes; c++)
+    {
+      float e = std::exp(scale * anchor_conf[shift + c * step]);
+      sum_exp += e;
+      if (e > max_exp && (c > 0 || !binary_task))
+      {
+        max_exp = e;
+        label = c;
+      }
+    }
+    float action_conf = max_exp / sum_exp;
+    if (label < 0 || action_conf < config.action_confidence_threshold)
+    {
+      label = config.default_action_id;
+      action_conf = 0.f;
+    }
+
+    float prior[4], variance[4], encoded[4];
+    if (new_network)
+    {
+      const auto& head = config.new_det_heads[h];
+      float cx = (pos % out.heads[h].width + 0.5f) * head.step;
+      float cy = (pos / out.heads[h].width + 0.5f) * head.step;
+      const auto& size = head.anchors[anchor];
+      prior[0] = (cx - 0.5f * size.width) / out.input.width;
+      prior[1] = (cy - 0.5f * size.height) / out.input.height;
+      prior[2] = (cx + 0.5f * size.width) / out.input.width;
+      prior[3] = (cy + 0.5f * size.height) / out.input.height;
+    }
+    const int order[4] = {1, 0, 3, 2};
+    for (int k = 0; k < 4; k++)
+    {
+      if (!new_network)
+      {
+        prior[k] = priors[p * 4 + k];
+      }
+      variance[k] = new_network ? config.variances[k] : priors[(candidates + p) * 4 + k];
+      encoded[k] = loc[p * 4 + (new_network ? order[k] : k)];
+    }
+
+    const float prior_width = prior[2] - prior[0];
+    const float prior_height = prior[3] - prior[1];
+    const float cx = variance[0] * encoded[0] * prior_width + 0.5f * (prior[0] + prior[2]);
+    const float cy = variance[1] * encoded[1] * prior_height + 0.5f * (prior[1] + prior[3]);
+    const float width = std::exp(variance[2] * encoded[2]) * prior_width;
+    const float height = std::exp(variance[3] * encoded[3]) * prior_height;
+
+    cv::Rect rect(static_cast<int>((cx - 0.5f * width) * frame_size.width),
+                  static_cast<int>((cy - 0.5f * height) * frame_size.height),
+                  static_cast<int>(width * frame_size.width),
+                  static_cast<int>(height * frame_size.height));
+
+    valid.emplace_back(rect, label, detection_conf, action_conf);
+  }
+
+  std::vector<int> indices;
+  SoftNonMaxSuppression(valid, config.nms_sigma, config.keep_top_k,
+                        config.detection_confidence_threshold,
+                        config.use_hard_nms, config.hard_nms_threshold, &indices);
+
+  DetectedActions detections;
+  for (int i : indices)
+  {
+    detections.push_back(valid[i]);
+  }
+  return detections;
+}
+
+/*
+ * SSD decode of the action detector, the scalar loop against the lookup
+ * tables and whole-matrix exp of GetDetections. Both must give the same
+ * detections, the confidences may differ by the rounding of the softmax shift.
+ */
+static void BM_ActionDetectionDecode(benchmark::State& state)
+{
+  const bool new_network = state.range(0) != 0;
+  const bool scalar = state.range(1) != 0;
+  const cv::Size frame_size(1280, 720);
+
+  ActionDetectorConfig config("");
+  CActionOutputs out = MakeActionOutputs(config, new_network);
+  ActionDetection detector(config, new_network, out.input, out.heads);
+
+  DetectedActions expected = ScalarActionDetections(config, new_network, out, frame_size);
+  DetectedActions actual = detector.GetDetections(out.loc, out.conf, out.priorboxes, out.add_conf, frame_size);
+
+  bool same = expected.size() == actual.size();
+  for (size_t i = 0; same && i < expected.size(); i++)
+  {
+    same = expected[i].rect == actual[i].rect &&
+           expected[i].label == actual[i].label &&
+           expected[i].detection_conf == actual[i].detection_conf &&
+           std::fabs(expected[i].action_conf - actual[i].action_conf) <= 1e-5f;
+  }
+  if (!same)
+  {
+    state.SkipWithError("vectorized decode differs from the scalar loop");
+    return;
+  }
+
+  for (auto _ : state)
+  {
+    DetectedActions detections = scalar
+      ? ScalarActionDetections(config, new_network, out, frame_size)
+      : detector.GetDetections(out.loc, out.conf, out.priorboxes, out.add_conf, frame_size);
+    benchmark::DoNotOptimize(detections.data());
+  }
+
+  state.counters["detections"] = static_cast<double>(actual.size());
+  state.SetItemsProcessed(state.iterations() * out.conf.rows);
+}
+
+BENCHMARK(BM_ActionDetectionDecode)->ArgNames({"new", "scalar"})->ArgsProduct({{0, 1}, {0, 1}});
+
+BENCHMARK_MAIN();
@@ -1,6 +1,7 @@
 #ifndef FRMAIN_HPP
 #define FRMAIN_HPP
 
+#include <mutex>
 #include <string>
 #include <vector>
 #include <functional>
@@ -8,10 +9,19 @@
 
 #include <opencv2/opencv.hpp>
 
+#include "../INCLUDE/Metrics.hpp"
+
 using TOnCameraEventCbk = std::function<
   void (const std::string&, const std::string&, const std::string&, std::vector<uint8_t>&)
 >;
 
+struct FRGalleryUpdate
+{
+  bool add;
+  std::string label;
+  std::string image_path;
+};
+
 struct FR
 {
   bool iStop = false;
@@ -40,22 +50,62 @@ struct FR
     iOnCameraEventCbk = cbk;
   }
 
+  // gallery updates are applied by fr_main between frames
+  void fr_add_identity(const std::string& label, const std::string& image_path)
+  {
+    std::lock_guard<std::mutex> lg(iGalleryLock);
+    iGalleryUpdates.push_back({true, label, image_path});
+  }
+
+  void fr_remove_identity(const std::string& label)
+  {
+    std::lock_guard<std::mutex> lg(iGalleryLock);
+    iGalleryUpdates.push_back({false, label, ""});
+  }
+
+  std::vector<FRGalleryUpdate> fr_take_gallery_updates(void)
+  {
+    std::lock_guard<std::mutex> lg(iGalleryLock);
+    std::vector<FRGalleryUpdate> updates;
+    updates.swap(iGalleryUpdates);
+    return updates;
+  }
+
   void ProcessFrame(const cv::Mat& frame)
   {
-    auto clone = frame.clone();
+    CStageTimer timer(iMetrics);
+
+    const cv::Mat* out = &frame;
 
-    if (clone.cols > 600)
+    timer.Start(EStage::Resize);
+
+    if (frame.cols > 600)
     {
-      auto scale = (float) 600 / clone.cols;
-      cv::resize(clone, clone, cv::Size(0, 0), scale, scale);
+      auto scale = (float) 600 / frame.cols;
+      cv::resize(frame, iPlayFrame, cv::Size(0, 0), scale, scale);
+      out = &iPlayFrame;
     }
-    std::vector<uchar> buf;
-    cv::imencode(".jpg", clone, buf);
-    iOnCameraEventCbk("play", "", "", buf);
+    timer.Start(EStage::Encode);
+    cv::imencode(".jpg", *out, iPlayBuffer);
+    timer.Start(EStage::Callback);
+    iOnCameraEventCbk("play", "", "", iPlayBuffer);
   }
 
   std::string iModelHomeDir;
 
+  // metrics of the pipeline stages are registered under this name
+  std::string iName = "fr";
+
+  SPCMetrics iMetrics;
+
+  cv::Mat iPlayFrame;
+
+  std::vector<uchar> iPlayBuffer;
+
+  std::mutex iGalleryLock;
+
+  std::vector<FRGalleryUpdate> iGalleryUpdates;
+
   int fr_main(int argc, char* argv[], FR *);
 };
 
@@ -5,6 +5,7 @@
 #pragma once
 
 #include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -78,6 +79,10 @@ struct ActionDetectorConfig : public CnnConfig {
 
     /** @brief Scale paramter for Soft-NMS algorithm */
     float nms_sigma = 0.6f;
+    /** @brief Use hard NMS instead of Soft-NMS */
+    bool use_hard_nms = false;
+    /** @brief Overlap threshold for hard NMS */
+    float hard_nms_threshold = 0.45f;
     /** @brief Threshold for detected objects */
     float detection_confidence_threshold = 0.4f;
     /** @brief Threshold for recognized actions */
@@ -98,6 +103,10 @@ struct ActionDetectorConfig : public CnnConfig {
     size_t num_action_classes = 3;
     /** @brief Async execution flag */
     bool is_async = true;
+    /** @brief Resize input frames by Inference Engine preprocessing */
+    bool resize_in_plugin = false;
+    /** @brief Resizer shared with other detectors, the detector owns one if it is not set */
+    std::shared_ptr<FrameResizer> frame_resizer;
     /** @brief  SSD bbox encoding variances */
     float variances[4]{0.1f, 0.1f, 0.2f, 0.2f};
     SSDHeads new_det_heads{{8,  {{26.17863728f, 58.670372f}}},
@@ -112,6 +121,19 @@ class ActionDetection : public AsyncDetection<DetectedAction>, public BaseCnnDet
 public:
     explicit ActionDetection(const ActionDetectorConfig& config);
 
+    /**
+    * @brief Constructor of the post-processing only, for outputs recorded from
+    * a network with the given layout. No model is read and nothing can be enqueued.
+    *
+    * @param config Detector config, the model path is not used
+    * @param new_network Whether the outputs come from the new network version
+    * @param network_input_size Size of the network input (WxH)
+    * @param head_blob_sizes Size of the action blobs of every head (WxH)
+    */
+    ActionDetection(const ActionDetectorConfig& config, bool new_network,
+                    const cv::Size& network_input_size,
+                    const std::vector<cv::Size>& head_blob_sizes);
+
     void submitRequest() override;
     void enqueue(const cv::Mat &frame) override;
     void wait() override { BaseCnnDetection::wait(); }
@@ -120,6 +142,22 @@ public:
     }
     DetectedActions fetchResults() override;
 
+     /**
+    * @brief Translates the detections from the network outputs
+    *
+    * @param loc Location buffer
+    * @param main_conf Detection conf buffer
+    * @param priorboxes Priorboxes buffer, empty for the new network version
+    * @param add_conf Action conf buffer
+    * @param frame_size Size of input image (WxH)
+    * @return Detected objects
+    */
+    DetectedActions GetDetections(const cv::Mat& loc,
+                                  const cv::Mat& main_conf,
+                                  const cv::Mat& priorboxes,
+                                  const std::vector<cv::Mat>& add_conf,
+                                  const cv::Size& frame_size) const;
+
 private:
     ActionDetectorConfig config_;
     InferenceEngine::ExecutableNetwork net_;
@@ -151,21 +189,12 @@ private:
     };
     typedef std::vector<NormalizedBBox> NormalizedBBoxes;
 
-     /**
-    * @brief Translates the detections from the network outputs
+    /**
+    * @brief Builds the head ranges and the candidate lookup tables
     *
-    * @param loc Location buffer
-    * @param main_conf Detection conf buffer
-    * @param add_conf Action conf buffer
-    * @param priorboxes Priorboxes buffer
-    * @param frame_size Size of input image (WxH)
-    * @return Detected objects
+    * @param head_blob_sizes Size of the action blobs of every head (WxH)
     */
-    DetectedActions GetDetections(const cv::Mat& loc,
-                                  const cv::Mat& main_conf,
-                                  const cv::Mat& priorboxes,
-                                  const std::vector<cv::Mat>& add_conf,
-                                  const cv::Size& frame_size) const;
+    void InitCandidates(const std::vector<cv::Size>& head_blob_sizes);
 
      /**
     * @brief Translate input buffer to BBox
@@ -186,32 +215,38 @@ private:
     inline NormalizedBBox
     GeneratePriorBox(int pos, int step, const cv::Size2f& anchor, const cv::Size& blob_size) const;
 
-     /**
-    * @brief Translates input blobs in SSD format to bbox in CV_Rect
-    *
-    * @param prior_bbox Prior boxes in SSD format
-    * @param variances Variances of prior boxes in SSD format
-    * @param encoded_bbox BBox to decode
-    * @param frame_size Size of input image (WxH)
-    * @return BBox in CV_Rect format
-    */
-    cv::Rect ConvertToRect(const NormalizedBBox& prior_bbox,
-                           const NormalizedBBox& variances,
-                           const NormalizedBBox& encoded_bbox,
-                           const cv::Size& frame_size) const;
-
-     /**
-    * @brief Carry out Soft Non-Maximum Suppression algorithm under detected actions
-    *
-    * @param detections Detected actions
-    * @param sigma Scale paramter
-    * @param top_k Number of top-score bboxes
-    * @param min_det_conf Minimum detection confidence
-    * @param out_indices Out indices of valid detections
-    */
-    void SoftNonMaxSuppression(const DetectedActions& detections,
-                               const float sigma,
-                               const int top_k,
-                               const float min_det_conf,
-                               std::vector<int>* out_indices) const;
+    /** @brief Global anchor of each candidate */
+    std::vector<int> candidate_glob_anchor_;
+    /** @brief Offset of the first action confidence of each candidate in its anchor blob */
+    std::vector<int> candidate_conf_shift_;
+    /** @brief Step between action confidences of each candidate */
+    std::vector<int> candidate_conf_step_;
+    /** @brief Prior boxes of candidates for the new network version */
+    NormalizedBBoxes candidate_priors_;
+
+    /** @brief Buffers of GetDetections reused between frames */
+    mutable cv::Mat candidates_mask_;
+    mutable std::vector<cv::Point> candidates_;
+    mutable cv::Mat action_probs_;
+    mutable cv::Mat box_sizes_;
 };
+
+/**
+* @brief Carry out Soft Non-Maximum Suppression algorithm under detected actions,
+* or hard NMS if it is enabled
+*
+* @param detections Detected actions
+* @param sigma Scale paramter
+* @param top_k Number of top-score bboxes
+* @param min_det_conf Minimum detection confidence
+* @param use_hard_nms Drop overlapping bboxes instead of decaying their scores
+* @param hard_nms_threshold IoU above which hard NMS drops a bbox
+* @param out_indices Out indices of valid detections
+*/
+void SoftNonMaxSuppression(const DetectedActions& detections,
+                           const float sigma,
+                           const int top_k,
+                           const float min_det_conf,
+                           const bool use_hard_nms,
+                           const float hard_nms_threshold,
+                           std::vector<int>* out_indices);
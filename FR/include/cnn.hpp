@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include <deque>
 #include <map>
 #include <memory>
 #include <string>
@@ -14,6 +15,8 @@
 
 #include <inference_engine.hpp>
 
+#include "../../INCLUDE/Trace.hpp"
+
 /**
 * @brief Base class of config for network
 */
@@ -38,6 +41,9 @@ struct CnnConfig {
 class CnnDLSDKBase {
 public:
     using Config = CnnConfig;
+    /** @brief Callback that draws an image straight at the network input size
+    * into a preallocated CV_8UC3 image */
+    using InputWriter = std::function<void(size_t image_idx, cv::Mat& input)>;
 
     /**
    * @brief Constructor
@@ -59,6 +65,11 @@ public:
     */
     void PrintPerformanceCounts(std::string fullDeviceName) const;
 
+    /**
+    * @brief Returns network config
+    */
+    const Config& config() const { return config_; }
+
 protected:
     /**
    * @brief Run network
@@ -78,6 +89,39 @@ protected:
     void InferBatch(const std::vector<cv::Mat>& frames,
                     const std::function<void(const InferenceEngine::BlobMap&, size_t)>& results_fetcher) const;
 
+    /**
+   * @brief Run network in batch mode on images drawn by a callback
+   *
+   * @param num_images Number of input images
+   * @param write_input Callback to draw input images
+   * @param results_fetcher Callback to fetch inference results
+   */
+    void InferBatch(size_t num_images, const InputWriter& write_input,
+                    const std::function<void(const InferenceEngine::BlobMap&, size_t)>& results_fetcher) const;
+
+    /**
+   * @brief Starts network asynchronously, one infer request per batch.
+   * Batches stay in flight until WaitBatch is called for each of them.
+   *
+   * @param frames Vector of input images
+   * @return Index of the first batch, the following batches have consecutive indices
+   */
+    size_t SubmitBatches(const std::vector<cv::Mat>& frames);
+
+    /**
+   * @brief Starts network asynchronously on images drawn by a callback
+   */
+    size_t SubmitBatches(size_t num_images, const InputWriter& write_input);
+
+    /**
+   * @brief Waits for a batch started by SubmitBatches
+   *
+   * @param batch_idx Index of the batch
+   * @param results_fetcher Callback to fetch inference results
+   */
+    void WaitBatch(size_t batch_idx,
+                   const std::function<void(const InferenceEngine::BlobMap&, size_t)>& results_fetcher);
+
     /** @brief Config */
     Config config_;
     /** @brief Net inputs info */
@@ -88,6 +132,12 @@ protected:
     InferenceEngine::ExecutableNetwork executable_network_;
     /** @brief IE InferRequest */
     mutable InferenceEngine::InferRequest infer_request_;
+    /** @brief IE InferRequests of asynchronous batches, created on demand */
+    std::vector<InferenceEngine::InferRequest> async_requests_;
+    /** @brief Sizes of asynchronous batches in flight */
+    std::vector<size_t> async_batch_sizes_;
+    /** @brief Number of asynchronous batches already waited for */
+    size_t async_num_waited_ = 0;
     /** @brief Name of the input blob input blob */
     std::string input_blob_name_;
     /** @brief Names of output blobs */
@@ -102,6 +152,47 @@ public:
                  cv::Mat* vector, cv::Size outp_shape = cv::Size()) const;
     void Compute(const std::vector<cv::Mat>& images,
                  std::vector<cv::Mat>* vectors, cv::Size outp_shape = cv::Size()) const;
+    void Compute(size_t num_images, const InputWriter& write_input,
+                 std::vector<cv::Mat>* vectors, cv::Size outp_shape = cv::Size()) const;
+
+    /**
+    * @brief Starts computing vectors of images without waiting for them
+    * @return Index of the first batch, images are split in batches of max_batch_size
+    */
+    size_t Submit(const std::vector<cv::Mat>& images);
+    size_t Submit(size_t num_images, const InputWriter& write_input);
+
+    /**
+    * @brief Waits for a batch started by Submit and appends its vectors
+    */
+    void Wait(size_t batch_idx, std::vector<cv::Mat>* vectors, cv::Size outp_shape = cv::Size());
+};
+
+/**
+* @brief Resizes frames to network input sizes in buffers that are allocated
+* once per size. Detectors sharing a resizer resize a frame to the same input
+* size only once, so NewFrame must be called before every new frame.
+*/
+class FrameResizer {
+public:
+    /**
+    * @brief Invalidates frames resized so far
+    */
+    void NewFrame() { frame_idx_++; }
+
+    /**
+    * @brief Returns the current frame resized to the given size
+    */
+    const cv::Mat& Resize(const cv::Mat& frame, const cv::Size& size);
+
+private:
+    struct Buffer {
+        cv::Size size;
+        size_t frame_idx;
+        cv::Mat image;
+    };
+    std::vector<Buffer> buffers_;
+    size_t frame_idx_ = 1;
 };
 
 class AsyncAlgorithm {
@@ -129,11 +220,39 @@ public:
     std::vector<T> fetchResults() override { return {}; }
 };
 
+///
+/// \brief Base class of detectors that run one frame per infer request.
+///
+/// Several frames may be in flight: every submitted request is queued and
+/// wait() takes the oldest one, whose results are then fetched, and which is
+/// reused for the next enqueued frame.
+///
 class BaseCnnDetection : public AsyncAlgorithm {
 protected:
+    /** @brief Request that is filled by enqueue or was waited for last */
     InferenceEngine::InferRequest::Ptr request;
+    /** @brief Submitted requests, the oldest first */
+    std::deque<InferenceEngine::InferRequest::Ptr> inFlight;
     const bool isAsync;
     std::string topoName;
+    /** @brief Resizer of input frames, shared between detectors or owned */
+    std::shared_ptr<FrameResizer> frameResizer;
+    bool ownsResizer = false;
+    /** @brief Whether the input is resized by IE preprocessing */
+    bool resizeInPlugin = false;
+    /** @brief Copies of the frames that the input blobs wrap if resizeInPlugin is set */
+    std::map<const InferenceEngine::InferRequest*, cv::Mat> pluginInputs;
+
+    /**
+    * @brief Sets preprocessing of inputs, must be called before the network is loaded
+    */
+    void setPreprocessing(const InferenceEngine::InputInfo::Ptr& inputInfo,
+                          const std::shared_ptr<FrameResizer>& resizer, bool inPlugin);
+
+    /**
+    * @brief Puts a frame to the input blob of the request
+    */
+    void setInputFrame(const std::string& inputName, const cv::Mat& frame);
 
 public:
     explicit BaseCnnDetection(bool isAsync = false) :
@@ -146,15 +265,25 @@ public:
         } else {
             request->Infer();
         }
+        inFlight.push_back(request);
+        request = nullptr;
     }
 
     void wait() override {
-        if (!request || !isAsync) return;
+        CVL_TRACE_SCOPE("BaseCnnDetection::wait");
+        if (inFlight.empty()) return;
+        request = inFlight.front();
+        inFlight.pop_front();
+        if (!isAsync) return;
         request->Wait(InferenceEngine::IInferRequest::WaitMode::RESULT_READY);
     }
 
     void printPerformanceCounts(const std::string &fullDeviceName) override {
+        // nothing ran if no request was ever submitted
+        auto counted = request;
+        if (counted == nullptr && !inFlight.empty()) counted = inFlight.front();
+        if (counted == nullptr) return;
         std::cout << "Performance counts for " << topoName << std::endl << std::endl;
-        ::printPerformanceCounts(*request, std::cout, fullDeviceName, false);
+        ::printPerformanceCounts(*counted, std::cout, fullDeviceName, false);
     }
 };
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "cnn.hpp"
+#include "detector.hpp"
+#include "action_detector.hpp"
+#include "../../INCLUDE/DetectionCache.hpp"
+
+///
+/// \brief Streams of the detection cache, one per detector of a run.
+///
+enum DetectionStream : uint32_t {
+    FACE_STREAM = 1,
+    ACTION_STREAM = 2
+};
+
+CachedDetection ToCachedDetection(const detection::DetectedObject& face);
+CachedDetection ToCachedDetection(const DetectedAction& action);
+template <typename T> T FromCachedDetection(const CachedDetection& cached);
+template <> detection::DetectedObject FromCachedDetection(const CachedDetection& cached);
+template <> DetectedAction FromCachedDetection(const CachedDetection& cached);
+
+///
+/// \brief Detector that writes the results of another detector to a
+/// detection cache, by the index of the frame in the input.
+///
+template <typename T>
+class RecordingDetection : public AsyncDetection<T> {
+public:
+    ///
+    /// \param[in] detector Detector to record.
+    /// \param[in] writer Cache to write to, may be shared by several detectors.
+    /// \param[in] stream Stream of the detector in the cache.
+    /// \param[in] first_frame Index of the first enqueued frame in the input.
+    ///
+    RecordingDetection(std::unique_ptr<AsyncDetection<T>> detector,
+                       const SPCDetectionCacheWriter& writer,
+                       DetectionStream stream, int first_frame)
+        : detector_(std::move(detector)), writer_(writer),
+          stream_(stream), next_frame_(first_frame) {}
+
+    void enqueue(const cv::Mat& frame) override {
+        frames_.push_back(next_frame_++);
+        detector_->enqueue(frame);
+    }
+    void submitRequest() override { detector_->submitRequest(); }
+    void wait() override { detector_->wait(); }
+    void printPerformanceCounts(const std::string& fullDeviceName) override {
+        detector_->printPerformanceCounts(fullDeviceName);
+    }
+
+    std::vector<T> fetchResults() override {
+        auto results = detector_->fetchResults();
+        if (!frames_.empty()) {
+            std::vector<CachedDetection> cached;
+            for (const auto& r : results) {
+                cached.push_back(ToCachedDetection(r));
+            }
+            writer_->Write(stream_, static_cast<uint32_t>(frames_.front()), cached);
+            frames_.pop_front();
+        }
+        return results;
+    }
+
+private:
+    std::unique_ptr<AsyncDetection<T>> detector_;
+    SPCDetectionCacheWriter writer_;
+    DetectionStream stream_;
+    int next_frame_;
+    std::deque<int> frames_;  ///< Input indices of frames in flight, the oldest first.
+};
+
+///
+/// \brief Detector that serves results recorded by RecordingDetection,
+/// frames that were not recorded have no detections.
+///
+template <typename T>
+class ReplayDetection : public AsyncDetection<T> {
+public:
+    ReplayDetection(const SPCDetectionCacheReader& reader,
+                    DetectionStream stream, int first_frame)
+        : reader_(reader), stream_(stream), next_frame_(first_frame) {}
+
+    void enqueue(const cv::Mat&) override { frames_.push_back(next_frame_++); }
+    void submitRequest() override {}
+    void wait() override {}
+    void printPerformanceCounts(const std::string&) override {}
+
+    std::vector<T> fetchResults() override {
+        std::vector<T> results;
+        if (!frames_.empty()) {
+            for (const auto& cached : reader_->Get(stream_, static_cast<uint32_t>(frames_.front()))) {
+                results.push_back(FromCachedDetection<T>(cached));
+            }
+            frames_.pop_front();
+        }
+        return results;
+    }
+
+private:
+    SPCDetectionCacheReader reader_;
+    DetectionStream stream_;
+    int next_frame_;
+    std::deque<int> frames_;
+};
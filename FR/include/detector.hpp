@@ -5,6 +5,7 @@
 #pragma once
 
 #include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -34,6 +35,10 @@ struct DetectorConfig : public CnnConfig {
     bool is_async = true;
     int input_h = 600;
     int input_w = 600;
+    /** @brief Resize input frames by Inference Engine preprocessing */
+    bool resize_in_plugin = false;
+    /** @brief Resizer shared with other detectors, the detector owns one if it is not set */
+    std::shared_ptr<FrameResizer> frame_resizer;
 };
 
 class FaceDetection : public AsyncDetection<DetectedObject>, public BaseCnnDetection {
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+#include <opencv2/core/core.hpp>
+
+///
+/// \brief The EmbeddingsCache class stores face reid embeddings of gallery
+/// images on disk, so that unchanged images are not run through the networks
+/// on every start.
+///
+/// The file is a fixed header followed by fixed-size records
+/// {path hash, content hash, float[dim]}, so it can be read in one pass or
+/// memory-mapped as is. The whole file is invalidated when the model hash
+/// (the networks and registration settings) changes.
+///
+class EmbeddingsCache {
+public:
+    ///
+    /// \brief Loads the cache file if it exists and matches the model hash.
+    /// \param[in] path Path to the cache file.
+    /// \param[in] model_hash Hash of everything the embeddings depend on.
+    ///
+    EmbeddingsCache(const std::string& path, uint64_t model_hash);
+
+    ///
+    /// \brief Finds an embedding of an image.
+    /// \param[in] image_path Path of the gallery image.
+    /// \param[in] content_hash Hash of the image file content.
+    /// \param[out] embedding Cached embedding.
+    /// \return true if the image with the same content is in the cache.
+    ///
+    bool Find(const std::string& image_path, uint64_t content_hash, cv::Mat* embedding);
+
+    ///
+    /// \brief Adds or replaces an embedding of an image.
+    ///
+    void Put(const std::string& image_path, uint64_t content_hash, const cv::Mat& embedding);
+
+    ///
+    /// \brief Marks the embedding of an image unused, so that the next Flush
+    /// drops it.
+    ///
+    void Release(const std::string& image_path);
+
+    ///
+    /// \brief Writes the cache file if it changed. Entries that were neither
+    /// found nor put since loading are dropped.
+    ///
+    void Flush();
+
+    ///
+    /// \brief FNV-1a hash of a memory block.
+    ///
+    static uint64_t Hash(const void* data, size_t size, uint64_t seed = kHashSeed);
+
+    static const uint64_t kHashSeed = 14695981039346656037ULL;
+
+private:
+    struct Entry {
+        uint64_t content_hash;
+        cv::Mat embedding;  ///< CV_32F column of dim_ elements.
+        bool used;
+    };
+
+    std::string path_;
+    uint64_t model_hash_;
+    int dim_ = 0;
+    bool dirty_ = false;
+    std::unordered_map<uint64_t, Entry> entries_;  ///< Keyed by the image path hash.
+};
@@ -5,24 +5,30 @@
 #pragma once
 
 #include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
 #include <opencv2/core/core.hpp>
+#include <opencv2/flann.hpp>
 
 #include "cnn.hpp"
 #include "detector.hpp"
+#include "embeddings_cache.hpp"
+#include "tracker.hpp"
 
 enum class RegistrationStatus {
   SUCCESS,
   FAILURE_LOW_QUALITY,
   FAILURE_NOT_DETECTED,
+  FAILURE_NOT_LOADED,
 };
 
 struct GalleryObject {
     std::vector<cv::Mat> embeddings;
     std::string label;
     int id;
+    std::vector<std::string> image_paths;  // images the embeddings were computed from
 
     GalleryObject(const std::vector<cv::Mat>& embeddings,
                   const std::string& label, int id)
@@ -38,27 +44,59 @@ public:
                       bool crop_gallery, const detection::DetectorConfig &detector_config,
                       const VectorCNN& landmarks_det,
                       const VectorCNN& image_reid,
-                      bool use_greedy_matcher=false);
+                      bool use_greedy_matcher=false,
+                      int ann_min_gallery_size=0,
+                      int ann_top_k=5,
+                      const std::string& cache_path="");
+    // Gallery of precomputed embeddings, e.g. recorded ones for benchmarks. It has
+    // no networks, so identities cannot be registered from images.
+    EmbeddingsGallery(const std::vector<GalleryObject>& identities, double threshold,
+                      bool use_greedy_matcher=false,
+                      int ann_min_gallery_size=0,
+                      int ann_top_k=5);
     size_t size() const;
     std::vector<int> GetIDsByEmbeddings(const std::vector<cv::Mat>& embeddings) const;
     std::string GetLabelByID(int id) const;
     std::vector<std::string> GetIDToLabelMap() const;
     bool LabelExists(const std::string& label) const;
 
+    // Registers a face image under the label, replacing the previous one if the label exists.
+    // A label keeps its identity id when replaced or removed and added again, and ids of
+    // other labels are never reused, so labels of already tracked faces stay valid.
+    RegistrationStatus AddIdentity(const std::string& label, const std::string& image_path);
+    bool RemoveIdentity(const std::string& label);
+
 private:
-    RegistrationStatus RegisterIdentity(const std::string& identity_label,
-                                        const cv::Mat& image,
-                                        int min_size_fr,
-                                        bool crop_gallery,
-                                        detection::FaceDetection& detector,
-                                        const VectorCNN& landmarks_det,
-                                        const VectorCNN& image_reid,
-                                        cv::Mat & embedding);
+    void RegisterIdentities(const std::vector<cv::Mat>& images,
+                            std::vector<cv::Mat>* embeddings,
+                            std::vector<RegistrationStatus>* statuses);
+    void ComputeEmbeddings(const std::vector<std::string>& paths,
+                           std::vector<cv::Mat>* embeddings,
+                           std::vector<RegistrationStatus>* statuses);
+    void ReleaseImages(const GalleryObject& identity, const std::string& kept_path = "");
+    void RebuildMatrix();
+    void BuildIndex();
+    cv::Mat ComputeDistances(const cv::Mat& queries, std::vector<int>* columns) const;
     std::vector<int> idx_to_id;
+    cv::Mat gallery_embeddings;  // L2-normalized embeddings, one row per idx_to_id entry
     double reid_threshold;
     std::vector<GalleryObject> identities;
     bool use_greedy_matcher;
+    int ann_min_gallery_size;
+    int ann_top_k;
+    cv::Ptr<cv::flann::Index> ann_index;  // built over gallery_embeddings for large galleries only
+    int min_size_fr;
+    bool crop_gallery;
+    const VectorCNN* landmarks_det;  // null in galleries of precomputed embeddings
+    const VectorCNN* image_reid;
+    std::unique_ptr<detection::FaceDetection> detector;  // created only if crop_gallery is set
+    std::unique_ptr<EmbeddingsCache> cache;
 };
 
-void AlignFaces(std::vector<cv::Mat>* face_images,
-                std::vector<cv::Mat>* landmarks_vec);
+///
+/// \brief Aligns a face by its landmarks and resizes it to the size of *aligned.
+/// \param[in] face_image Face crop.
+/// \param[in] landmarks 5x2 landmarks normalized to the crop size.
+/// \param[in,out] aligned Preallocated output image.
+///
+void AlignFace(const cv::Mat& face_image, const cv::Mat& landmarks, cv::Mat* aligned);
@@ -5,16 +5,44 @@
 #pragma once
 
 #include <opencv2/opencv.hpp>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 class ImageGrabber {
 public:
     explicit ImageGrabber(const std::string& fname);
+    ~ImageGrabber();
+
+    ///
+    /// \brief Starts decoding frames ahead in a background thread.
+    /// \param[in] depth Max number of decoded frames waiting to be grabbed.
+    ///
+    /// After this call Retrieve() hands over a decoded frame and takes the
+    /// previous buffer of img to decode later frames into, so the caller must
+    /// not keep other references to that buffer.
+    ///
+    void StartPrefetch(size_t depth);
+
+    ///
+    /// \brief Restricts grabbing to a range of frames of the video.
+    /// \param[in] first_frame Index of the first frame to grab.
+    /// \param[in] num_frames Number of frames to grab, negative means all.
+    /// \return false if the video has no frame first_frame.
+    ///
+    /// If the video cannot seek exactly, the frames up to first_frame are
+    /// grabbed, from the start of the video if the seek went past it.
+    ///
+    bool SetRange(int first_frame, int num_frames);
+
     bool GrabNext();
     bool Retrieve(cv::Mat& img);
     bool IsOpened() const;
     int GetFPS() const;
+    int GetFrameCount() const;
     std::string GetVideoPath() const;
 
 private:
@@ -26,4 +54,20 @@ private:
     std::vector<std::vector<int>> frames;
     int current_video_idx;
     int current_frame_idx;
+
+    bool GrabFrame();
+    void PrefetchLoop();
+
+    int frames_left = -1;
+
+    size_t prefetch_depth = 0;
+    int fps = 0;
+    std::thread prefetch_thread;
+    std::mutex prefetch_mutex;
+    std::condition_variable prefetch_cond;
+    std::deque<cv::Mat> decoded_frames;
+    std::vector<cv::Mat> free_frames;
+    cv::Mat grabbed_frame;
+    bool decoding_done = false;
+    bool stop_prefetch = false;
 };
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+///
+/// \brief The RecognitionCache class keeps face identities of reid tracks,
+/// so that faces of a track are run through the landmarks and reid networks
+/// only until the identity of the track is established, and then once in a
+/// while to catch identity switches.
+///
+/// An identity is confident after min_streak consecutive recognitions of the
+/// track returned it, the unknown identity included. A confident identity is
+/// reused for refresh_interval frames after the last recognition.
+///
+class RecognitionCache {
+public:
+    ///
+    /// \brief Constructor.
+    /// \param[in] refresh_interval Max number of frames between recognitions
+    /// of a track, zero or negative disables caching.
+    /// \param[in] min_streak Number of equal identities in a row to trust.
+    ///
+    RecognitionCache(int refresh_interval, int min_streak);
+
+    ///
+    /// \brief Looks up identities of faces.
+    /// \param[in] track_ids Predicted track of each face, -1 for new tracks.
+    /// \param[in] frame_idx Index of the current frame.
+    /// \param[out] ids Cached identity of faces that need no recognition.
+    /// \param[out] need_recognition Whether a face has to be recognized.
+    ///
+    void Lookup(const std::vector<int>& track_ids, int frame_idx,
+                std::vector<int>* ids, std::vector<char>* need_recognition) const;
+
+    ///
+    /// \brief Stores identities of faces recognized in a frame.
+    /// \param[in] track_ids Track each face was added to.
+    /// \param[in] ids Identity of each face.
+    /// \param[in] recognized Whether a face was recognized, not looked up.
+    /// \param[in] frame_idx Index of the current frame.
+    ///
+    void Update(const std::vector<int>& track_ids, const std::vector<int>& ids,
+                const std::vector<char>& recognized, int frame_idx);
+
+    ///
+    /// \brief Forgets all identities, e.g. after the gallery has changed.
+    ///
+    void Clear();
+
+private:
+    struct Entry {
+        int id;
+        int streak;
+        int last_recognized;
+    };
+
+    int refresh_interval_;
+    int min_streak_;
+    int last_pruned_ = 0;
+    std::unordered_map<int, Entry> entries_;  ///< Keyed by the track id.
+};
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "tracker.hpp"
+
+///
+/// \brief A range of frames of a video that is processed by one worker.
+///
+/// Consecutive shards of a video overlap by a few frames, the objects seen
+/// in the overlap are used to stitch tracks of the shards together.
+///
+struct VideoShard {
+    std::string video_path;
+    int video_idx;    ///< Index of the video in the input list.
+    int first_frame;  ///< Index of the first frame in the video.
+    int num_frames;   ///< Number of frames with the overlap, negative for the rest of the video.
+};
+
+///
+/// \brief Face tracks and actions found in a shard, frame indices are
+/// relative to the first frame of the shard.
+///
+struct ShardResult {
+    std::vector<Track> face_tracks;
+    std::vector<std::map<int, int>> face_obj_id_to_action_maps;
+    /// Sum of the L2-normalized reid embeddings of the recognized faces of
+    /// each face track, by the object id of the track.
+    std::map<int, cv::Mat> face_track_embeddings;
+};
+
+///
+/// \brief Splits videos into shards of about equal length.
+/// \param[in] videos Paths of the videos.
+/// \param[in] frame_counts Number of frames in each video.
+/// \param[in] num_shards Number of shards to split all the videos into.
+/// \param[in] overlap_frames Number of frames shared by consecutive shards.
+/// \return Shards of each video, in the order of videos and frames.
+///
+std::vector<VideoShard> SplitIntoShards(const std::vector<std::string>& videos,
+                                        const std::vector<int>& frame_counts,
+                                        int num_shards, int overlap_frames);
+
+///
+/// \brief Stitches results of consecutive shards of a video.
+///
+/// Tracks of neighbouring shards are the same track if their boxes overlap
+/// in the common frames and their identities do not contradict each other.
+/// Tracks that both have reid embeddings must also look alike, so that
+/// unknown persons passing each other in the overlap are not swapped.
+/// Each frame of the overlap is taken from one shard only: the first half
+/// from the earlier shard, the second half from the later one. Frames that
+/// no shard has processed, e.g. after a shard that stopped early, get no
+/// faces.
+///
+/// \param[in] shards Consecutive shards of one video.
+/// \param[in] results Results of the shards.
+/// \param[in] min_iou Min mean IoU of boxes in the overlap to join tracks.
+/// \param[in] max_reid_distance Max cosine distance between the mean reid
+/// embeddings of tracks to join them.
+/// \param[out] face_tracks Face tracks of the whole video.
+/// \param[out] face_obj_id_to_action_maps Actions of face tracks in each frame.
+///
+void StitchShards(const std::vector<VideoShard>& shards,
+                  const std::vector<ShardResult>& results,
+                  float min_iou, float max_reid_distance,
+                  std::vector<Track>* face_tracks,
+                  std::vector<std::map<int, int>>* face_obj_id_to_action_maps);
@@ -32,6 +32,16 @@ static const char target_device_message_face_reid[] = "Optional. Specify the tar
                                                       "Use \"-d HETERO:<comma-separated_devices_list>\" format to specify HETERO plugin. "
                                                       "The application looks for a suitable plugin for the specified device.";
 static const char greedy_reid_matching_message[] = "Optional. Use faster greedy matching algorithm in face reid.";
+static const char reid_ann_min_size_message[] = "Optional. Minimum faces gallery size to match faces through an approximate "
+                                                "nearest-neighbour index. If it is zero or negative, the exact matching is always used.";
+static const char reid_ann_top_k_message[] = "Optional. Number of nearest gallery candidates per face for approximate matching.";
+static const char hard_nms_message[] = "Optional. Merge overlapping person/action detections by faster hard NMS "
+                                       "instead of Soft-NMS.";
+static const char ie_resize_message[] = "Optional. Resize frames for the face and person/action detectors "
+                                        "by Inference Engine preprocessing instead of OpenCV.";
+static const char reid_refresh_message[] = "Optional. Number of frames to reuse an established identity of a face track "
+                                           "before recognizing its face again. Zero recognizes all faces on every frame.";
+static const char reid_min_streak_message[] = "Optional. Number of equal identities in a row that establish an identity of a face track.";
 static const char performance_counter_message[] = "Optional. Enables per-layer performance statistics.";
 static const char custom_cldnn_message[] = "Optional. For GPU custom kernels, if any. "
                                            "Absolute path to an .xml file with the kernels description.";
@@ -42,10 +52,21 @@ static const char person_threshold_output_message[] = "Optional. Probability thr
 static const char action_threshold_output_message[] = "Optional. Probability threshold for action recognition.";
 static const char threshold_output_message_face_reid[] = "Optional. Cosine distance threshold between two vectors for face reidentification.";
 static const char reid_gallery_path_message[] = "Optional. Path to a faces gallery in .json format.";
+static const char reid_gallery_cache_message[] = "Optional. Path to a file to cache faces gallery embeddings in. "
+                                                 "Only new or changed gallery images are processed on start.";
 static const char output_video_message[] = "Optional. File to write output video with visualization to.";
 static const char act_stat_output_message[] = "Optional. Output file name to save per-person action statistics in.";
 static const char raw_output_message[] = "Optional. Output Inference results as raw values.";
 static const char no_show_processed_video[] = "Optional. Do not show processed video.";
+static const char batch_message[] = "Optional. Process a recorded video as fast as possible: decode ahead, "
+                                    "keep several frames in flight and skip all visualization.";
+static const char batch_inflight_message[] = "Optional. Number of frames in flight in the detectors in batch mode.";
+static const char shards_message[] = "Optional. Number of workers to process recorded videos (-i may list them separated "
+                                     "by a comma) in parallel time shards. Only student actions are supported.";
+static const char shard_overlap_message[] = "Optional. Overlap of consecutive shards in seconds, used to stitch face tracks.";
+static const char record_det_message[] = "Optional. File to record face and action detections of every frame to.";
+static const char replay_det_message[] = "Optional. File of detections recorded with -record_det to use instead of running "
+                                         "the face and action detectors, to tune tracking without inference.";
 static const char input_image_height_output_message[] = "Optional. Input image height for face detector.";
 static const char input_image_width_output_message[] = "Optional. Input image width for face detector.";
 static const char expand_ratio_output_message[] = "Optional. Expand ratio for bbox before face recognition.";
@@ -77,6 +98,12 @@ DEFINE_string(d_fd, "CPU", target_device_message_face_detection);
 DEFINE_string(d_lm, "CPU", target_device_message_landmarks_regression);
 DEFINE_string(d_reid, "CPU", target_device_message_face_reid);
 DEFINE_bool(greedy_reid_matching, false, greedy_reid_matching_message);
+DEFINE_int32(reid_ann_min_size, 10000, reid_ann_min_size_message);
+DEFINE_int32(reid_ann_top_k, 5, reid_ann_top_k_message);
+DEFINE_bool(hard_nms, false, hard_nms_message);
+DEFINE_bool(ie_resize, false, ie_resize_message);
+DEFINE_int32(reid_refresh, 30, reid_refresh_message);
+DEFINE_int32(reid_min_streak, 3, reid_min_streak_message);
 DEFINE_bool(pc, false, performance_counter_message);
 DEFINE_string(c, "", custom_cldnn_message);
 DEFINE_string(l, "", custom_cpu_library_message);
@@ -87,8 +114,15 @@ DEFINE_double(t_ar, 0.75, action_threshold_output_message);
 DEFINE_double(t_fd, 0.6, face_threshold_output_message);
 DEFINE_double(t_reid, 0.7, threshold_output_message_face_reid);
 DEFINE_string(fg, "", reid_gallery_path_message);
+DEFINE_string(fg_cache, "", reid_gallery_cache_message);
 DEFINE_string(out_v, "", output_video_message);
 DEFINE_bool(no_show, false, no_show_processed_video);
+DEFINE_bool(batch, false, batch_message);
+DEFINE_int32(batch_inflight, 2, batch_inflight_message);
+DEFINE_int32(shards, 0, shards_message);
+DEFINE_double(shard_overlap, 2.0, shard_overlap_message);
+DEFINE_string(record_det, "", record_det_message);
+DEFINE_string(replay_det, "", replay_det_message);
 DEFINE_int32(inh_fd, 600, input_image_height_output_message);
 DEFINE_int32(inw_fd, 600, input_image_width_output_message);
 DEFINE_double(exp_r_fd, 1.15, face_threshold_output_message);
@@ -131,6 +165,12 @@ static void showUsage() {
     std::cout << "    -d_reid '<device>'             " << target_device_message_face_reid << std::endl;
     std::cout << "    -out_v  '<path>'               " << output_video_message << std::endl;
     std::cout << "    -greedy_reid_matching          " << greedy_reid_matching_message << std::endl;
+    std::cout << "    -reid_ann_min_size             " << reid_ann_min_size_message << std::endl;
+    std::cout << "    -reid_ann_top_k                " << reid_ann_top_k_message << std::endl;
+    std::cout << "    -hard_nms                      " << hard_nms_message << std::endl;
+    std::cout << "    -ie_resize                     " << ie_resize_message << std::endl;
+    std::cout << "    -reid_refresh                  " << reid_refresh_message << std::endl;
+    std::cout << "    -reid_min_streak               " << reid_min_streak_message << std::endl;
     std::cout << "    -pc                            " << performance_counter_message << std::endl;
     std::cout << "    -r                             " << raw_output_message << std::endl;
     std::cout << "    -ad                            " << act_stat_output_message << std::endl;
@@ -142,8 +182,15 @@ static void showUsage() {
     std::cout << "    -exp_r_fd                      " << expand_ratio_output_message << std::endl;
     std::cout << "    -t_reid                        " << threshold_output_message_face_reid << std::endl;
     std::cout << "    -fg                            " << reid_gallery_path_message << std::endl;
+    std::cout << "    -fg_cache                      " << reid_gallery_cache_message << std::endl;
     std::cout << "    -teacher_id                    " << teacher_id_message << std::endl;
     std::cout << "    -no_show                       " << no_show_processed_video << std::endl;
+    std::cout << "    -batch                         " << batch_message << std::endl;
+    std::cout << "    -batch_inflight                " << batch_inflight_message << std::endl;
+    std::cout << "    -shards                        " << shards_message << std::endl;
+    std::cout << "    -shard_overlap                 " << shard_overlap_message << std::endl;
+    std::cout << "    -record_det                    " << record_det_message << std::endl;
+    std::cout << "    -replay_det                    " << replay_det_message << std::endl;
     std::cout << "    -last_frame                    " << last_frame_message << std::endl;
     std::cout << "    -min_ad                        " << min_action_duration_message << std::endl;
     std::cout << "    -d_ad                          " << same_action_time_delta_message << std::endl;
@@ -6,10 +6,14 @@
 
 #include "cnn.hpp"
 
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
 #include <memory>
-#include <set>
 #include <string>
 #include <tuple>
+#include <type_traits>
 #include <unordered_map>
 #include <utility>
 #include <vector>
@@ -56,9 +60,31 @@ public:
     ///
     std::vector<size_t> Solve(const cv::Mat &dissimilarity_matrix);
 
+    ///
+    /// \brief Solves the assignment problem reusing the solver workspace.
+    /// Rectangular matrices are solved as is, without padding to square.
+    /// \param dissimilarity_matrix CV_32F dissimilarity matrix.
+    /// \param[in,out] assignment If it has an element per row, it is used as
+    /// a warm start hint (e.g. the one of NearestHint). Pairs of the hint that
+    /// are not the cheapest of their row are ignored. On return it stores
+    /// optimal column index for each row, -1 means that there is no column for
+    /// row.
+    ///
+    void Solve(const cv::Mat &dissimilarity_matrix, std::vector<size_t> *assignment);
+
+    ///
+    /// \brief Builds a warm start hint for Solve from the rows and columns
+    /// that are each other's cheapest, e.g. tracks and the detections nearest
+    /// to them. Most of these pairs are kept by the optimal assignment when
+    /// objects move little between frames.
+    /// \param dissimilarity_matrix CV_32F dissimilarity matrix.
+    /// \param[out] hint Column index for each row, -1 for rows without a pair.
+    ///
+    void NearestHint(const cv::Mat &dissimilarity_matrix, std::vector<size_t> *hint);
+
 private:
     class Impl;
-    std::shared_ptr<Impl> impl_;  ///< Class implementation.
+    std::shared_ptr<Impl> impl_;  ///< Class implementation and its workspace.
 };
 
 ///
@@ -91,6 +117,10 @@ struct TrackerParams {
     /// restricted by this parameter. If it is negative or zero, the max number of
     /// objects in track is not restricted.
 
+    bool keep_spilled_objects;  ///< Keep objects that do not fit in the track
+    /// history, so that vector_tracks() returns complete tracks. It is needed only
+    /// to dump whole tracks and makes memory usage grow with the track length.
+
     int averaging_window_size_for_rects;  ///< The number of objects in track for averaging rects of predictions.
     int averaging_window_size_for_labels;  ///< The number of objects in track for averaging labels of predictions.
 
@@ -103,6 +133,181 @@ struct TrackerParams {
     TrackerParams();
 };
 
+///
+/// \brief The TrackHistory class stores the most recent objects of a track
+/// in a ring buffer. If its capacity is zero, the history is not bounded.
+///
+class TrackHistory {
+public:
+    template <typename History, typename Object>
+    class Iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = typename std::remove_const<Object>::type;
+        using difference_type = std::ptrdiff_t;
+        using pointer = Object *;
+        using reference = Object &;
+
+        Iterator() : history_(nullptr), idx_(0) {}
+        Iterator(History *history, size_t idx) : history_(history), idx_(idx) {}
+        Object &operator*() const { return (*history_)[idx_]; }
+        Object *operator->() const { return &(*history_)[idx_]; }
+        Iterator &operator++() { ++idx_; return *this; }
+        Iterator operator++(int) { Iterator it = *this; ++idx_; return it; }
+        bool operator==(const Iterator &other) const { return idx_ == other.idx_; }
+        bool operator!=(const Iterator &other) const { return idx_ != other.idx_; }
+
+    private:
+        History *history_;
+        size_t idx_;
+    };
+
+    using iterator = Iterator<TrackHistory, TrackedObject>;
+    using const_iterator = Iterator<const TrackHistory, const TrackedObject>;
+
+    explicit TrackHistory(size_t capacity = 0) : capacity_(capacity), head_(0) {}
+
+    bool empty() const { return buffer_.empty(); }
+    size_t size() const { return buffer_.size(); }
+    size_t capacity() const { return capacity_; }
+
+    ///
+    /// \brief operator [] returns object with specified index, the oldest
+    /// stored object has index 0.
+    ///
+    const TrackedObject &operator[](size_t i) const { return buffer_[Index(i)]; }
+    TrackedObject &operator[](size_t i) { return buffer_[Index(i)]; }
+
+    const TrackedObject &front() const { return (*this)[0]; }
+    const TrackedObject &back() const { return (*this)[size() - 1]; }
+    TrackedObject &back() { return (*this)[size() - 1]; }
+
+    ///
+    /// \brief push_back appends an object to the history.
+    /// \param obj Object to append.
+    /// \param[out] evicted The oldest object if it was evicted to make room.
+    /// \return true if the oldest object was evicted.
+    ///
+    bool push_back(const TrackedObject &obj, TrackedObject *evicted = nullptr) {
+        if (capacity_ == 0 || buffer_.size() < capacity_) {
+            buffer_.push_back(obj);
+            return false;
+        }
+        if (evicted) *evicted = buffer_[head_];
+        buffer_[head_] = obj;
+        head_ = head_ + 1 == buffer_.size() ? 0 : head_ + 1;
+        return true;
+    }
+
+    void clear() {
+        buffer_.clear();
+        head_ = 0;
+    }
+
+    iterator begin() { return iterator(this, 0); }
+    iterator end() { return iterator(this, size()); }
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, size()); }
+
+private:
+    size_t Index(size_t i) const {
+        size_t idx = head_ + i;
+        return idx < buffer_.size() ? idx : idx - buffer_.size();
+    }
+
+    TrackedObjects buffer_;
+    size_t capacity_;
+    size_t head_;  ///< Index of the oldest object in buffer_.
+};
+
+///
+/// \brief The LabelVotes class keeps frequencies of known labels of a track
+/// and its most frequent label, either over the whole track or over a sliding
+/// window of the last objects. Ties keep the label that got the count first,
+/// except after the best label loses a vote leaving the window, when the
+/// lowest of the tied labels is taken.
+///
+class LabelVotes {
+public:
+    ///
+    /// \brief Constructor.
+    /// \param window_size Number of last objects to vote, zero means all objects.
+    ///
+    explicit LabelVotes(size_t window_size = 0)
+        : window_size_(window_size), head_(0),
+          best_label_(TrackedObject::UNKNOWN_LABEL_IDX), best_count_(0) {}
+
+    ///
+    /// \brief Add adds a label of the next object of a track.
+    /// \param label Label, UNKNOWN_LABEL_IDX takes a window place but is not counted.
+    ///
+    void Add(int label) {
+        if (window_size_ > 0) {
+            if (window_.size() < window_size_) {
+                window_.push_back(label);
+            } else {
+                Count(window_[head_], -1);
+                window_[head_] = label;
+                head_ = head_ + 1 == window_size_ ? 0 : head_ + 1;
+            }
+        }
+        Count(label, 1);
+    }
+
+    ///
+    /// \brief Reset makes label the only one with given frequency.
+    ///
+    void Reset(int label, int count) {
+        counts_.clear();
+        window_.clear();
+        head_ = 0;
+        best_label_ = label;
+        best_count_ = count;
+        counts_[label] = count;
+    }
+
+    size_t window_size() const { return window_size_; }
+    int best_label() const { return best_label_; }
+    int best_count() const { return best_count_; }
+
+private:
+    void Count(int label, int delta) {
+        if (label == TrackedObject::UNKNOWN_LABEL_IDX) {
+            return;
+        }
+        int count = counts_[label] += delta;
+        if (count == 0) {
+            counts_.erase(label);
+        }
+        if (delta > 0) {
+            if (count > best_count_) {
+                best_count_ = count;
+                best_label_ = label;
+            }
+        } else if (label == best_label_) {
+            // Only a drop of the best label can change the majority. Ties go to
+            // the lowest label, so that the result does not depend on the order
+            // of the hash map.
+            best_count_ = 0;
+            best_label_ = TrackedObject::UNKNOWN_LABEL_IDX;
+            for (const auto &item : counts_) {
+                if (item.second > best_count_ ||
+                        (item.second == best_count_ && item.first < best_label_)) {
+                    best_count_ = item.second;
+                    best_label_ = item.first;
+                }
+            }
+        }
+    }
+
+    std::unordered_map<int, int> counts_;
+    std::vector<int> window_;  ///< Labels in the window, a ring buffer.
+    size_t window_size_;
+    size_t head_;
+    int best_label_;
+    int best_count_;
+};
+
 ///
 /// \brief The Track struct describes tracks.
 ///
@@ -110,10 +315,34 @@ struct Track {
     ///
     /// \brief Track constructor.
     /// \param objs Detected objects sequence.
-    ///
-    explicit Track(const TrackedObjects &objs) : objects(objs), lost(0), length(1) {
+    /// \param history_size Max number of objects kept in the track history,
+    /// zero means unbounded history.
+    /// \param label_window_size Size of the window to vote labels in besides
+    /// the whole track, zero means no window.
+    ///
+    explicit Track(const TrackedObjects &objs, size_t history_size = 0,
+                   size_t label_window_size = 0)
+        : objects(history_size), lost(0), length(0), window_labels(label_window_size) {
         CV_Assert(!objs.empty());
         first_object = objs[0];
+        for (const auto &obj : objs) {
+            Add(obj);
+        }
+    }
+
+    ///
+    /// \brief Add appends an object to the track and updates its summary.
+    /// \param obj Detected object.
+    /// \param[out] evicted The oldest object if it was evicted from the history.
+    /// \return true if an object was evicted.
+    ///
+    bool Add(const TrackedObject &obj, TrackedObject *evicted = nullptr) {
+        length++;
+        labels.Add(obj.label);
+        if (window_labels.window_size() > 0) {
+            window_labels.Add(obj.label);
+        }
+        return objects.push_back(obj, evicted);
     }
 
     ///
@@ -162,12 +391,18 @@ struct Track {
         return objects.back();
     }
 
-    TrackedObjects objects;  ///< Detected objects;
-    size_t lost;             ///< How many frames ago track has been lost.
+    TrackHistory objects;  ///< Most recent detected objects.
+    size_t lost;           ///< How many frames ago track has been lost.
 
     TrackedObject first_object;  ///< First object in track.
     size_t length;  ///< Length of a track including number of objects that were
                     /// removed from track in order to avoid memory usage growth.
+
+    LabelVotes labels;         ///< Known labels votes over the whole track.
+    LabelVotes window_labels;  ///< Known labels votes over the last objects.
+
+    TrackedObjects spilled_objects;  ///< Objects evicted from the history, kept only
+                                     /// if TrackerParams::keep_spilled_objects is set.
 };
 
 ///
@@ -191,9 +426,23 @@ public:
     /// \param[in] detections Detected objects on the frame.
     /// \param[in] timestamp Timestamp must be positive and measured in
     /// milliseconds
+    /// \param[out] track_ids Optional id of the track each detection was added
+    /// to, -1 for filtered out detections.
     ///
     void Process(const cv::Mat &frame, const TrackedObjects &detections,
-                 int frame_idx);
+                 int frame_idx, std::vector<int> *track_ids = nullptr);
+
+    ///
+    /// \brief Finds tracks that detections would be added to by Process,
+    /// without changing the tracks.
+    /// \param[in] detections Detected objects on the frame.
+    /// \param[out] track_ids Id of the matched track of each detection, -1 for
+    /// detections that would start new tracks or are filtered out.
+    ///
+    /// The next Process call reuses the assignment if it gets detections with
+    /// the same boxes, e.g. the same detections with labels set.
+    ///
+    void PredictTrackIds(const TrackedObjects &detections, std::vector<int> *track_ids);
 
     ///
     /// \brief Pipeline parameters getter.
@@ -244,15 +493,16 @@ public:
     bool IsTrackForgotten(size_t id) const;
 
     ///
-    /// \brief tracks Returns all tracks including forgotten (lost too many frames
-    /// ago).
-    /// \return Set of tracks {id, track}.
+    /// \brief track Returns a track including forgotten (lost too many frames
+    /// ago) ones, unless it was dropped.
+    /// \param id Track ID.
+    /// \return Track with the specified ID.
     ///
-    const std::unordered_map<size_t, Track> &tracks() const;
+    const Track &track(size_t id) const;
 
     ///
     /// \brief tracks Returns all tracks including forgotten (lost too many frames
-    /// ago).
+    /// ago). Spilled objects are put back into histories of returned tracks.
     /// \return Vector of tracks
     ///
     std::vector<Track> vector_tracks() const;
@@ -270,63 +520,110 @@ public:
     ///
     void DropForgottenTracks();
 
+    ///
+    /// \brief Sets a function that gets the tracks removed by
+    /// DropForgottenTracks, with spilled objects put back into their
+    /// histories, e.g. to keep the ones to dump. Without it removed tracks
+    /// are discarded.
+    /// \param[in] handler Function that takes a removed track.
+    ///
+    void set_dropped_track_handler(std::function<void(Track &&track)> handler);
+
 private:
-    const std::set<size_t> &active_track_ids() const { return active_track_ids_; }
+    using Match = std::tuple<size_t, size_t, float>;  ///< {track id, detection index, affinity}
 
-    float ShapeAffinity(const cv::Rect &trk, const cv::Rect &det);
-    float MotionAffinity(const cv::Rect &trk, const cv::Rect &det);
+    int SlotOf(size_t track_id) const;
+
+    void CollectActiveSlots(bool with_lost, std::vector<size_t> *slots) const;
+
+    void CollectActiveTrackIds(std::vector<size_t> *track_ids) const;
+
+    bool IsAssignmentPredicted() const;
 
     void SolveAssignmentProblem(
-            const std::set<size_t> &track_ids, const TrackedObjects &detections,
-            std::set<size_t> *unmatched_tracks,
-            std::set<size_t> *unmatched_detections,
-            std::set<std::tuple<size_t, size_t, float>> *matches);
+            const std::vector<size_t> &track_ids, const TrackedObjects &detections,
+            std::vector<size_t> *unmatched_tracks,
+            std::vector<Match> *matches);
     void FilterDetectionsAndStore(const TrackedObjects &detected_objects);
 
-    void ComputeDissimilarityMatrix(const std::set<size_t> &active_track_ids,
+    void ComputeDissimilarityMatrix(const std::vector<size_t> &active_track_ids,
                                     const TrackedObjects &detections,
                                     cv::Mat *dissimilarity_matrix);
 
-    std::vector<std::pair<size_t, size_t>> GetTrackToDetectionIds(
-            const std::set<std::tuple<size_t, size_t, float>> &matches);
-
-    float Distance(const TrackedObject &obj1, const TrackedObject &obj2);
-
-    void AddNewTrack(const TrackedObject &detection);
-
-    void AddNewTracks(const TrackedObjects &detections);
+    size_t AddNewTrack(const TrackedObject &detection);
 
     void AddNewTracks(const TrackedObjects &detections,
-                      const std::set<size_t> &ids);
+                      const std::vector<char> &is_matched);
 
     void AppendToTrack(size_t track_id, const TrackedObject &detection);
 
+    size_t HistorySize() const;
+
+    size_t LabelWindowSize() const;
+
     bool EraseTrackIfBBoxIsOutOfFrame(size_t track_id);
 
     bool EraseTrackIfItWasLostTooManyFramesAgo(size_t track_id);
 
     bool UptateLostTrackAndEraseIfItsNeeded(size_t track_id);
 
-    void UpdateLostTracks(const std::set<size_t> &track_ids);
+    void UpdateLostTracks(const std::vector<size_t> &track_ids);
 
     std::unordered_map<size_t, std::vector<cv::Point>> GetActiveTracks();
 
     // Parameters of the pipeline.
     TrackerParams params_;
 
-    // Indexes of active tracks.
-    std::set<size_t> active_track_ids_;
-
-    // All tracks.
-    std::unordered_map<size_t, Track> tracks_;
-
-    // Recent detections.
+    std::function<void(Track &&track)> dropped_track_handler_;
+
+    // Track store: tracks live in slots which are reused through a free list.
+    // Track ids grow monotonically and map to slots through id_to_slot_, which
+    // holds the ids of tracks that were not dropped only. Active (not
+    // forgotten) and lost slots are kept in bitsets.
+    std::vector<Track> slots_;
+    std::vector<size_t> slot_to_id_;
+    std::vector<size_t> free_slots_;
+    std::unordered_map<size_t, int> id_to_slot_;
+    std::vector<uint64_t> active_slots_;
+    std::vector<uint64_t> lost_slots_;
+
+    // Per-frame scratch buffers, reused so that steady state processing does
+    // not allocate.
+    std::vector<size_t> active_ids_;
+    std::vector<size_t> unmatched_tracks_;
+    std::vector<char> is_detection_matched_;
+    std::vector<Match> matches_;
+
+    // Recent detections, the indices of them among all detections of the
+    // frame and the ids of the tracks they were added to.
     TrackedObjects detections_;
+    std::vector<size_t> detection_indices_;
+    std::vector<int> detection_track_ids_;
 
     // Number of all current tracks.
     size_t tracks_counter_;
 
+    // Assignment solver and its last solution.
+    KuhnMunkres matcher_;
+    std::vector<size_t> assignment_;
+
+    // Boxes of the detections PredictTrackIds solved the assignment for, if
+    // matches_ and unmatched_tracks_ still hold that solution.
+    bool assignment_predicted_ = false;
+    std::vector<cv::Rect> predicted_rects_;
+
     cv::Size frame_size_;
+
+    // Last rects of active tracks and detection rects in SoA form, detections
+    // sorted by x, the pairs that pass the gate with their affinity exponents,
+    // and the dissimilarity matrix, reused between frames.
+    std::vector<float> trk_x_, trk_y_, trk_w_, trk_h_;
+    std::vector<float> det_x_, det_y_, det_w_, det_h_;
+    std::vector<int> det_order_;
+    std::vector<float> det_sorted_x_;
+    std::vector<int> pair_rows_, pair_cols_;
+    std::vector<float> pair_exponents_;
+    cv::Mat dissimilarity_;
 };
 
 int LabelWithMaxFrequencyInTrack(const Track &track, int window_size);
@@ -12,7 +12,10 @@
 #include <memory>
 #include <limits>
 #include <vector>
+#include <atomic>
 #include <deque>
+#include <functional>
+#include <thread>
 #include <map>
 #include <set>
 #include <algorithm>
@@ -23,10 +26,13 @@
 #include "action_detector.hpp"
 #include "cnn.hpp"
 #include "detector.hpp"
+#include "detection_replay.hpp"
 #include "face_reid.hpp"
 #include "tracker.hpp"
 #include "image_grabber.hpp"
 #include "logger.hpp"
+#include "recognition_cache.hpp"
+#include "shards.hpp"
 #include "smart_classroom_demo.hpp"
 #include <fr.hpp>
 
@@ -34,9 +40,19 @@ using namespace InferenceEngine;
 
 namespace {
 
+///
+/// \brief The Visualizer class draws the results over the processed frame.
+///
+/// Objects are recorded into an overlay while a frame is processed, and are
+/// drawn over a copy of the frame only when the copy goes to the window, the
+/// play callback or the output video. The source frame is never copied or
+/// modified otherwise.
+///
 class Visualizer {
 private:
+    cv::Mat source_;
     cv::Mat frame_;
+    std::vector<std::function<void(cv::Mat&)>> overlay_;
     cv::Mat top_persons_;
     const bool enabled_;
     const int num_top_persons_;
@@ -76,29 +92,56 @@ public:
         return input_size;
     }
 
+    bool IsActive() const {
+        return enabled_ || writer_.isOpened();
+    }
+
     void SetFrame(const cv::Mat& frame) {
-        if (!enabled_ && !writer_.isOpened()) {
+        overlay_.clear();
+        if (!IsActive()) {
             return;
         }
 
-        frame_ = frame.clone();
+        source_ = frame;
         rect_scale_x_ = 1;
         rect_scale_y_ = 1;
-        cv::Size new_size = GetOutputSize(frame_.size());
-        if (new_size != frame_.size()) {
-            rect_scale_x_ = static_cast<float>(new_size.height) / frame_.size().height;
-            rect_scale_y_ = static_cast<float>(new_size.width) / frame_.size().width;
-            cv::resize(frame_, frame_, new_size);
+        cv::Size new_size = GetOutputSize(source_.size());
+        if (new_size != source_.size()) {
+            rect_scale_x_ = static_cast<float>(new_size.height) / source_.size().height;
+            rect_scale_y_ = static_cast<float>(new_size.width) / source_.size().width;
         }
     }
 
-    void Show(FR *fr = nullptr) const {
-        if (enabled_) {
+    ///
+    /// \brief Adds a drawing to the overlay, e.g. performance graphs.
+    ///
+    void DrawOverlay(std::function<void(cv::Mat&)> draw) {
+        if (IsActive()) {
+            overlay_.push_back(std::move(draw));
+        }
+    }
+
+    void Show(FR *fr = nullptr) {
+        const bool play = enabled_ && fr && fr->iPlay;
+        if (!play && !writer_.isOpened()) {
+            source_ = cv::Mat();
+            return;
+        }
+
+        // frame_ keeps its buffer between frames, so composing does not allocate
+        if (source_.size() != GetOutputSize(source_.size())) {
+            cv::resize(source_, frame_, GetOutputSize(source_.size()));
+        } else {
+            source_.copyTo(frame_);
+        }
+        for (const auto& draw : overlay_) {
+            draw(frame_);
+        }
+        source_ = cv::Mat();
+
+        if (play) {
             //cv::imshow(main_window_name_, frame_);
-            if (fr && fr->iPlay)
-            {
-              fr->ProcessFrame(frame_);
-            }             
+            fr->ProcessFrame(frame_);
         }
 
         if (writer_.isOpened()) {
@@ -115,33 +158,23 @@ public:
             return;
         }
 
-        if (rect_scale_x_ != 1 || rect_scale_y_ != 1) {
-            roi.x = cvRound(roi.x * rect_scale_x_);
-            roi.y = cvRound(roi.y * rect_scale_y_);
-
-            roi.height = cvRound(roi.height * rect_scale_y_);
-            roi.width = cvRound(roi.width * rect_scale_x_);
-        }
-
         roi.x = std::max(0, roi.x);
         roi.y = std::max(0, roi.y);
-        roi.width = std::min(roi.width, frame_.cols - roi.x);
-        roi.height = std::min(roi.height, frame_.rows - roi.y);
+        roi.width = std::min(roi.width, source_.cols - roi.x);
+        roi.height = std::min(roi.height, source_.rows - roi.y);
 
         const auto crop_label = std::to_string(id + 1);
 
-        auto frame_crop = frame_(roi).clone();
-        cv::resize(frame_crop, frame_crop, cv::Size(crop_width_, crop_height_));
-
         const int shift = (id + 1) * margin_size_ + id * crop_width_;
-        frame_crop.copyTo(top_persons_(cv::Rect(shift, header_size_, crop_width_, crop_height_)));
+        cv::Mat crop = top_persons_(cv::Rect(shift, header_size_, crop_width_, crop_height_));
+        cv::resize(source_(roi), crop, crop.size());
 
         cv::imshow(top_window_name_, top_persons_);
     }
 
     void DrawObject(cv::Rect rect, const std::string& label_to_draw,
                     const cv::Scalar& text_color, const cv::Scalar& bbox_color, bool plot_bg) {
-        if (!enabled_ && !writer_.isOpened()) {
+        if (!IsActive()) {
             return;
         }
 
@@ -152,28 +185,32 @@ public:
             rect.height = cvRound(rect.height * rect_scale_y_);
             rect.width = cvRound(rect.width * rect_scale_x_);
         }
-        cv::rectangle(frame_, rect, bbox_color);
-
-        if (plot_bg && !label_to_draw.empty()) {
-            int baseLine = 0;
-            const cv::Size label_size =
-                cv::getTextSize(label_to_draw, cv::FONT_HERSHEY_PLAIN, 1, 1, &baseLine);
-            cv::rectangle(frame_, cv::Point(rect.x, rect.y - label_size.height),
-                            cv::Point(rect.x + label_size.width, rect.y + baseLine),
-                            bbox_color, cv::FILLED);
-        }
-        if (!label_to_draw.empty()) {
-            cv::putText(frame_, label_to_draw, cv::Point(rect.x, rect.y), cv::FONT_HERSHEY_SIMPLEX, 1,
-                        text_color, 2, cv::LINE_AA);
-        }
+        overlay_.push_back([=](cv::Mat& frame) {
+            cv::rectangle(frame, rect, bbox_color);
+
+            if (plot_bg && !label_to_draw.empty()) {
+                int baseLine = 0;
+                const cv::Size label_size =
+                    cv::getTextSize(label_to_draw, cv::FONT_HERSHEY_PLAIN, 1, 1, &baseLine);
+                cv::rectangle(frame, cv::Point(rect.x, rect.y - label_size.height),
+                                cv::Point(rect.x + label_size.width, rect.y + baseLine),
+                                bbox_color, cv::FILLED);
+            }
+            if (!label_to_draw.empty()) {
+                cv::putText(frame, label_to_draw, cv::Point(rect.x, rect.y), cv::FONT_HERSHEY_SIMPLEX, 1,
+                            text_color, 2, cv::LINE_AA);
+            }
+        });
     }
 
     void DrawFPS(const float fps, const cv::Scalar& color) {
         if (enabled_ && !writer_.isOpened()) {
-            cv::putText(frame_,
-                        std::to_string(static_cast<int>(fps)) + " fps",
-                        cv::Point(10, 50), cv::FONT_HERSHEY_SIMPLEX, 1,
-                        color, 2, cv::LINE_AA);
+            const auto fps_text = std::to_string(static_cast<int>(fps)) + " fps";
+            overlay_.push_back([=](cv::Mat& frame) {
+                cv::putText(frame, fps_text,
+                            cv::Point(10, 50), cv::FONT_HERSHEY_SIMPLEX, 1,
+                            color, 2, cv::LINE_AA);
+            });
         }
     }
 
@@ -422,6 +459,46 @@ std::map<int, int> GetMapFaceTrackIdToLabel(const std::vector<Track>& face_track
     return face_track_id_to_label;
 }
 
+void DumpFaceTracks(DetectionsLogger& logger, const std::string& video_path, const cv::Size& frame_size,
+                    const std::vector<Track>& face_tracks,
+                    const std::vector<std::map<int, int>>& face_obj_id_to_action_maps,
+                    const std::vector<std::string>& face_id_to_label_map,
+                    const std::vector<std::string>& actions_map,
+                    int smooth_window_size, int smooth_min_length) {
+    // correct labels for track
+    std::vector<Track> new_face_tracks = UpdateTrackLabelsToBestAndFilterOutUnknowns(face_tracks);
+    std::map<int, int> face_track_id_to_label = GetMapFaceTrackIdToLabel(new_face_tracks);
+
+    if (!face_id_to_label_map.empty()) {
+        std::map<int, FrameEventsTrack> face_obj_id_to_actions_track;
+        ConvertActionMapsToFrameEventTracks(face_obj_id_to_action_maps, default_action_index,
+                                            &face_obj_id_to_actions_track);
+
+        const int start_frame = 0;
+        const int end_frame = face_obj_id_to_action_maps.size();
+        std::map<int, RangeEventsTrack> face_obj_id_to_events;
+        SmoothTracks(face_obj_id_to_actions_track, start_frame, end_frame,
+                     smooth_window_size, smooth_min_length, default_action_index,
+                     &face_obj_id_to_events);
+
+        slog::info << "Final ID->events mapping" << slog::endl;
+        logger.DumpTracks(face_obj_id_to_events,
+                          actions_map, face_track_id_to_label,
+                          face_id_to_label_map);
+
+        std::vector<std::map<int, int>> face_obj_id_to_smoothed_action_maps;
+        ConvertRangeEventsTracksToActionMaps(end_frame, face_obj_id_to_events,
+                                             &face_obj_id_to_smoothed_action_maps);
+
+        slog::info << "Final per-frame ID->action mapping" << slog::endl;
+        logger.DumpDetections(video_path, frame_size, face_obj_id_to_action_maps.size(),
+                              new_face_tracks,
+                              face_track_id_to_label,
+                              actions_map, face_id_to_label_map,
+                              face_obj_id_to_smoothed_action_maps);
+    }
+}
+
 bool checkDynamicBatchSupport(const Core& ie, const std::string& device)  {
     try  {
         if (ie.GetConfig(device, CONFIG_KEY(DYN_BATCH_ENABLED)).as<std::string>() != PluginConfigParams::YES)
@@ -441,7 +518,14 @@ public:
     virtual std::string GetLabelByID(int id) const = 0;
     virtual std::vector<std::string> GetIDToLabelMap() const = 0;
 
-    virtual std::vector<int> Recognize(const cv::Mat& frame, const detection::DetectedObjects& faces) = 0;
+    // Starts recognition of faces, the frame must stay unchanged until FetchRecognition.
+    virtual void SubmitRecognition(const cv::Mat& frame, const detection::DetectedObjects& faces) = 0;
+    virtual std::vector<int> FetchRecognition() = 0;
+    // Reid embeddings of the faces of the last FetchRecognition, empty if faces are not recognized.
+    virtual const std::vector<cv::Mat>& LastEmbeddings() const = 0;
+
+    virtual bool AddIdentity(const std::string &label, const std::string &image_path) = 0;
+    virtual bool RemoveIdentity(const std::string &label) = 0;
 
     virtual void PrintPerformanceCounts(
         const std::string &landmarks_device, const std::string &reid_device) = 0;
@@ -457,12 +541,26 @@ public:
 
     std::vector<std::string> GetIDToLabelMap() const override { return {}; }
 
-    std::vector<int> Recognize(const cv::Mat&, const detection::DetectedObjects& faces) override {
-        return std::vector<int>(faces.size(), EmbeddingsGallery::unknown_id);
+    void SubmitRecognition(const cv::Mat&, const detection::DetectedObjects& faces) override {
+        num_faces = faces.size();
+    }
+
+    std::vector<int> FetchRecognition() override {
+        return std::vector<int>(num_faces, EmbeddingsGallery::unknown_id);
     }
 
+    const std::vector<cv::Mat>& LastEmbeddings() const override { return embeddings; }
+
+    bool AddIdentity(const std::string &, const std::string &) override { return false; }
+
+    bool RemoveIdentity(const std::string &) override { return false; }
+
     void PrintPerformanceCounts(
         const std::string &, const std::string &) override {}
+
+private:
+    size_t num_faces = 0;
+    std::vector<cv::Mat> embeddings;
 };
 
 class FaceRecognizerDefault : public FaceRecognizer {
@@ -475,13 +573,17 @@ public:
             double reid_threshold,
             int min_size_fr,
             bool crop_gallery,
-            bool greedy_reid_matching
+            bool greedy_reid_matching,
+            int ann_min_gallery_size,
+            int ann_top_k,
+            const std::string& face_gallery_cache_path
     )
         : landmarks_detector(landmarks_detector_config),
           face_reid(reid_config),
           face_gallery(face_gallery_path, reid_threshold, min_size_fr, crop_gallery,
                        face_registration_det_config, landmarks_detector, face_reid,
-                       greedy_reid_matching)
+                       greedy_reid_matching, ann_min_gallery_size, ann_top_k,
+                       face_gallery_cache_path)
     {
         if (face_gallery.size() == 0) {
             slog::warn << "Face reid gallery is empty!" << slog::endl;
@@ -502,21 +604,61 @@ public:
         return face_gallery.GetIDToLabelMap();
     }
 
-    std::vector<int> Recognize(const cv::Mat& frame, const detection::DetectedObjects& faces) override {
-        std::vector<cv::Mat> face_rois;
-
+    void SubmitRecognition(const cv::Mat& frame, const detection::DetectedObjects& faces) override {
+        CVL_TRACE_SCOPE("FaceRecognizerDefault::SubmitRecognition");
+        face_rois.clear();
         for (const auto& face : faces) {
             face_rois.push_back(frame(face.rect));
         }
+        first_landmarks_batch = landmarks_detector.Submit(face_rois);
+    }
 
-        std::vector<cv::Mat> landmarks, embeddings;
+    std::vector<int> FetchRecognition() override {
+        CVL_TRACE_SCOPE("FaceRecognizerDefault::FetchRecognition");
+        // Reid of a landmarks batch is started as soon as the batch is aligned,
+        // so it runs while the next landmarks batches are still in flight.
+        const size_t landmarks_batch_size = static_cast<size_t>(landmarks_detector.config().max_batch_size);
+        const size_t reid_batch_size = static_cast<size_t>(face_reid.config().max_batch_size);
+
+        reid_batches.clear();
+        for (size_t begin = 0, batch = first_landmarks_batch; begin < face_rois.size();
+             begin += landmarks_batch_size, batch++) {
+            const size_t end = std::min(begin + landmarks_batch_size, face_rois.size());
+            landmarks.clear();
+            landmarks_detector.Wait(batch, &landmarks, cv::Size(2, 5));
+
+            // Faces are aligned straight into the reid input blob.
+            const size_t first_reid_batch = face_reid.Submit(end - begin, [&](size_t k, cv::Mat& input) {
+                AlignFace(face_rois[begin + k], landmarks[k], &input);
+            });
+            for (size_t i = 0; i < end - begin; i += reid_batch_size) {
+                reid_batches.push_back(first_reid_batch + i / reid_batch_size);
+            }
+        }
 
-        landmarks_detector.Compute(face_rois, &landmarks, cv::Size(2, 5));
-        AlignFaces(&face_rois, &landmarks);
-        face_reid.Compute(face_rois, &embeddings);
+        embeddings.clear();
+        for (size_t batch : reid_batches) {
+            face_reid.Wait(batch, &embeddings);
+        }
         return face_gallery.GetIDsByEmbeddings(embeddings);
     }
 
+    const std::vector<cv::Mat>& LastEmbeddings() const override { return embeddings; }
+
+    bool AddIdentity(const std::string &label, const std::string &image_path) override {
+        RegistrationStatus status = face_gallery.AddIdentity(label, image_path);
+        if (status != RegistrationStatus::SUCCESS) {
+            slog::warn << "Failed to register '" << label << "' from " << image_path << slog::endl;
+            return false;
+        }
+        slog::info << "Face reid gallery size: " << face_gallery.size() << slog::endl;
+        return true;
+    }
+
+    bool RemoveIdentity(const std::string &label) override {
+        return face_gallery.RemoveIdentity(label);
+    }
+
     void PrintPerformanceCounts(
             const std::string &landmarks_device, const std::string &reid_device) {
         landmarks_detector.PrintPerformanceCounts(landmarks_device);
@@ -527,6 +669,10 @@ private:
     VectorCNN landmarks_detector;
     VectorCNN face_reid;
     EmbeddingsGallery face_gallery;
+
+    std::vector<cv::Mat> face_rois, landmarks, embeddings;
+    size_t first_landmarks_batch = 0;
+    std::vector<size_t> reid_batches;
 };
 
 bool ParseAndCheckCommandLine(int argc, char *argv[]) {
@@ -544,28 +690,49 @@ bool ParseAndCheckCommandLine(int argc, char *argv[]) {
     if (FLAGS_i.empty()) {
         throw std::logic_error("Parameter -i is not set");
     }
-    if (FLAGS_m_act.empty() && FLAGS_m_fd.empty()) {
-        throw std::logic_error("At least one parameter -m_act or -m_fd must be set");
+    if (FLAGS_m_act.empty() && FLAGS_m_fd.empty() && FLAGS_replay_det.empty()) {
+        throw std::logic_error("At least one parameter -m_act, -m_fd or -replay_det must be set");
     }
 
     return true;
 }
 
-}  // namespace
+///
+/// \brief A shard of the input processed by ProcessVideo in a worker thread.
+///
+struct ShardJob {
+    VideoShard shard;
+    ShardResult result;
+    const FR* owner;            ///< Stops the job when the owner is stopped.
+    std::mutex* setup_mutex;    ///< Serializes loading of models and gallery.
+    int cpu_threads;
+    int input_first_frame = 0;  ///< Index of the first frame of the shard in all the -i videos.
+    int status = 0;
+    cv::Size frame_size;
+    std::vector<std::string> face_id_to_label_map;
+};
 
-int /*__cdecl*/ FR::fr_main(int argc, char* argv[], FR *fr) {
+///
+/// \brief Detection cache of a run, written with -record_det and read
+/// with -replay_det. Frames are indexed over all the -i videos, so shards
+/// share the cache with each other and with runs without shards.
+///
+struct DetectionCache {
+    SPCDetectionCacheWriter writer;
+    SPCDetectionCacheReader reader;
+};
 
+///
+/// \brief Runs the pipeline over the -i input, or over a shard of it
+/// without any visualization if job is set.
+///
+int ProcessVideo(FR* fr, ShardJob* job, const DetectionCache& cache) {
+    if (!job) {
+        CVL_TRACE_THREAD_NAME(fr->iName);
+    }
     try {
-        /** This demo covers 4 certain topologies and cannot be generalized **/
-        slog::info << "InferenceEngine: " << GetInferenceEngineVersion() << slog::endl;
-
-        if (!ParseAndCheckCommandLine(argc, argv)) {
-            return 0;
-        }
-
         std::map<std::string, std::tuple<int, int>> fr_map;
-        EmbeddingsGallery::fr_gallery_root = fr->iModelHomeDir + std::string("fr_gallery/");
-        const auto video_path = FLAGS_i;
+        const auto video_path = job ? job->shard.video_path : FLAGS_i;
         const auto ad_model_path = FLAGS_m_act;
         const auto fd_model_path = FLAGS_m_fd;
         const auto fr_model_path = FLAGS_m_reid;
@@ -594,6 +761,10 @@ int /*__cdecl*/ FR::fr_main(int argc, char* argv[], FR *fr) {
             slog::err << "Cannot find target action: " << FLAGS_top_id << slog::endl;
             return 1;
         }
+        if (actions_type == TOP_K && FLAGS_batch) {
+            slog::err << "Top-k students recognition is interactive and cannot run in batch mode." << slog::endl;
+            return 1;
+        }
 
         slog::info << "Reading video '" << video_path << "'" << slog::endl;
         ImageGrabber cap(video_path);
@@ -601,6 +772,18 @@ int /*__cdecl*/ FR::fr_main(int argc, char* argv[], FR *fr) {
             slog::err << "Cannot open the video" << slog::endl;
             return 1;
         }
+        if (job && !cap.SetRange(job->shard.first_frame, job->shard.num_frames)) {
+            slog::err << "Cannot seek to frame " << job->shard.first_frame << slog::endl;
+            return 1;
+        }
+        const bool headless = FLAGS_batch || job != nullptr;
+
+        // Shards load the models one by one, so that the gallery cache is
+        // written by the first shard and read by the others.
+        std::unique_lock<std::mutex> setup_lock;
+        if (job) {
+            setup_lock = std::unique_lock<std::mutex>(*job->setup_mutex);
+        }
 
         slog::info << "Loading Inference Engine" << slog::endl;
         Core ie;
@@ -636,14 +819,33 @@ int /*__cdecl*/ FR::fr_main(int argc, char* argv[], FR *fr) {
                 ie.SetConfig({{PluginConfigParams::KEY_DYN_BATCH_ENABLED, PluginConfigParams::YES}}, "GPU");
             }
 
+            // Frames in flight run in parallel only if the CPU plugin has several streams
+            if (FLAGS_batch && device.find("CPU") != std::string::npos) {
+                ie.SetConfig({{PluginConfigParams::KEY_CPU_THROUGHPUT_STREAMS,
+                               PluginConfigParams::CPU_THROUGHPUT_AUTO}}, "CPU");
+            }
+
+            // Shards share the cores of the machine
+            if (job && device.find("CPU") != std::string::npos) {
+                ie.SetConfig({{PluginConfigParams::KEY_CPU_THREADS_NUM,
+                               std::to_string(job->cpu_threads)}}, "CPU");
+            }
+
             if (FLAGS_pc)
                 ie.SetConfig({{PluginConfigParams::KEY_PERF_COUNT, PluginConfigParams::YES}});
 
             loadedDevices.insert(device);
         }
 
+        // Both detectors take the same frames, so they share resized buffers.
+        auto frame_resizer = std::make_shared<FrameResizer>();
+
+        const int input_first_frame = job ? job->input_first_frame : 0;
+
         std::unique_ptr<AsyncDetection<DetectedAction>> action_detector;
-        if (!ad_model_path.empty()) {
+        if (cache.reader) {
+            action_detector.reset(new ReplayDetection<DetectedAction>(cache.reader, ACTION_STREAM, input_first_frame));
+        } else if (!ad_model_path.empty()) {
             // Load action detector
             ActionDetectorConfig action_config(ad_model_path);
             action_config.deviceName = FLAGS_d_act;
@@ -652,13 +854,22 @@ int /*__cdecl*/ FR::fr_main(int argc, char* argv[], FR *fr) {
             action_config.detection_confidence_threshold = static_cast<float>(FLAGS_t_ad);
             action_config.action_confidence_threshold = static_cast<float>(FLAGS_t_ar);
             action_config.num_action_classes = actions_map.size();
+            action_config.use_hard_nms = FLAGS_hard_nms;
+            action_config.resize_in_plugin = FLAGS_ie_resize;
+            action_config.frame_resizer = frame_resizer;
             action_detector.reset(new ActionDetection(action_config));
         } else {
             action_detector.reset(new NullDetection<DetectedAction>);
         }
+        if (cache.writer) {
+            action_detector.reset(new RecordingDetection<DetectedAction>(
+                std::move(action_detector), cache.writer, ACTION_STREAM, input_first_frame));
+        }
 
         std::unique_ptr<AsyncDetection<detection::DetectedObject>> face_detector;
-        if (!fd_model_path.empty()) {
+        if (cache.reader) {
+            face_detector.reset(new ReplayDetection<detection::DetectedObject>(cache.reader, FACE_STREAM, input_first_frame));
+        } else if (!fd_model_path.empty()) {
             // Load face detector
             detection::DetectorConfig face_config(fd_model_path);
             face_config.deviceName = FLAGS_d_fd;
@@ -669,10 +880,16 @@ int /*__cdecl*/ FR::fr_main(int argc, char* argv[], FR *fr) {
             face_config.input_w = FLAGS_inw_fd;
             face_config.increase_scale_x = static_cast<float>(FLAGS_exp_r_fd);
             face_config.increase_scale_y = static_cast<float>(FLAGS_exp_r_fd);
+            face_config.resize_in_plugin = FLAGS_ie_resize;
+            face_config.frame_resizer = frame_resizer;
             face_detector.reset(new detection::FaceDetection(face_config));
         } else {
             face_detector.reset(new NullDetection<detection::DetectedObject>);
         }
+        if (cache.writer) {
+            face_detector.reset(new RecordingDetection<detection::DetectedObject>(
+                std::move(face_detector), cache.writer, FACE_STREAM, input_first_frame));
+        }
 
         std::unique_ptr<FaceRecognizer> face_recognizer;
 
@@ -706,7 +923,8 @@ int /*__cdecl*/ FR::fr_main(int argc, char* argv[], FR *fr) {
             face_recognizer.reset(new FaceRecognizerDefault(
                 landmarks_config, reid_config,
                 face_registration_det_config,
-                FLAGS_fg, FLAGS_t_reid, FLAGS_min_size_fr, FLAGS_crop_gallery, FLAGS_greedy_reid_matching));
+                FLAGS_fg, FLAGS_t_reid, FLAGS_min_size_fr, FLAGS_crop_gallery, FLAGS_greedy_reid_matching,
+                FLAGS_reid_ann_min_size, FLAGS_reid_ann_top_k, FLAGS_fg_cache));
 
             if (actions_type == TEACHER && !face_recognizer->LabelExists(teacher_id)) {
                 slog::err << "Teacher id does not exist in the gallery!" << slog::endl;
@@ -721,6 +939,14 @@ int /*__cdecl*/ FR::fr_main(int argc, char* argv[], FR *fr) {
 
             face_recognizer.reset(new FaceRecognizerNull);
         }
+        if (setup_lock.owns_lock()) {
+            setup_lock.unlock();
+        }
+
+        // Track histories are bounded so that memory does not grow on long streams,
+        // older objects are kept only if whole face tracks are dumped at the end.
+        const int track_history_size = 300;
+        const bool dump_face_tracks = actions_type == STUDENT && (FLAGS_r || !FLAGS_ad.empty() || job);
 
         // Create tracker for reid
         TrackerParams tracker_reid_params;
@@ -730,12 +956,34 @@ int /*__cdecl*/ FR::fr_main(int argc, char* argv[], FR *fr) {
         tracker_reid_params.averaging_window_size_for_rects = 1;
         tracker_reid_params.averaging_window_size_for_labels = std::numeric_limits<int>::max();
         tracker_reid_params.bbox_heights_range = cv::Vec2f(10, 1080);
-        tracker_reid_params.drop_forgotten_tracks = false;
-        tracker_reid_params.max_num_objects_in_track = std::numeric_limits<int>::max();
+        tracker_reid_params.drop_forgotten_tracks = true;
+        tracker_reid_params.max_num_objects_in_track = track_history_size;
+        tracker_reid_params.keep_spilled_objects = dump_face_tracks;
         tracker_reid_params.objects_type = "face";
 
         Tracker tracker_reid(tracker_reid_params);
 
+        // Forgotten face tracks get no more objects, so they are dropped from the
+        // tracker and kept only if they are dumped. The dump leaves out tracks
+        // without a known label, so a single run keeps only the labeled ones with
+        // their labels settled. Shards keep all of them to stitch unknown tracks.
+        std::vector<Track> forgotten_face_tracks;
+        if (dump_face_tracks) {
+            tracker_reid.set_dropped_track_handler([&forgotten_face_tracks, job](Track&& track) {
+                if (job) {
+                    forgotten_face_tracks.push_back(std::move(track));
+                    return;
+                }
+                for (auto& labeled : UpdateTrackLabelsToBestAndFilterOutUnknowns({std::move(track)})) {
+                    forgotten_face_tracks.push_back(std::move(labeled));
+                }
+            });
+        }
+        RecognitionCache recognition_cache(FLAGS_reid_refresh, FLAGS_reid_min_streak);
+        std::vector<int> face_track_ids, face_ids;
+        std::vector<char> need_recognition;
+        detection::DetectedObjects faces_to_recognize;
+
         // Create Tracker for action recognition
         TrackerParams tracker_action_params;
         tracker_action_params.min_track_duration = 8;
@@ -746,13 +994,22 @@ int /*__cdecl*/ FR::fr_main(int argc, char* argv[], FR *fr) {
                                                                  ? FLAGS_ss_t
                                                                  : actions_type == TOP_K ? 5 : 1;
         tracker_action_params.bbox_heights_range = cv::Vec2f(10, 2160);
-        tracker_action_params.drop_forgotten_tracks = false;
-        tracker_action_params.max_num_objects_in_track = std::numeric_limits<int>::max();
+        tracker_action_params.drop_forgotten_tracks = true;
+        tracker_action_params.max_num_objects_in_track = std::max(track_history_size,
+                                                                  tracker_action_params.averaging_window_size_for_labels);
         tracker_action_params.objects_type = "action";
 
         Tracker tracker_action(tracker_action_params);
 
+        // Frames are processed in the order they were submitted to the detectors,
+        // which run up to frames_in_flight frames ahead. The buffer of a processed
+        // frame is reused to retrieve a new frame into.
+        const size_t frames_in_flight = FLAGS_batch ? std::max(FLAGS_batch_inflight, 1) : 1;
+        std::deque<cv::Mat> queued_frames;
         cv::Mat frame, prev_frame;
+        if (FLAGS_batch) {
+            cap.StartPrefetch(2 * frames_in_flight);
+        }
 
         float work_time_ms = 0.f;
         float wait_time_ms = 0.f;
@@ -778,55 +1035,85 @@ int /*__cdecl*/ FR::fr_main(int argc, char* argv[], FR *fr) {
         }
 
         if (actions_type != TOP_K) {
+            frame_resizer->NewFrame();
             action_detector->enqueue(frame);
             action_detector->submitRequest();
             face_detector->enqueue(frame);
             face_detector->submitRequest();
         }
 
-        prev_frame = frame.clone();
+        queued_frames.push_back(frame);
+        frame = cv::Mat();
+        while (actions_type != TOP_K && queued_frames.size() < frames_in_flight && cap.GrabNext()) {
+            cap.Retrieve(frame);
+            frame_resizer->NewFrame();
+            action_detector->enqueue(frame);
+            action_detector->submitRequest();
+            face_detector->enqueue(frame);
+            face_detector->submitRequest();
+            queued_frames.push_back(frame);
+            frame = cv::Mat();
+        }
+        prev_frame = queued_frames.front();
 
         bool is_last_frame = false;
         bool is_monitoring_enabled = false;
         auto prev_frame_path = cap.GetVideoPath();
 
         cv::VideoWriter vid_writer;
-        if (!FLAGS_out_v.empty()) {
+        if (!FLAGS_out_v.empty() && !headless) {
             vid_writer = cv::VideoWriter(FLAGS_out_v, cv::VideoWriter::fourcc('M', 'J', 'P', 'G'),
-                                         cap.GetFPS(), Visualizer::GetOutputSize(frame.size()));
+                                         cap.GetFPS(), Visualizer::GetOutputSize(prev_frame.size()));
         }
-        Visualizer sc_visualizer(!FLAGS_no_show, vid_writer, num_top_persons);
-        DetectionsLogger logger(std::cout, FLAGS_r, FLAGS_ad, FLAGS_al);
+        Visualizer sc_visualizer(!FLAGS_no_show && !headless, vid_writer, num_top_persons);
+        // Logs of shards are written after the shards are stitched together
+        DetectionsLogger logger(std::cout, FLAGS_r && !job, job ? "" : FLAGS_ad, job ? "" : FLAGS_al);
 
         const int smooth_window_size = static_cast<int>(cap.GetFPS() * FLAGS_d_ad);
         const int smooth_min_length = static_cast<int>(cap.GetFPS() * FLAGS_min_ad);
 
         std::cout << "To close the application, press 'CTRL+C' here";
-        if (!FLAGS_no_show) {
+        if (!FLAGS_no_show && !headless) {
             std::cout << " or switch to the output window and press ESC key";
         }
         std::cout << std::endl;
 
-        cv::Size graphSize{static_cast<int>(frame.cols / 4), 60};
-        Presenter presenter(FLAGS_u, frame.rows - graphSize.height - 10, graphSize);
+        const cv::Size output_size = Visualizer::GetOutputSize(prev_frame.size());
+        cv::Size graphSize{static_cast<int>(output_size.width / 4), 60};
+        Presenter presenter(FLAGS_u, output_size.height - graphSize.height - 10, graphSize);
 
-        while (!is_last_frame) {
+        const auto run_started = std::chrono::high_resolution_clock::now();
+        while (!queued_frames.empty()) {
+            prev_frame = queued_frames.front();
             logger.CreateNextFrameRecord(cap.GetVideoPath(), work_num_frames, prev_frame.cols, prev_frame.rows);
             auto started = std::chrono::high_resolution_clock::now();
+            CStageTimer timer(fr->iMetrics);
 
+            timer.Start(EStage::Read);
             is_last_frame = !cap.GrabNext();
-            if (!is_last_frame)
+            if (!is_last_frame) {
                 cap.Retrieve(frame);
+                queued_frames.push_back(frame);
+            }
+            timer.Stop();
 
-            char key = cv::waitKey(1);
-            if (key == ESC_KEY || iStop) {
+            char key = headless ? -1 : cv::waitKey(1);
+            if (key == ESC_KEY || fr->iStop || (job && job->owner->iStop)) {
                 break;
             }
-            presenter.handleKey(key);
 
-            presenter.drawGraphs(prev_frame);
+            for (const auto& update : fr->fr_take_gallery_updates()) {
+                if (update.add) {
+                    face_recognizer->AddIdentity(update.label, update.image_path);
+                } else {
+                    face_recognizer->RemoveIdentity(update.label);
+                }
+                recognition_cache.Clear();
+            }
+            presenter.handleKey(key);
 
             sc_visualizer.SetFrame(prev_frame);
+            sc_visualizer.DrawOverlay([&presenter](cv::Mat& output) { presenter.drawGraphs(output); });
 
             if (actions_type == TOP_K) {
                 if ( (is_monitoring_enabled && key == SPACE_KEY) ||
@@ -855,6 +1142,7 @@ int /*__cdecl*/ FR::fr_main(int argc, char* argv[], FR *fr) {
                     if (key == SPACE_KEY) {
                         is_monitoring_enabled = true;
 
+                        frame_resizer->NewFrame();
                         action_detector->enqueue(prev_frame);
                         action_detector->submitRequest();
                     }
@@ -864,6 +1152,7 @@ int /*__cdecl*/ FR::fr_main(int argc, char* argv[], FR *fr) {
 
                     if (!is_last_frame) {
                         prev_frame_path = cap.GetVideoPath();
+                        frame_resizer->NewFrame();
                         action_detector->enqueue(frame);
                         action_detector->submitRequest();
                     }
@@ -913,6 +1202,7 @@ int /*__cdecl*/ FR::fr_main(int argc, char* argv[], FR *fr) {
                     }
                 }
             } else {
+                timer.Start(EStage::Detect);
                 face_detector->wait();
                 detection::DetectedObjects faces = face_detector->fetchResults();
 
@@ -921,23 +1211,36 @@ int /*__cdecl*/ FR::fr_main(int argc, char* argv[], FR *fr) {
 
                 if (!is_last_frame) {
                     prev_frame_path = cap.GetVideoPath();
+                    frame_resizer->NewFrame();
                     face_detector->enqueue(frame);
                     face_detector->submitRequest();
                     action_detector->enqueue(frame);
                     action_detector->submitRequest();
                 }
 
-                auto ids = face_recognizer->Recognize(prev_frame, faces);
-
+                timer.Start(EStage::Match);
                 TrackedObjects tracked_face_objects;
+                for (const auto& face : faces) {
+                    tracked_face_objects.emplace_back(face.rect, face.confidence,
+                                                      TrackedObject::UNKNOWN_LABEL_IDX);
+                }
 
+                // Only faces of new tracks and of tracks without an established
+                // identity are recognized, the rest reuse identities of their tracks.
+                tracker_reid.PredictTrackIds(tracked_face_objects, &face_track_ids);
+                recognition_cache.Lookup(face_track_ids, static_cast<int>(work_num_frames),
+                                         &face_ids, &need_recognition);
+                faces_to_recognize.clear();
                 for (size_t i = 0; i < faces.size(); i++) {
-                    tracked_face_objects.emplace_back(faces[i].rect, faces[i].confidence, ids[i]);
+                    if (need_recognition[i]) {
+                        faces_to_recognize.push_back(faces[i]);
+                    }
                 }
-                tracker_reid.Process(prev_frame, tracked_face_objects, work_num_frames);
 
-                const auto tracked_faces = tracker_reid.TrackedDetectionsWithLabels();
+                // Face recognition runs in background while actions are tracked.
+                face_recognizer->SubmitRecognition(prev_frame, faces_to_recognize);
 
+                timer.Start(EStage::Track);
                 TrackedObjects tracked_action_objects;
                 for (const auto& action : actions) {
                     tracked_action_objects.emplace_back(action.rect, action.detection_conf, action.label);
@@ -946,6 +1249,42 @@ int /*__cdecl*/ FR::fr_main(int argc, char* argv[], FR *fr) {
                 tracker_action.Process(prev_frame, tracked_action_objects, work_num_frames);
                 const auto tracked_actions = tracker_action.TrackedDetectionsWithLabels();
 
+                timer.Start(EStage::Recognize);
+                auto recognized_ids = face_recognizer->FetchRecognition();
+                for (size_t i = 0, k = 0; i < faces.size(); i++) {
+                    if (need_recognition[i]) {
+                        face_ids[i] = recognized_ids[k++];
+                    }
+                    tracked_face_objects[i].label = face_ids[i];
+                }
+                tracker_reid.Process(prev_frame, tracked_face_objects, work_num_frames, &face_track_ids);
+                recognition_cache.Update(face_track_ids, face_ids, need_recognition,
+                                         static_cast<int>(work_num_frames));
+
+                // Embeddings of the tracks tell unknown persons apart when shards are stitched.
+                const auto& embeddings = face_recognizer->LastEmbeddings();
+                if (job && !embeddings.empty()) {
+                    for (size_t i = 0, k = 0; i < faces.size(); i++) {
+                        if (!need_recognition[i]) {
+                            continue;
+                        }
+                        cv::Mat embedding;
+                        cv::normalize(embeddings[k++].reshape(1, 1), embedding);
+                        if (face_track_ids[i] < 0) {
+                            continue;
+                        }
+                        auto& sum = job->result.face_track_embeddings[face_track_ids[i]];
+                        if (sum.empty()) {
+                            sum = embedding;
+                        } else {
+                            sum += embedding;
+                        }
+                    }
+                }
+
+                const auto tracked_faces = tracker_reid.TrackedDetectionsWithLabels();
+
+                timer.Start(EStage::Render);
                 auto elapsed = std::chrono::high_resolution_clock::now() - started;
                 auto elapsed_ms =
                         std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
@@ -1026,12 +1365,15 @@ int /*__cdecl*/ FR::fr_main(int argc, char* argv[], FR *fr) {
 
             ++total_num_frames;
 
+            // playing the frame is timed by FR::ProcessFrame
+            timer.Stop();
             sc_visualizer.Show(fr);
 
             if (FLAGS_last_frame >= 0 && work_num_frames > static_cast<size_t>(FLAGS_last_frame)) {
                 break;
             }
-            prev_frame = frame.clone();
+            frame = queued_frames.front();
+            queued_frames.pop_front();
             logger.FinalizeFrameRecord();
 
             while (fr->iPause && !fr->iStop)
@@ -1045,11 +1387,14 @@ int /*__cdecl*/ FR::fr_main(int argc, char* argv[], FR *fr) {
 
               if ((total_num_frames - std::get<1>(data)) > 10)
               {
-                fr->iOnCameraEventCbk(
-                  "face", 
-                  (*f).first,                        // label
-                  std::to_string(std::get<0>(data)),  // count
-                  std::vector<uint8_t>());
+                if (fr->iOnCameraEventCbk)
+                {
+                  fr->iOnCameraEventCbk(
+                    "face", 
+                    (*f).first,                        // label
+                    std::to_string(std::get<0>(data)),  // count
+                    std::vector<uint8_t>());
+                }
 
                 f = fr_map.erase(f);
               }
@@ -1071,6 +1416,14 @@ int /*__cdecl*/ FR::fr_main(int argc, char* argv[], FR *fr) {
             slog::info << "Mean FPS: " << 1e3f / mean_time_ms << slog::endl;
         }
         slog::info << "Frames processed: " << total_num_frames << slog::endl;
+        if (FLAGS_batch) {
+            const auto run_time = std::chrono::high_resolution_clock::now() - run_started;
+            const float run_time_s = std::chrono::duration_cast<std::chrono::duration<float>>(run_time).count();
+            const float run_fps = static_cast<float>(total_num_frames) / std::max(run_time_s, 1e-6f);
+            const unsigned num_cores = std::max(std::thread::hardware_concurrency(), 1u);
+            slog::info << "Sustained FPS: " << run_fps << ", per core: " << run_fps / num_cores
+                       << " (" << num_cores << " cores)" << slog::endl;
+        }
         if (FLAGS_pc) {
             std::map<std::string, std::string>  mapDevices = getMapFullDevicesNames(ie, devices);
             face_detector->wait();
@@ -1082,46 +1435,32 @@ int /*__cdecl*/ FR::fr_main(int argc, char* argv[], FR *fr) {
                 getFullDeviceName(mapDevices, FLAGS_d_reid));
         }
 
+        std::vector<Track> face_tracks;
         if (actions_type == STUDENT) {
-            auto face_tracks = tracker_reid.vector_tracks();
-
-            // correct labels for track
-            std::vector<Track> new_face_tracks = UpdateTrackLabelsToBestAndFilterOutUnknowns(face_tracks);
-            std::map<int, int> face_track_id_to_label = GetMapFaceTrackIdToLabel(new_face_tracks);
-
-            std::vector<std::string> face_id_to_label_map = face_recognizer->GetIDToLabelMap();
-
-            if (!face_id_to_label_map.empty()) {
-                std::map<int, FrameEventsTrack> face_obj_id_to_actions_track;
-                ConvertActionMapsToFrameEventTracks(face_obj_id_to_action_maps, default_action_index,
-                                                    &face_obj_id_to_actions_track);
-
-                const int start_frame = 0;
-                const int end_frame = face_obj_id_to_action_maps.size();
-                std::map<int, RangeEventsTrack> face_obj_id_to_events;
-                SmoothTracks(face_obj_id_to_actions_track, start_frame, end_frame,
-                             smooth_window_size, smooth_min_length, default_action_index,
-                             &face_obj_id_to_events);
-
-                slog::info << "Final ID->events mapping" << slog::endl;
-                logger.DumpTracks(face_obj_id_to_events,
-                                  actions_map, face_track_id_to_label,
-                                  face_id_to_label_map);
-
-                std::vector<std::map<int, int>> face_obj_id_to_smoothed_action_maps;
-                ConvertRangeEventsTracksToActionMaps(end_frame, face_obj_id_to_events,
-                                                     &face_obj_id_to_smoothed_action_maps);
-
-                slog::info << "Final per-frame ID->action mapping" << slog::endl;
-                logger.DumpDetections(cap.GetVideoPath(), frame.size(), work_num_frames,
-                                      new_face_tracks,
-                                      face_track_id_to_label,
-                                      actions_map, face_id_to_label_map,
-                                      face_obj_id_to_smoothed_action_maps);
+            face_tracks = std::move(forgotten_face_tracks);
+            for (auto& track : tracker_reid.vector_tracks()) {
+                face_tracks.push_back(std::move(track));
             }
+            std::sort(face_tracks.begin(), face_tracks.end(), [](const Track& t1, const Track& t2) {
+                return t1.first_object.object_id < t2.first_object.object_id;
+            });
+        }
+
+        if (actions_type == STUDENT && job) {
+            job->result.face_tracks = std::move(face_tracks);
+            job->result.face_obj_id_to_action_maps = std::move(face_obj_id_to_action_maps);
+            job->frame_size = prev_frame.size();
+            job->face_id_to_label_map = face_recognizer->GetIDToLabelMap();
+        } else if (actions_type == STUDENT) {
+            DumpFaceTracks(logger, cap.GetVideoPath(), prev_frame.size(),
+                           face_tracks, face_obj_id_to_action_maps,
+                           face_recognizer->GetIDToLabelMap(), actions_map,
+                           smooth_window_size, smooth_min_length);
         }
 
-        std::cout << presenter.reportMeans() << '\n';
+        if (!headless) {
+            std::cout << presenter.reportMeans() << '\n';
+        }
     }
     catch (const std::exception& error) {
         slog::err << error.what() << slog::endl;
@@ -1132,6 +1471,156 @@ int /*__cdecl*/ FR::fr_main(int argc, char* argv[], FR *fr) {
         return 1;
     }
 
+    return 0;
+}
+
+///
+/// \brief Splits the -i videos into time shards, runs the pipeline over the
+/// shards in parallel and writes the logs of the stitched shards.
+///
+int ProcessShards(FR* fr, const DetectionCache& cache) {
+    if (!FLAGS_teacher_id.empty() || FLAGS_a_top > 0) {
+        slog::err << "Only student actions can be recognized in shards." << slog::endl;
+        return 1;
+    }
+
+    std::vector<std::string> videos;
+    std::stringstream video_list(FLAGS_i);
+    for (std::string video; std::getline(video_list, video, ',');) {
+        videos.push_back(video);
+    }
+    std::vector<int> frame_counts;
+    int fps = 0;
+    for (const auto& video : videos) {
+        ImageGrabber cap(video);
+        if (!cap.IsOpened()) {
+            slog::err << "Cannot open the video " << video << slog::endl;
+            return 1;
+        }
+        frame_counts.push_back(cap.GetFrameCount());
+        fps = std::max(fps, cap.GetFPS());
+    }
+
+    const int overlap_frames = static_cast<int>(fps * FLAGS_shard_overlap);
+    const auto shards = SplitIntoShards(videos, frame_counts, FLAGS_shards, overlap_frames);
+    const size_t num_workers = std::min(shards.size(), static_cast<size_t>(FLAGS_shards));
+    const int num_cores = static_cast<int>(std::max(std::thread::hardware_concurrency(), 1u));
+
+    std::vector<int> video_first_frames(videos.size(), 0);
+    for (size_t v = 1; v < videos.size(); v++) {
+        video_first_frames[v] = video_first_frames[v - 1] + frame_counts[v - 1];
+    }
+
+    std::mutex setup_mutex;
+    std::vector<ShardJob> jobs(shards.size());
+    for (size_t i = 0; i < shards.size(); i++) {
+        jobs[i].shard = shards[i];
+        jobs[i].input_first_frame = video_first_frames[shards[i].video_idx] + shards[i].first_frame;
+        jobs[i].owner = fr;
+        jobs[i].setup_mutex = &setup_mutex;
+        jobs[i].cpu_threads = std::max(num_cores / static_cast<int>(num_workers), 1);
+    }
+    slog::info << "Processing " << videos.size() << " video(s) in " << jobs.size()
+               << " shards by " << num_workers << " workers" << slog::endl;
+
+    std::atomic<size_t> next_job(0);
+    std::vector<std::thread> workers;
+    for (size_t w = 0; w < num_workers; w++) {
+        workers.emplace_back([&, w] {
+            CVL_TRACE_THREAD_NAME(fr->iName + " worker " + std::to_string(w));
+            for (size_t i = next_job++; i < jobs.size(); i = next_job++) {
+                FR shard_fr;
+                shard_fr.iModelHomeDir = fr->iModelHomeDir;
+                shard_fr.iMetrics = fr->iMetrics;
+                jobs[i].status = ProcessVideo(&shard_fr, &jobs[i], cache);
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    for (const auto& job : jobs) {
+        if (job.status != 0) {
+            return job.status;
+        }
+    }
+
+    const auto actions_map = ParseActionLabels(FLAGS_student_ac);
+    const int smooth_window_size = static_cast<int>(fps * FLAGS_d_ad);
+    const int smooth_min_length = static_cast<int>(fps * FLAGS_min_ad);
+    DetectionsLogger logger(std::cout, FLAGS_r, FLAGS_ad, FLAGS_al);
+    for (size_t v = 0; v < videos.size(); v++) {
+        std::vector<VideoShard> video_shards;
+        std::vector<ShardResult> video_results;
+        const ShardJob* first_job = nullptr;
+        for (const auto& job : jobs) {
+            if (job.shard.video_idx == static_cast<int>(v)) {
+                video_shards.push_back(job.shard);
+                video_results.push_back(job.result);
+                first_job = first_job ? first_job : &job;
+            }
+        }
+
+        std::vector<Track> face_tracks;
+        std::vector<std::map<int, int>> face_obj_id_to_action_maps;
+        StitchShards(video_shards, video_results, 0.5f, static_cast<float>(FLAGS_t_reid),
+                     &face_tracks, &face_obj_id_to_action_maps);
+        DumpFaceTracks(logger, videos[v], first_job->frame_size,
+                       face_tracks, face_obj_id_to_action_maps,
+                       first_job->face_id_to_label_map, actions_map,
+                       smooth_window_size, smooth_min_length);
+    }
+
+    if (fr->iOnCameraEventCbk) {
+        fr->iOnCameraEventCbk("stop", "", "", std::vector<uint8_t>());
+        fr->iOnCameraEventCbk = nullptr;
+    }
+    return 0;
+}
+
+}  // namespace
+
+int /*__cdecl*/ FR::fr_main(int argc, char* argv[], FR *fr) {
+    try {
+        /** This demo covers 4 certain topologies and cannot be generalized **/
+        slog::info << "InferenceEngine: " << GetInferenceEngineVersion() << slog::endl;
+
+        if (!ParseAndCheckCommandLine(argc, argv)) {
+            return 0;
+        }
+    }
+    catch (const std::exception& error) {
+        slog::err << error.what() << slog::endl;
+        return 1;
+    }
+
+    EmbeddingsGallery::fr_gallery_root = fr->iModelHomeDir + std::string("fr_gallery/");
+    fr->iMetrics = CMetricsRegistry::Get().Register(fr->iName);
+    CMetricsRegistry::Get().StartFileDump();
+
+    DetectionCache cache;
+    if (!FLAGS_replay_det.empty()) {
+        cache.reader = std::make_shared<CDetectionCacheReader>(FLAGS_replay_det);
+        if (!cache.reader->IsOpened()) {
+            slog::err << "Cannot read detections from " << FLAGS_replay_det << slog::endl;
+            return 1;
+        }
+        slog::info << "Replaying detections of " << cache.reader->GetFrameCount() << " frames" << slog::endl;
+    }
+    if (!FLAGS_record_det.empty()) {
+        cache.writer = std::make_shared<CDetectionCacheWriter>(FLAGS_record_det);
+        if (!cache.writer->IsOpened()) {
+            slog::err << "Cannot write detections to " << FLAGS_record_det << slog::endl;
+            return 1;
+        }
+    }
+
+    const int status = FLAGS_shards > 1 ? ProcessShards(fr, cache) : ProcessVideo(fr, nullptr, cache);
+    CVL_TRACE_DUMP();
+    if (status != 0) {
+        return status;
+    }
+
     slog::info << "Execution successful" << slog::endl;
 
     return 0;
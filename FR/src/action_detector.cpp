@@ -8,6 +8,7 @@
 #include <vector>
 #include <limits>
 #include <numeric>
+#include <queue>
 #include <opencv2/imgproc/imgproc.hpp>
 
 using namespace InferenceEngine;
@@ -38,9 +39,7 @@ void ActionDetection::enqueue(const cv::Mat &frame) {
     width_ = static_cast<float>(frame.cols);
     height_ = static_cast<float>(frame.rows);
 
-    Blob::Ptr inputBlob = request->GetBlob(input_name_);
-
-    matU8ToBlob<uint8_t>(frame, inputBlob);
+    setInputFrame(input_name_, frame);
 
     enqueued_frames_ = 1;
 }
@@ -59,6 +58,7 @@ ActionDetection::ActionDetection(const ActionDetectorConfig& config)
     InputInfo::Ptr inputInfoFirst = inputInfo.begin()->second;
     inputInfoFirst->setPrecision(Precision::U8);
     inputInfoFirst->getInputData()->setLayout(Layout::NCHW);
+    setPreprocessing(inputInfoFirst, config_.frame_resizer, config_.resize_in_plugin);
 
     network_input_size_.height = inputInfoFirst->getTensorDesc().getDims()[2];
     network_input_size_.width = inputInfoFirst->getTensorDesc().getDims()[3];
@@ -76,16 +76,8 @@ ActionDetection::ActionDetection(const ActionDetectorConfig& config)
     const auto& head_anchors = new_network_ ? config_.new_anchors : config_.old_anchors;
     const int num_heads = head_anchors.size();
 
-    head_ranges_.resize(num_heads + 1);
-    glob_anchor_map_.resize(num_heads);
-    head_step_sizes_.resize(num_heads);
-
-    num_glob_anchors_ = 0;
-    head_ranges_[0] = 0;
-    int head_shift = 0;
+    std::vector<cv::Size> head_blob_sizes;
     for (int head_id = 0; head_id < num_heads; ++head_id) {
-        glob_anchor_map_[head_id].resize(head_anchors[head_id]);
-
         int anchor_height, anchor_width;
         for (int anchor_id = 0; anchor_id < head_anchors[head_id]; ++anchor_id) {
             const auto glob_anchor_name = new_network_
@@ -102,8 +94,40 @@ ActionDetection::ActionDetection(const ActionDetectorConfig& config)
                 throw std::logic_error("The number of specified actions and the number of actions predicted by "
                     "the Person/Action Detection Retail model must match");
             }
+        }
+
+        head_blob_sizes.emplace_back(anchor_width, anchor_height);
+    }
+
+    InitCandidates(head_blob_sizes);
+}
+
+ActionDetection::ActionDetection(const ActionDetectorConfig& config, bool new_network,
+                                 const cv::Size& network_input_size,
+                                 const std::vector<cv::Size>& head_blob_sizes)
+        : BaseCnnDetection(false), config_(config), new_network_(new_network),
+          network_input_size_(network_input_size) {
+    topoName = "action detector";
+    InitCandidates(head_blob_sizes);
+}
 
-            const int anchor_size = anchor_height * anchor_width;
+void ActionDetection::InitCandidates(const std::vector<cv::Size>& head_blob_sizes) {
+    const auto& head_anchors = new_network_ ? config_.new_anchors : config_.old_anchors;
+    const int num_heads = head_anchors.size();
+
+    head_ranges_.resize(num_heads + 1);
+    glob_anchor_map_.resize(num_heads);
+    head_step_sizes_.resize(num_heads);
+    head_blob_sizes_ = head_blob_sizes;
+
+    num_glob_anchors_ = 0;
+    head_ranges_[0] = 0;
+    int head_shift = 0;
+    for (int head_id = 0; head_id < num_heads; ++head_id) {
+        glob_anchor_map_[head_id].resize(head_anchors[head_id]);
+
+        const int anchor_size = head_blob_sizes_[head_id].area();
+        for (int anchor_id = 0; anchor_id < head_anchors[head_id]; ++anchor_id) {
             head_shift += anchor_size;
 
             head_step_sizes_[head_id] = new_network_ ? anchor_size : 1;
@@ -111,12 +135,37 @@ ActionDetection::ActionDetection(const ActionDetectorConfig& config)
         }
 
         head_ranges_[head_id + 1] = head_shift;
-        head_blob_sizes_.emplace_back(anchor_width, anchor_height);
     }
 
     num_candidates_ = head_shift;
 
     binary_task_ = config_.num_action_classes == 2;
+
+    /** Map every candidate to its anchor and action confidences once **/
+    candidate_glob_anchor_.resize(num_candidates_);
+    candidate_conf_shift_.resize(num_candidates_);
+    candidate_conf_step_.resize(num_candidates_);
+    if (new_network_) {
+        candidate_priors_.resize(num_candidates_);
+    }
+    for (int head_id = 0, p = 0; head_id < num_heads; ++head_id) {
+        const int head_num_anchors = head_anchors[head_id];
+        for (; p < head_ranges_[head_id + 1]; ++p) {
+            const int head_p = p - head_ranges_[head_id];
+            const int anchor_id = head_p % head_num_anchors;
+            candidate_glob_anchor_[p] = glob_anchor_map_[head_id][anchor_id];
+            candidate_conf_shift_[p] = new_network_
+                                         ? head_p / head_num_anchors
+                                         : head_p / head_num_anchors * static_cast<int>(config_.num_action_classes);
+            candidate_conf_step_[p] = head_step_sizes_[head_id];
+            if (new_network_) {
+                candidate_priors_[p] = GeneratePriorBox(head_p / head_num_anchors,
+                                                        config_.new_det_heads[head_id].step,
+                                                        config_.new_det_heads[head_id].anchors[anchor_id],
+                                                        head_blob_sizes_[head_id]);
+            }
+        }
+    }
 }
 
 std::vector<int> ieSizeToVector(const SizeVector& ie_output_dims) {
@@ -192,38 +241,6 @@ ActionDetection::GeneratePriorBox(int pos, int step, const cv::Size2f& anchor,
     return bbox;
 }
 
-cv::Rect ActionDetection::ConvertToRect(
-        const NormalizedBBox& prior_bbox, const NormalizedBBox& variances,
-        const NormalizedBBox& encoded_bbox, const cv::Size& frame_size) const {
-    /** Convert prior bbox to CV_Rect **/
-    const float prior_width = prior_bbox.xmax - prior_bbox.xmin;
-    const float prior_height = prior_bbox.ymax - prior_bbox.ymin;
-    const float prior_center_x = 0.5f * (prior_bbox.xmin + prior_bbox.xmax);
-    const float prior_center_y = 0.5f * (prior_bbox.ymin + prior_bbox.ymax);
-
-    /** Decode bbox coordinates from the SSD format **/
-    const float decoded_bbox_center_x =
-            variances.xmin * encoded_bbox.xmin * prior_width + prior_center_x;
-    const float decoded_bbox_center_y =
-            variances.ymin * encoded_bbox.ymin * prior_height + prior_center_y;
-    const float decoded_bbox_width =
-            static_cast<float>(exp(static_cast<float>(variances.xmax * encoded_bbox.xmax))) * prior_width;
-    const float decoded_bbox_height =
-            static_cast<float>(exp(static_cast<float>(variances.ymax * encoded_bbox.ymax))) * prior_height;
-
-    /** Create decoded bbox **/
-    const float decoded_bbox_xmin = decoded_bbox_center_x - 0.5f * decoded_bbox_width;
-    const float decoded_bbox_ymin = decoded_bbox_center_y - 0.5f * decoded_bbox_height;
-    const float decoded_bbox_xmax = decoded_bbox_center_x + 0.5f * decoded_bbox_width;
-    const float decoded_bbox_ymax = decoded_bbox_center_y + 0.5f * decoded_bbox_height;
-
-    /** Convert decoded bbox to CV_Rect **/
-    return cv::Rect(static_cast<int>(decoded_bbox_xmin * frame_size.width),
-                    static_cast<int>(decoded_bbox_ymin * frame_size.height),
-                    static_cast<int>((decoded_bbox_xmax - decoded_bbox_xmin) * frame_size.width),
-                    static_cast<int>((decoded_bbox_ymax - decoded_bbox_ymin) * frame_size.height));
-}
-
 DetectedActions ActionDetection::GetDetections(const cv::Mat& loc, const cv::Mat& main_conf,
         const cv::Mat& priorboxes, const std::vector<cv::Mat>& add_conf,
         const cv::Size& frame_size) const {
@@ -238,57 +255,83 @@ DetectedActions ActionDetection::GetDetections(const cv::Mat& loc, const cv::Mat
         action_conf_data[i] = reinterpret_cast<float*>(add_conf[i].data);
     }
 
+    auto variance_of = [&](int p) {
+        return ParseBBoxRecord(new_network_
+                                   ? config_.variances
+                                   : prior_data + (num_candidates_ + p) * SSD_PRIORBOX_RECORD_SIZE,
+                               false);
+    };
+    auto encoded_bbox_of = [&](int p) {
+        return ParseBBoxRecord(loc_data + p * SSD_LOCATION_RECORD_SIZE, new_network_);
+    };
+
+    /** Select candidates above the detection threshold in one vectorized pass **/
+    const cv::Mat det_conf(num_candidates_, NUM_DETECTION_CLASSES, CV_32F, const_cast<float*>(det_conf_data));
+    cv::compare(det_conf.col(POSITIVE_DETECTION_IDX), config_.detection_confidence_threshold,
+                candidates_mask_, cv::CMP_GE);
+    cv::findNonZero(candidates_mask_, candidates_);
+    const int num_valid = static_cast<int>(candidates_.size());
+    if (num_valid == 0) {
+        return DetectedActions();
+    }
+
+    /** Gather scaled action logits and take the softmax of all candidates at once **/
+    const int num_classes = static_cast<int>(config_.num_action_classes);
+    const float scale = new_network_ ? config_.new_action_scale : config_.old_action_scale;
+    action_probs_.create(num_valid, num_classes, CV_32F);
+    for (int k = 0; k < num_valid; ++k) {
+        const int p = candidates_[k].y;
+        const float* anchor_conf_data = action_conf_data[candidate_glob_anchor_[p]] + candidate_conf_shift_[p];
+        const int action_conf_step = candidate_conf_step_[p];
+        float* logits = action_probs_.ptr<float>(k);
+        float max_logit = -std::numeric_limits<float>::max();
+        for (int c = 0; c < num_classes; ++c) {
+            logits[c] = scale * anchor_conf_data[c * action_conf_step];
+            max_logit = std::max(max_logit, logits[c]);
+        }
+        /** Shifting by the max keeps exp finite and does not change the softmax **/
+        for (int c = 0; c < num_classes; ++c) {
+            logits[c] -= max_logit;
+        }
+    }
+    cv::exp(action_probs_, action_probs_);
+
+    /** Gather bbox size exponents and decode all bboxes at once **/
+    box_sizes_.create(num_valid, 2, CV_32F);
+    for (int k = 0; k < num_valid; ++k) {
+        const int p = candidates_[k].y;
+        const auto variance = variance_of(p);
+        const auto encoded_bbox = encoded_bbox_of(p);
+        float* sizes = box_sizes_.ptr<float>(k);
+        sizes[0] = variance.xmax * encoded_bbox.xmax;
+        sizes[1] = variance.ymax * encoded_bbox.ymax;
+    }
+    cv::exp(box_sizes_, box_sizes_);
+
     /** Variable to store all detection candidates**/
     DetectedActions valid_detections;
+    valid_detections.reserve(num_valid);
 
-    /** Iterate over all candidate bboxes**/
-    for (int p = 0; p < num_candidates_; ++p) {
-        /** Parse detection confidence from the SSD Detection output **/
+    const int first_label = binary_task_ ? 1 : 0;
+    for (int k = 0; k < num_valid; ++k) {
+        const int p = candidates_[k].y;
         const float detection_conf =
                 det_conf_data[p * NUM_DETECTION_CLASSES + POSITIVE_DETECTION_IDX];
 
-        /** Skip low-confidence detections **/
-        if (detection_conf < config_.detection_confidence_threshold) {
-            continue;
-        }
-
-        /** Estimate the action head ID **/
-        int head_id = 0;
-        while (p >= head_ranges_[head_id + 1]) {
-            ++head_id;
+        /** Estimate the action label and confidence **/
+        const float* probs = action_probs_.ptr<float>(k);
+        float action_sum_exp_values = 0.f;
+        for (int c = 0; c < num_classes; ++c) {
+            action_sum_exp_values += probs[c];
         }
-        const int head_p = p - head_ranges_[head_id];
-
-        /** Estimate the action anchor ID **/
-        const int head_num_anchors =
-            new_network_ ? config_.new_anchors[head_id] : config_.old_anchors[head_id];
-        const int anchor_id = head_p % head_num_anchors;
-
-        /** Estimate the action label **/
-        const int glob_anchor_id = glob_anchor_map_[head_id][anchor_id];
-        const float* anchor_conf_data = action_conf_data[glob_anchor_id];
-        const int action_conf_idx_shift = new_network_
-                                            ? head_p / head_num_anchors
-                                            : head_p / head_num_anchors * config_.num_action_classes;
-        const int action_conf_step = head_step_sizes_[head_id];
-        const float scale = new_network_ ? config_.new_action_scale : config_.old_action_scale;
         int action_label = -1;
         float action_max_exp_value = 0.f;
-        float action_sum_exp_values = 0.f;
-        for (size_t c = 0; c < config_.num_action_classes; ++c) {
-            float action_exp_value =
-                std::exp(scale * anchor_conf_data[action_conf_idx_shift + c * action_conf_step]);
-            action_sum_exp_values += action_exp_value;
-            if (action_exp_value > action_max_exp_value && ((c > 0 && binary_task_) || !binary_task_)) {
-                action_max_exp_value = action_exp_value;
+        for (int c = first_label; c < num_classes; ++c) {
+            if (probs[c] > action_max_exp_value) {
+                action_max_exp_value = probs[c];
                 action_label = c;
             }
         }
-
-        if (std::fabs(action_sum_exp_values) < std::numeric_limits<float>::epsilon()) {
-            throw std::logic_error("action_sum_exp_values can't be equal to 0");
-        }
-        /** Estimate the action confidence **/
         float action_conf = action_max_exp_value / action_sum_exp_values;
 
         /** Skip low-confidence actions **/
@@ -297,22 +340,30 @@ DetectedActions ActionDetection::GetDetections(const cv::Mat& loc, const cv::Mat
             action_conf = 0.f;
         }
 
-        /** Parse bbox from the SSD Detection output **/
+        /** Decode bbox coordinates from the SSD format **/
         const auto priorbox = new_network_
-                                ? GeneratePriorBox(head_p / head_num_anchors,
-                                                   config_.new_det_heads[head_id].step,
-                                                   config_.new_det_heads[head_id].anchors[anchor_id],
-                                                   head_blob_sizes_[head_id])
+                                ? candidate_priors_[p]
                                 : ParseBBoxRecord(prior_data + p * SSD_PRIORBOX_RECORD_SIZE, false);
-        const auto variance =
-                ParseBBoxRecord(new_network_
-                                    ? config_.variances
-                                    : prior_data + (num_candidates_ + p) * SSD_PRIORBOX_RECORD_SIZE,
-                                false);
-        const auto encoded_bbox =
-                ParseBBoxRecord(loc_data + p * SSD_LOCATION_RECORD_SIZE, new_network_);
-
-        const auto det_rect = ConvertToRect(priorbox, variance, encoded_bbox, frame_size);
+        const auto variance = variance_of(p);
+        const auto encoded_bbox = encoded_bbox_of(p);
+
+        const float prior_width = priorbox.xmax - priorbox.xmin;
+        const float prior_height = priorbox.ymax - priorbox.ymin;
+        const float prior_center_x = 0.5f * (priorbox.xmin + priorbox.xmax);
+        const float prior_center_y = 0.5f * (priorbox.ymin + priorbox.ymax);
+
+        const float* sizes = box_sizes_.ptr<float>(k);
+        const float decoded_bbox_center_x = variance.xmin * encoded_bbox.xmin * prior_width + prior_center_x;
+        const float decoded_bbox_center_y = variance.ymin * encoded_bbox.ymin * prior_height + prior_center_y;
+        const float decoded_bbox_width = sizes[0] * prior_width;
+        const float decoded_bbox_height = sizes[1] * prior_height;
+
+        const float decoded_bbox_xmin = decoded_bbox_center_x - 0.5f * decoded_bbox_width;
+        const float decoded_bbox_ymin = decoded_bbox_center_y - 0.5f * decoded_bbox_height;
+        const cv::Rect det_rect(static_cast<int>(decoded_bbox_xmin * frame_size.width),
+                                static_cast<int>(decoded_bbox_ymin * frame_size.height),
+                                static_cast<int>(decoded_bbox_width * frame_size.width),
+                                static_cast<int>(decoded_bbox_height * frame_size.height));
 
         /** Store detected action **/
         valid_detections.emplace_back(det_rect, action_label, detection_conf, action_conf);
@@ -322,6 +373,7 @@ DetectedActions ActionDetection::GetDetections(const cv::Mat& loc, const cv::Mat
     std::vector<int> out_det_indices;
     SoftNonMaxSuppression(valid_detections, config_.nms_sigma, config_.keep_top_k,
                           config_.detection_confidence_threshold,
+                          config_.use_hard_nms, config_.hard_nms_threshold,
                           &out_det_indices);
 
     DetectedActions detections;
@@ -331,9 +383,10 @@ DetectedActions ActionDetection::GetDetections(const cv::Mat& loc, const cv::Mat
     return detections;
 }
 
-void ActionDetection::SoftNonMaxSuppression(const DetectedActions& detections,
+void SoftNonMaxSuppression(const DetectedActions& detections,
         const float sigma, const int top_k, const float min_det_conf,
-        std::vector<int>* out_indices) const {
+        const bool use_hard_nms, const float hard_nms_threshold,
+        std::vector<int>* out_indices) {
     /** Store input bbox scores **/
     std::vector<float> scores(detections.size());
     for (size_t i = 0; i < detections.size(); ++i) {
@@ -358,40 +411,106 @@ void ActionDetection::SoftNonMaxSuppression(const DetectedActions& detections,
         valid_scores[i] = scores[valid_score_idx[i]];
     }
 
-    /** Carry out Soft Non-Maximum Suppression algorithm **/
+    /** Put bboxes into a uniform grid, so that only overlapping bboxes are rescored **/
     out_indices->clear();
-    for (size_t step = 0; step < valid_scores.size(); ++step) {
-        auto best_score_itr = std::max_element(valid_scores.begin(), valid_scores.end());
-        if (*best_score_itr < min_det_conf) {
+    const int num_boxes = static_cast<int>(valid_score_idx.size());
+    if (num_boxes == 0) {
+        return;
+    }
+    cv::Rect bounds = detections[valid_score_idx[0]].rect;
+    long long sum_sides = 0;
+    for (int i = 0; i < num_boxes; ++i) {
+        const auto& rect = detections[valid_score_idx[i]].rect;
+        bounds |= rect;
+        sum_sides += rect.width + rect.height;
+    }
+    const int cell_size = std::max(1, static_cast<int>(sum_sides / (2 * num_boxes)));
+    const int grid_width = bounds.width / cell_size + 1;
+    const int grid_height = bounds.height / cell_size + 1;
+    auto cell_range = [&](const cv::Rect& rect) {
+        return cv::Rect(cv::Point((rect.x - bounds.x) / cell_size, (rect.y - bounds.y) / cell_size),
+                        cv::Point((rect.br().x - 1 - bounds.x) / cell_size + 1,
+                                  (rect.br().y - 1 - bounds.y) / cell_size + 1));
+    };
+    std::vector<std::vector<int>> grid(grid_width * grid_height);
+    for (int i = 0; i < num_boxes; ++i) {
+        const auto cells = cell_range(detections[valid_score_idx[i]].rect);
+        for (int y = cells.y; y < cells.y + cells.height; ++y) {
+            for (int x = cells.x; x < cells.x + cells.width; ++x) {
+                grid[y * grid_width + x].push_back(i);
+            }
+        }
+    }
+
+    /** Max-heap of scores, ties go to the earlier bbox. An entry becomes stale
+     *  when its bbox is rescored, and the rescored bbox gets a new entry **/
+    typedef std::pair<float, int> HeapEntry;
+    auto heap_less = [](const HeapEntry& e1, const HeapEntry& e2) {
+        return e1.first < e2.first || (e1.first == e2.first && e1.second > e2.second);
+    };
+    std::priority_queue<HeapEntry, std::vector<HeapEntry>, decltype(heap_less)> heap(heap_less);
+    for (int i = 0; i < num_boxes; ++i) {
+        heap.emplace(valid_scores[i], i);
+    }
+
+    /** Carry out Soft Non-Maximum Suppression algorithm **/
+    std::vector<char> selected(num_boxes, 0);
+    std::vector<int> visited_by(num_boxes, -1);
+    while (!heap.empty()) {
+        const HeapEntry best = heap.top();
+        heap.pop();
+        const int local_anchor_idx = best.second;
+        if (selected[local_anchor_idx] || best.first != valid_scores[local_anchor_idx]) {
+            continue;
+        }
+        if (best.first < min_det_conf) {
             break;
         }
 
         /** Add current bbox to output list **/
-        const size_t local_anchor_idx = std::distance(valid_scores.begin(), best_score_itr);
         const int anchor_idx = valid_score_idx[local_anchor_idx];
         out_indices->emplace_back(anchor_idx);
-        *best_score_itr = 0.f;
-
-        /** Update valid_scores of the rest bboxes **/
-        for (size_t local_reference_idx = 0; local_reference_idx < valid_scores.size(); ++local_reference_idx) {
-            /** Skip updating step for the low-confidence bbox **/
-            if (valid_scores[local_reference_idx] < min_det_conf) {
-                continue;
-            }
-
-            /** Calculate the Intersection over Union metric between two bboxes**/
-            const size_t reference_idx = valid_score_idx[local_reference_idx];
-            const auto& rect1 = detections[anchor_idx].rect;
-            const auto& rect2 = detections[reference_idx].rect;
-            const auto intersection = rect1 & rect2;
-            float overlap = 0.f;
-            if (intersection.width > 0 && intersection.height > 0) {
-                const int intersection_area = intersection.area();
-                overlap = static_cast<float>(intersection_area) / static_cast<float>(rect1.area() + rect2.area() - intersection_area);
+        selected[local_anchor_idx] = 1;
+
+        /** Update valid_scores of the bboxes that share grid cells with it **/
+        const auto& rect1 = detections[anchor_idx].rect;
+        const auto cells = cell_range(rect1);
+        for (int y = cells.y; y < cells.y + cells.height; ++y) {
+            for (int x = cells.x; x < cells.x + cells.width; ++x) {
+                for (int local_reference_idx : grid[y * grid_width + x]) {
+                    if (visited_by[local_reference_idx] == local_anchor_idx) {
+                        continue;
+                    }
+                    visited_by[local_reference_idx] = local_anchor_idx;
+
+                    /** Skip updating step for selected and low-confidence bboxes **/
+                    float& score = valid_scores[local_reference_idx];
+                    if (selected[local_reference_idx] || score < min_det_conf) {
+                        continue;
+                    }
+
+                    /** Calculate the Intersection over Union metric between two bboxes**/
+                    const auto& rect2 = detections[valid_score_idx[local_reference_idx]].rect;
+                    const auto intersection = rect1 & rect2;
+                    if (intersection.width <= 0 || intersection.height <= 0) {
+                        continue;
+                    }
+                    const int intersection_area = intersection.area();
+                    const float overlap = static_cast<float>(intersection_area) /
+                                          static_cast<float>(rect1.area() + rect2.area() - intersection_area);
+
+                    /** Suppress the bbox or scale its score using the exponential rule **/
+                    const float prev_score = score;
+                    if (use_hard_nms) {
+                        score = overlap > hard_nms_threshold ? 0.f : score;
+                    } else {
+                        score *= std::exp(-overlap * overlap / sigma);
+                    }
+                    if (score != prev_score && score >= min_det_conf) {
+                        heap.emplace(score, local_reference_idx);
+                    }
+                }
             }
-
-            /** Scale bbox score using the exponential rule **/
-            valid_scores[local_reference_idx] *= std::exp(-overlap * overlap / sigma);
         }
     }
 }
@@ -5,6 +5,7 @@
 #include "face_reid.hpp"
 
 #include <algorithm>
+#include <cmath>
 #include <vector>
 #include <limits>
 #include <opencv2/imgproc.hpp>
@@ -15,58 +16,85 @@ static const float w = 96.;
 static const float ref_landmarks_normalized[] = {
     30.2946f / w, 51.6963f / h, 65.5318f / w, 51.5014f / h, 48.0252f / w,
     71.7366f / h, 33.5493f / w, 92.3655f / h, 62.7299f / w, 92.2041f / h};
+static const int num_landmarks = 5;
 
-cv::Mat GetTransform(cv::Mat* src, cv::Mat* dst) {
-    cv::Mat col_mean_src;
-    reduce(*src, col_mean_src, 0, cv::REDUCE_AVG);
-    for (int i = 0; i < src->rows; i++) {
-        src->row(i) -= col_mean_src;
-    }
+namespace {
 
-    cv::Mat col_mean_dst;
-    reduce(*dst, col_mean_dst, 0, cv::REDUCE_AVG);
-    for (int i = 0; i < dst->rows; i++) {
-        dst->row(i) -= col_mean_dst;
+// Reference landmarks centered at their mean. A face of any size scales them
+// by its width and height, so they are computed only once.
+struct ReferenceLandmarks {
+    ReferenceLandmarks() : mean_x(0), mean_y(0), sum_xx(0), sum_yy(0) {
+        for (int i = 0; i < num_landmarks; i++) {
+            mean_x += ref_landmarks_normalized[2 * i] / num_landmarks;
+            mean_y += ref_landmarks_normalized[2 * i + 1] / num_landmarks;
+        }
+        for (int i = 0; i < num_landmarks; i++) {
+            x[i] = ref_landmarks_normalized[2 * i] - mean_x;
+            y[i] = ref_landmarks_normalized[2 * i + 1] - mean_y;
+            sum_xx += x[i] * x[i];
+            sum_yy += y[i] * y[i];
+        }
     }
 
-    cv::Scalar mean, dev_src, dev_dst;
-    cv::meanStdDev(*src, mean, dev_src);
-    dev_src(0) =
-            std::max(static_cast<double>(std::numeric_limits<float>::epsilon()), dev_src(0));
-    *src /= dev_src(0);
-    cv::meanStdDev(*dst, mean, dev_dst);
-    dev_dst(0) =
-            std::max(static_cast<double>(std::numeric_limits<float>::epsilon()), dev_dst(0));
-    *dst /= dev_dst(0);
+    float x[num_landmarks], y[num_landmarks];
+    float mean_x, mean_y;
+    float sum_xx, sum_yy;
+};
 
-    cv::Mat w, u, vt;
-    cv::SVD::compute((*src).t() * (*dst), w, u, vt);
-    cv::Mat r = (u * vt).t();
-    cv::Mat m(2, 3, CV_32F);
-    m.colRange(0, 2) = r * (dev_dst(0) / dev_src(0));
-    m.col(2) = (col_mean_dst.t() - m.colRange(0, 2) * col_mean_src.t());
-    return m;
-}
+// Similarity transform that maps reference landmarks of a face of the given
+// size to its detected landmarks (normalized to the face size). Rotation is
+// the closed-form 2D Procrustes (Umeyama) solution, scale is the ratio of the
+// point spreads.
+cv::Matx23f GetTransform(const cv::Mat& landmarks, cv::Size face_size) {
+    static const ReferenceLandmarks ref;
+    CV_Assert(landmarks.type() == CV_32F && landmarks.total() == 2 * num_landmarks && landmarks.isContinuous());
+    const float* points = landmarks.ptr<float>();
+    const float fw = static_cast<float>(face_size.width);
+    const float fh = static_cast<float>(face_size.height);
 
-void AlignFaces(std::vector<cv::Mat>* face_images,
-                std::vector<cv::Mat>* landmarks_vec) {
-    if (landmarks_vec->size() == 0) {
-        return;
+    float mean_x = 0, mean_y = 0;
+    for (int i = 0; i < num_landmarks; i++) {
+        mean_x += points[2 * i] / num_landmarks;
+        mean_y += points[2 * i + 1] / num_landmarks;
     }
-    CV_Assert(face_images->size() == landmarks_vec->size());
-    cv::Mat ref_landmarks = cv::Mat(5, 2, CV_32F);
 
-    for (size_t j = 0; j < face_images->size(); j++) {
-        for (int i = 0; i < ref_landmarks.rows; i++) {
-            ref_landmarks.at<float>(i, 0) =
-                    ref_landmarks_normalized[2 * i] * face_images->at(j).cols;
-            ref_landmarks.at<float>(i, 1) =
-                    ref_landmarks_normalized[2 * i + 1] * face_images->at(j).rows;
-            landmarks_vec->at(j).at<float>(i, 0) *= face_images->at(j).cols;
-            landmarks_vec->at(j).at<float>(i, 1) *= face_images->at(j).rows;
-        }
-        cv::Mat m = GetTransform(&ref_landmarks, &landmarks_vec->at(j));
-        cv::warpAffine(face_images->at(j), face_images->at(j), m,
-                       face_images->at(j).size(), cv::WARP_INVERSE_MAP);
+    float dot = 0, cross = 0, sum_xx = 0, sum_yy = 0;
+    for (int i = 0; i < num_landmarks; i++) {
+        const float dx = points[2 * i] - mean_x;
+        const float dy = points[2 * i + 1] - mean_y;
+        dot += fw * fw * ref.x[i] * dx + fh * fh * ref.y[i] * dy;
+        cross += fw * fh * (ref.x[i] * dy - ref.y[i] * dx);
+        sum_xx += dx * dx;
+        sum_yy += dy * dy;
     }
+
+    const float eps = std::numeric_limits<float>::epsilon();
+    const float src_spread = std::max(eps, std::sqrt(fw * fw * ref.sum_xx + fh * fh * ref.sum_yy));
+    const float dst_spread = std::max(eps, std::sqrt(fw * fw * sum_xx + fh * fh * sum_yy));
+    const float scale = dst_spread / src_spread;
+    const float norm = std::sqrt(dot * dot + cross * cross);
+    const float a = norm > eps ? scale * dot / norm : scale;
+    const float b = norm > eps ? scale * cross / norm : 0.f;
+
+    const float src_x = fw * ref.mean_x, src_y = fh * ref.mean_y;
+    const float dst_x = fw * mean_x, dst_y = fh * mean_y;
+    return cv::Matx23f(a, -b, dst_x - (a * src_x - b * src_y),
+                       b,  a, dst_y - (b * src_x + a * src_y));
+}
+
+}  // namespace
+
+void AlignFace(const cv::Mat& face_image, const cv::Mat& landmarks, cv::Mat* aligned) {
+    CV_Assert(!aligned->empty());
+    cv::Matx23f m = GetTransform(landmarks, face_image.size());
+
+    // The transform maps aligned face coordinates to the image, so resizing to
+    // the output size is folded into it and the face is interpolated once.
+    const float sx = static_cast<float>(face_image.cols) / aligned->cols;
+    const float sy = static_cast<float>(face_image.rows) / aligned->rows;
+    m(0, 2) += 0.5f * (m(0, 0) * sx + m(0, 1) * sy) - 0.5f * (m(0, 0) + m(0, 1));
+    m(1, 2) += 0.5f * (m(1, 0) * sx + m(1, 1) * sy) - 0.5f * (m(1, 0) + m(1, 1));
+    m(0, 0) *= sx; m(1, 0) *= sx;
+    m(0, 1) *= sy; m(1, 1) *= sy;
+    cv::warpAffine(face_image, *aligned, m, aligned->size(), cv::INTER_LINEAR | cv::WARP_INVERSE_MAP);
 }
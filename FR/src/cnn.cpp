@@ -15,6 +15,75 @@
 
 using namespace InferenceEngine;
 
+namespace {
+
+void FillBatch(InferRequest& request, const std::string& input_blob_name,
+               const std::vector<cv::Mat>& frames, size_t first, size_t count, bool dynamic_batch) {
+    Blob::Ptr input = request.GetBlob(input_blob_name);
+    for (size_t b = 0; b < count; b++) {
+        matU8ToBlob<uint8_t>(frames[first + b], input, b);
+    }
+    if (dynamic_batch)
+        request.SetBatch(count);
+}
+
+// Splits an HWC image into the planes of an NCHW blob item.
+void SplitToPlanes(const cv::Mat& image, uint8_t* blob_data) {
+    const int channels = image.channels();
+    cv::Mat planes[3];
+    CV_Assert(channels == 3);
+    for (int c = 0; c < channels; c++) {
+        planes[c] = cv::Mat(image.rows, image.cols, CV_8UC1, blob_data + c * image.rows * image.cols);
+    }
+    cv::split(image, planes);
+}
+
+// Wraps memory of a dense HWC image into an NHWC blob without copying it.
+Blob::Ptr WrapMatToBlob(const cv::Mat& mat) {
+    const size_t channels = mat.channels();
+    const size_t height = mat.rows;
+    const size_t width = mat.cols;
+    if (!mat.isContinuous()) {
+        THROW_IE_EXCEPTION << "Doesn't support conversion from not dense cv::Mat";
+    }
+    TensorDesc desc(Precision::U8, {1, channels, height, width}, Layout::NHWC);
+    return make_shared_blob<uint8_t>(desc, mat.data);
+}
+
+// Draws images at the network input size and splits them straight into the
+// planes of the NCHW input blob.
+void WriteBatch(InferRequest& request, const std::string& input_blob_name,
+                const CnnDLSDKBase::InputWriter& write_input, size_t first, size_t count, bool dynamic_batch) {
+    Blob::Ptr input = request.GetBlob(input_blob_name);
+    const SizeVector dims = input->getTensorDesc().getDims();
+    const int channels = static_cast<int>(dims[1]);
+    const int height = static_cast<int>(dims[2]);
+    const int width = static_cast<int>(dims[3]);
+    CV_Assert(channels == 3);
+
+    LockedMemory<void> blob_mapped = as<MemoryBlob>(input)->wmap();
+    uint8_t* blob_data = blob_mapped.as<uint8_t*>();
+    cv::Mat image(height, width, CV_8UC3);
+    for (size_t b = 0; b < count; b++) {
+        write_input(first + b, image);
+        CV_Assert(image.rows == height && image.cols == width && image.type() == CV_8UC3);
+        SplitToPlanes(image, blob_data + b * channels * height * width);
+    }
+    if (dynamic_batch)
+        request.SetBatch(count);
+}
+
+void FetchBatch(InferRequest& request, const std::vector<std::string>& output_blobs_names, size_t count,
+                const std::function<void(const InferenceEngine::BlobMap&, size_t)>& fetch_results) {
+    InferenceEngine::BlobMap blobs;
+    for (const auto& name : output_blobs_names)  {
+        blobs[name] = request.GetBlob(name);
+    }
+    fetch_results(blobs, count);
+}
+
+}  // namespace
+
 CnnDLSDKBase::CnnDLSDKBase(const Config& config) : config_(config) {}
 
 void CnnDLSDKBase::Load() {
@@ -52,25 +121,69 @@ void CnnDLSDKBase::InferBatch(
     size_t num_imgs = frames.size();
     for (size_t batch_i = 0; batch_i < num_imgs; batch_i += batch_size) {
         const size_t current_batch_size = std::min(batch_size, num_imgs - batch_i);
-        for (size_t b = 0; b < current_batch_size; b++) {
-            matU8ToBlob<uint8_t>(frames[batch_i + b], input, b);
-        }
+        FillBatch(infer_request_, input_blob_name_, frames, batch_i, current_batch_size,
+                  config_.max_batch_size != 1);
+        infer_request_.Infer();
+        FetchBatch(infer_request_, output_blobs_names_, current_batch_size, fetch_results);
+    }
+}
 
-        if (config_.max_batch_size != 1)
-            infer_request_.SetBatch(current_batch_size);
+void CnnDLSDKBase::InferBatch(
+        size_t num_images, const InputWriter& write_input,
+        const std::function<void(const InferenceEngine::BlobMap&, size_t)>& fetch_results) const {
+    const size_t batch_size = static_cast<size_t>(config_.max_batch_size);
+    for (size_t batch_i = 0; batch_i < num_images; batch_i += batch_size) {
+        const size_t current_batch_size = std::min(batch_size, num_images - batch_i);
+        WriteBatch(infer_request_, input_blob_name_, write_input, batch_i, current_batch_size,
+                   config_.max_batch_size != 1);
         infer_request_.Infer();
+        FetchBatch(infer_request_, output_blobs_names_, current_batch_size, fetch_results);
+    }
+}
+
+size_t CnnDLSDKBase::SubmitBatches(const std::vector<cv::Mat>& frames) {
+    return SubmitBatches(frames.size(), [&frames](size_t idx, cv::Mat& input) {
+        cv::resize(frames[idx], input, input.size());
+    });
+}
 
-        InferenceEngine::BlobMap blobs;
-        for (const auto& name : output_blobs_names_)  {
-            blobs[name] = infer_request_.GetBlob(name);
+size_t CnnDLSDKBase::SubmitBatches(size_t num_images, const InputWriter& write_input) {
+    const size_t first_batch = async_batch_sizes_.size();
+    const size_t batch_size = static_cast<size_t>(config_.max_batch_size);
+
+    for (size_t batch_i = 0; batch_i < num_images; batch_i += batch_size) {
+        const size_t idx = async_batch_sizes_.size();
+        if (idx == async_requests_.size()) {
+            async_requests_.push_back(executable_network_.CreateInferRequest());
         }
-        fetch_results(blobs, current_batch_size);
+        const size_t current_batch_size = std::min(batch_size, num_images - batch_i);
+        WriteBatch(async_requests_[idx], input_blob_name_, write_input, batch_i, current_batch_size,
+                   config_.max_batch_size != 1);
+        async_requests_[idx].StartAsync();
+        async_batch_sizes_.push_back(current_batch_size);
+    }
+    return first_batch;
+}
+
+void CnnDLSDKBase::WaitBatch(
+        size_t batch_idx,
+        const std::function<void(const InferenceEngine::BlobMap&, size_t)>& fetch_results) {
+    CV_Assert(batch_idx < async_batch_sizes_.size());
+    auto& request = async_requests_[batch_idx];
+    request.Wait(InferenceEngine::IInferRequest::WaitMode::RESULT_READY);
+    FetchBatch(request, output_blobs_names_, async_batch_sizes_[batch_idx], fetch_results);
+
+    // Requests are reused once every batch in flight is consumed.
+    if (++async_num_waited_ == async_batch_sizes_.size()) {
+        async_batch_sizes_.clear();
+        async_num_waited_ = 0;
     }
 }
 
 void CnnDLSDKBase::PrintPerformanceCounts(std::string fullDeviceName) const {
     std::cout << "Performance counts for " << config_.path_to_model << std::endl << std::endl;
-    ::printPerformanceCounts(infer_request_, std::cout, fullDeviceName, false);
+    ::printPerformanceCounts(async_requests_.empty() ? infer_request_ : async_requests_.front(),
+                             std::cout, fullDeviceName, false);
 }
 
 void CnnDLSDKBase::Infer(const cv::Mat& frame,
@@ -93,13 +206,11 @@ void VectorCNN::Compute(const cv::Mat& frame,
     *vector = output[0];
 }
 
-void VectorCNN::Compute(const std::vector<cv::Mat>& images, std::vector<cv::Mat>* vectors,
-                                     cv::Size outp_shape) const {
-    if (images.empty()) {
-        return;
-    }
-    vectors->clear();
-    auto results_fetcher = [vectors, outp_shape](const InferenceEngine::BlobMap& outputs, size_t batch_size) {
+namespace {
+
+std::function<void(const InferenceEngine::BlobMap&, size_t)> VectorsFetcher(
+        std::vector<cv::Mat>* vectors, cv::Size outp_shape) {
+    return [vectors, outp_shape](const InferenceEngine::BlobMap& outputs, size_t batch_size) {
         for (auto&& item : outputs) {
             InferenceEngine::Blob::Ptr blob = item.second;
             if (blob == nullptr) {
@@ -122,5 +233,87 @@ void VectorCNN::Compute(const std::vector<cv::Mat>& images, std::vector<cv::Mat>
             }
         }
     };
-    InferBatch(images, results_fetcher);
+}
+
+}  // namespace
+
+void VectorCNN::Compute(const std::vector<cv::Mat>& images, std::vector<cv::Mat>* vectors,
+                                     cv::Size outp_shape) const {
+    if (images.empty()) {
+        return;
+    }
+    vectors->clear();
+    InferBatch(images, VectorsFetcher(vectors, outp_shape));
+}
+
+void VectorCNN::Compute(size_t num_images, const InputWriter& write_input,
+                        std::vector<cv::Mat>* vectors, cv::Size outp_shape) const {
+    vectors->clear();
+    InferBatch(num_images, write_input, VectorsFetcher(vectors, outp_shape));
+}
+
+size_t VectorCNN::Submit(const std::vector<cv::Mat>& images) {
+    return SubmitBatches(images);
+}
+
+size_t VectorCNN::Submit(size_t num_images, const InputWriter& write_input) {
+    return SubmitBatches(num_images, write_input);
+}
+
+void VectorCNN::Wait(size_t batch_idx, std::vector<cv::Mat>* vectors, cv::Size outp_shape) {
+    WaitBatch(batch_idx, VectorsFetcher(vectors, outp_shape));
+}
+
+const cv::Mat& FrameResizer::Resize(const cv::Mat& frame, const cv::Size& size) {
+    auto it = std::find_if(buffers_.begin(), buffers_.end(),
+                           [&size](const Buffer& buffer) { return buffer.size == size; });
+    if (it == buffers_.end()) {
+        buffers_.push_back(Buffer{size, 0, cv::Mat()});
+        it = buffers_.end() - 1;
+    }
+    if (it->frame_idx != frame_idx_) {
+        if (frame.size() == size) {
+            it->image = frame;
+        } else {
+            // The buffer keeps its memory, unless it was the frame itself.
+            if (it->image.data == frame.data) {
+                it->image = cv::Mat();
+            }
+            cv::resize(frame, it->image, size);
+        }
+        it->frame_idx = frame_idx_;
+    }
+    return it->image;
+}
+
+void BaseCnnDetection::setPreprocessing(const InferenceEngine::InputInfo::Ptr& inputInfo,
+                                        const std::shared_ptr<FrameResizer>& resizer, bool inPlugin) {
+    frameResizer = resizer ? resizer : std::make_shared<FrameResizer>();
+    ownsResizer = !resizer;
+    resizeInPlugin = inPlugin;
+    if (resizeInPlugin) {
+        inputInfo->getPreProcess().setResizeAlgorithm(InferenceEngine::RESIZE_BILINEAR);
+        inputInfo->getPreProcess().setColorFormat(InferenceEngine::ColorFormat::BGR);
+    }
+}
+
+void BaseCnnDetection::setInputFrame(const std::string& inputName, const cv::Mat& frame) {
+    if (resizeInPlugin) {
+        // The plugin reads the frame when the request runs, so it gets a copy
+        // that stays unchanged while the caller reuses the frame buffer.
+        cv::Mat& pluginInput = pluginInputs[request.get()];
+        frame.copyTo(pluginInput);
+        request->SetBlob(inputName, WrapMatToBlob(pluginInput));
+        return;
+    }
+
+    if (ownsResizer) {
+        frameResizer->NewFrame();
+    }
+
+    Blob::Ptr input = request->GetBlob(inputName);
+    const SizeVector dims = input->getTensorDesc().getDims();
+    const cv::Size size(static_cast<int>(dims[3]), static_cast<int>(dims[2]));
+    LockedMemory<void> blobMapped = as<MemoryBlob>(input)->wmap();
+    SplitToPlanes(frameResizer->Resize(frame, size), blobMapped.as<uint8_t*>());
 }
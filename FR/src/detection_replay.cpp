@@ -0,0 +1,32 @@
+#include "detection_replay.hpp"
+
+CachedDetection ToCachedDetection(const detection::DetectedObject& face) {
+    return {static_cast<float>(face.rect.x), static_cast<float>(face.rect.y),
+            static_cast<float>(face.rect.width), static_cast<float>(face.rect.height),
+            face.confidence, -1.0f, -1};
+}
+
+CachedDetection ToCachedDetection(const DetectedAction& action) {
+    return {static_cast<float>(action.rect.x), static_cast<float>(action.rect.y),
+            static_cast<float>(action.rect.width), static_cast<float>(action.rect.height),
+            action.detection_conf, action.action_conf, action.label};
+}
+
+namespace {
+
+cv::Rect ToRect(const CachedDetection& cached) {
+    return cv::Rect(static_cast<int>(cached.x), static_cast<int>(cached.y),
+                    static_cast<int>(cached.width), static_cast<int>(cached.height));
+}
+
+}  // namespace
+
+template <>
+detection::DetectedObject FromCachedDetection(const CachedDetection& cached) {
+    return detection::DetectedObject(ToRect(cached), cached.a);
+}
+
+template <>
+DetectedAction FromCachedDetection(const CachedDetection& cached) {
+    return DetectedAction(ToRect(cached), cached.label, cached.a, cached.b);
+}
@@ -63,9 +63,7 @@ void FaceDetection::enqueue(const cv::Mat &frame) {
     width_ = static_cast<float>(frame.cols);
     height_ = static_cast<float>(frame.rows);
 
-    Blob::Ptr inputBlob = request->GetBlob(input_name_);
-
-    matU8ToBlob<uint8_t>(frame, inputBlob);
+    setInputFrame(input_name_, frame);
 
     enqueued_frames_ = 1;
 }
@@ -82,6 +80,7 @@ FaceDetection::FaceDetection(const DetectorConfig& config) :
     InputInfo::Ptr inputInfoFirst = inputInfo.begin()->second;
     inputInfoFirst->setPrecision(Precision::U8);
     inputInfoFirst->getInputData()->setLayout(Layout::NCHW);
+    setPreprocessing(inputInfoFirst, config_.frame_resizer, config_.resize_in_plugin);
 
     SizeVector input_dims = inputInfoFirst->getInputData()->getTensorDesc().getDims();
     input_dims[2] = config_.input_h;
@@ -0,0 +1,144 @@
+#include "embeddings_cache.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+namespace {
+
+const char kMagic[8] = {'C', 'V', 'L', 'E', 'M', 'B', '0', '1'};
+
+struct CacheHeader {
+    char magic[8];
+    uint64_t model_hash;
+    uint32_t dim;
+    uint32_t count;
+};
+
+size_t RecordSize(int dim) {
+    return 2 * sizeof(uint64_t) + dim * sizeof(float);
+}
+
+}  // namespace
+
+EmbeddingsCache::EmbeddingsCache(const std::string& path, uint64_t model_hash)
+    : path_(path), model_hash_(model_hash) {
+    std::ifstream in(path_, std::ios::binary);
+    if (!in.good()) {
+        return;
+    }
+
+    CacheHeader header;
+    if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+        header.model_hash != model_hash_ || header.dim == 0) {
+        dirty_ = true;
+        return;
+    }
+
+    const int dim = static_cast<int>(header.dim);
+    const size_t record_size = RecordSize(dim);
+    std::vector<char> records(record_size * header.count);
+    if (!in.read(records.data(), records.size())) {
+        dirty_ = true;
+        return;
+    }
+
+    dim_ = dim;
+    for (uint32_t i = 0; i < header.count; i++) {
+        const char* record = records.data() + i * record_size;
+        uint64_t path_hash, content_hash;
+        std::memcpy(&path_hash, record, sizeof(path_hash));
+        std::memcpy(&content_hash, record + sizeof(path_hash), sizeof(content_hash));
+
+        Entry entry{content_hash, cv::Mat(dim_, 1, CV_32F), false};
+        std::memcpy(entry.embedding.data, record + 2 * sizeof(uint64_t), dim_ * sizeof(float));
+        entries_[path_hash] = entry;
+    }
+}
+
+bool EmbeddingsCache::Find(const std::string& image_path, uint64_t content_hash, cv::Mat* embedding) {
+    auto it = entries_.find(Hash(image_path.data(), image_path.size()));
+    if (it == entries_.end() || it->second.content_hash != content_hash) {
+        return false;
+    }
+    it->second.used = true;
+    *embedding = it->second.embedding.clone();
+    return true;
+}
+
+void EmbeddingsCache::Put(const std::string& image_path, uint64_t content_hash, const cv::Mat& embedding) {
+    CV_Assert(embedding.type() == CV_32F && embedding.isContinuous());
+    if (dim_ == 0) {
+        dim_ = static_cast<int>(embedding.total());
+    }
+    CV_Assert(static_cast<int>(embedding.total()) == dim_);
+
+    entries_[Hash(image_path.data(), image_path.size())] =
+            Entry{content_hash, embedding.reshape(1, dim_).clone(), true};
+    dirty_ = true;
+}
+
+void EmbeddingsCache::Release(const std::string& image_path) {
+    auto it = entries_.find(Hash(image_path.data(), image_path.size()));
+    if (it != entries_.end() && it->second.used) {
+        it->second.used = false;
+        dirty_ = true;
+    }
+}
+
+void EmbeddingsCache::Flush() {
+    uint32_t count = 0;
+    for (const auto& item : entries_) {
+        count += item.second.used ? 1 : 0;
+    }
+    if (!dirty_ && count == entries_.size()) {
+        return;
+    }
+
+    const std::string tmp_path = path_ + ".tmp";
+    {
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!out.good()) {
+            return;
+        }
+
+        CacheHeader header;
+        std::memcpy(header.magic, kMagic, sizeof(kMagic));
+        header.model_hash = model_hash_;
+        header.dim = static_cast<uint32_t>(dim_);
+        header.count = count;
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        for (const auto& item : entries_) {
+            if (!item.second.used) {
+                continue;
+            }
+            out.write(reinterpret_cast<const char*>(&item.first), sizeof(item.first));
+            out.write(reinterpret_cast<const char*>(&item.second.content_hash), sizeof(item.second.content_hash));
+            out.write(reinterpret_cast<const char*>(item.second.embedding.data), dim_ * sizeof(float));
+        }
+        if (!out.good()) {
+            return;
+        }
+    }
+
+#ifdef _WIN32
+    // rename does not replace an existing file on Windows
+    std::remove(path_.c_str());
+#endif
+    if (std::rename(tmp_path.c_str(), path_.c_str()) == 0) {
+        dirty_ = false;
+    }
+}
+
+uint64_t EmbeddingsCache::Hash(const void* data, size_t size, uint64_t seed) {
+    const auto* bytes = static_cast<const unsigned char*>(data);
+    uint64_t hash = seed;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
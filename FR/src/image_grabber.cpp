@@ -23,14 +23,138 @@ std::string ImageGrabber::GetVideoPath() const {
     return current_video_idx >= 0 ? videos[current_video_idx] : std::string("");
 }
 
+ImageGrabber::~ImageGrabber() {
+    if (prefetch_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(prefetch_mutex);
+            stop_prefetch = true;
+        }
+        prefetch_cond.notify_all();
+        prefetch_thread.join();
+    }
+}
+
+void ImageGrabber::StartPrefetch(size_t depth) {
+    if (prefetch_thread.joinable() || depth == 0) {
+        return;
+    }
+    // The capture belongs to the decoding thread from now on.
+    fps = GetFPS();
+    prefetch_depth = depth;
+    prefetch_thread = std::thread(&ImageGrabber::PrefetchLoop, this);
+}
+
+void ImageGrabber::PrefetchLoop() {
+    for (;;) {
+        cv::Mat frame;
+        {
+            std::unique_lock<std::mutex> lock(prefetch_mutex);
+            prefetch_cond.wait(lock, [this] {
+                return decoded_frames.size() < prefetch_depth || stop_prefetch;
+            });
+            if (stop_prefetch) {
+                return;
+            }
+            if (!free_frames.empty()) {
+                frame = free_frames.back();
+                free_frames.pop_back();
+            }
+        }
+
+        const bool decoded = GrabFrame() && cap.retrieve(frame);
+        {
+            std::lock_guard<std::mutex> lock(prefetch_mutex);
+            if (decoded) {
+                decoded_frames.push_back(frame);
+            } else {
+                decoding_done = true;
+            }
+        }
+        prefetch_cond.notify_all();
+        if (!decoded) {
+            return;
+        }
+    }
+}
+
 int ImageGrabber::GetFPS() const {
+    if (prefetch_depth > 0) {
+        return fps;
+    }
     return static_cast<int>(cap.get(cv::CAP_PROP_FPS));
 }
 
 bool ImageGrabber::IsOpened() const { return is_opened; }
 
+int ImageGrabber::GetFrameCount() const {
+    return static_cast<int>(cap.get(cv::CAP_PROP_FRAME_COUNT));
+}
+
+bool ImageGrabber::SetRange(int first_frame, int num_frames) {
+    if (first_frame > 0) {
+        // Seeking may stop at another frame, e.g. at the key frame before
+        // first_frame, so the position is read back and the rest is grabbed.
+        int pos = cap.set(cv::CAP_PROP_POS_FRAMES, first_frame)
+                  ? static_cast<int>(cap.get(cv::CAP_PROP_POS_FRAMES))
+                  : -1;
+        if (pos < 0 || pos > first_frame) {
+            if (!cap.open(videos[current_video_idx])) {
+                return false;
+            }
+            pos = 0;
+        }
+        for (; pos < first_frame; pos++) {
+            if (!cap.grab()) {
+                return false;
+            }
+        }
+    }
+    current_frame_idx = first_frame;
+    frames_left = num_frames;
+    return true;
+}
+
+bool ImageGrabber::GrabFrame() {
+    if (frames_left == 0 || !cap.grab()) {
+        return false;
+    }
+    if (frames_left > 0) {
+        frames_left--;
+    }
+    current_frame_idx++;
+    return true;
+}
+
 bool ImageGrabber::GrabNext() {
-    return cap.grab();
+    if (prefetch_depth == 0) {
+        return GrabFrame();
+    }
+
+    std::unique_lock<std::mutex> lock(prefetch_mutex);
+    prefetch_cond.wait(lock, [this] { return !decoded_frames.empty() || decoding_done; });
+    if (decoded_frames.empty()) {
+        return false;
+    }
+    grabbed_frame = decoded_frames.front();
+    decoded_frames.pop_front();
+    lock.unlock();
+    prefetch_cond.notify_all();
+    return true;
 }
 
-bool ImageGrabber::Retrieve(cv::Mat& img) { return cap.retrieve(img); }
+bool ImageGrabber::Retrieve(cv::Mat& img) {
+    if (prefetch_depth == 0) {
+        return cap.retrieve(img);
+    }
+
+    if (grabbed_frame.empty()) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(prefetch_mutex);
+    if (!img.empty()) {
+        free_frames.push_back(img);
+    }
+    img = grabbed_frame;
+    grabbed_frame.release();
+    return true;
+}
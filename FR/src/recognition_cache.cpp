@@ -0,0 +1,72 @@
+#include "recognition_cache.hpp"
+
+#include <algorithm>
+
+#include "face_reid.hpp"
+
+RecognitionCache::RecognitionCache(int refresh_interval, int min_streak)
+    : refresh_interval_(refresh_interval), min_streak_(std::max(min_streak, 1)) {}
+
+void RecognitionCache::Lookup(const std::vector<int>& track_ids, int frame_idx,
+                              std::vector<int>* ids, std::vector<char>* need_recognition) const {
+    ids->assign(track_ids.size(), EmbeddingsGallery::unknown_id);
+    need_recognition->assign(track_ids.size(), 1);
+    if (refresh_interval_ <= 0) {
+        return;
+    }
+
+    for (size_t i = 0; i < track_ids.size(); i++) {
+        if (track_ids[i] < 0) {
+            continue;
+        }
+        auto it = entries_.find(track_ids[i]);
+        if (it == entries_.end()) {
+            continue;
+        }
+        const Entry& entry = it->second;
+        if (entry.streak >= min_streak_ && frame_idx - entry.last_recognized < refresh_interval_) {
+            (*ids)[i] = entry.id;
+            (*need_recognition)[i] = 0;
+        }
+    }
+}
+
+void RecognitionCache::Update(const std::vector<int>& track_ids, const std::vector<int>& ids,
+                              const std::vector<char>& recognized, int frame_idx) {
+    CV_Assert(track_ids.size() == ids.size() && ids.size() == recognized.size());
+    if (refresh_interval_ <= 0) {
+        return;
+    }
+
+    for (size_t i = 0; i < track_ids.size(); i++) {
+        if (track_ids[i] < 0 || !recognized[i]) {
+            continue;
+        }
+        auto it = entries_.find(track_ids[i]);
+        if (it == entries_.end()) {
+            entries_[track_ids[i]] = Entry{ids[i], 1, frame_idx};
+            continue;
+        }
+        Entry& entry = it->second;
+        entry.streak = entry.id == ids[i] ? entry.streak + 1 : 1;
+        entry.id = ids[i];
+        entry.last_recognized = frame_idx;
+    }
+
+    // Entries that were not refreshed in time are useless, so drop them once
+    // per interval to keep the map as small as the set of visible tracks.
+    if (frame_idx - last_pruned_ >= refresh_interval_) {
+        for (auto it = entries_.begin(); it != entries_.end();) {
+            if (frame_idx - it->second.last_recognized >= refresh_interval_) {
+                it = entries_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        last_pruned_ = frame_idx;
+    }
+}
+
+void RecognitionCache::Clear() {
+    entries_.clear();
+}
@@ -10,16 +10,21 @@
 #include <vector>
 #include <string>
 #include <limits>
+#include <algorithm>
 
 #include <opencv2/opencv.hpp>
 
 namespace {
-    float ComputeReidDistance(const cv::Mat& descr1, const cv::Mat& descr2) {
-        float xy = static_cast<float>(descr1.dot(descr2));
-        float xx = static_cast<float>(descr1.dot(descr1));
-        float yy = static_cast<float>(descr2.dot(descr2));
-        float norm = sqrt(xx * yy) + 1e-6f;
-        return 1.0f - xy / norm;
+    // Branching factor of the k-means tree and number of leaves visited per query.
+    const int kAnnBranching = 32;
+    const int kAnnChecks = 128;
+    // Distance assigned to (query, gallery) pairs that are not among the nearest candidates.
+    const float kMaxReidDistance = 2.0f;
+    // Number of gallery images decoded at once during registration.
+    const size_t kRegistrationChunk = 64;
+
+    void NormalizeEmbedding(const cv::Mat& descr, cv::Mat dst) {
+        cv::normalize(descr.reshape(1, 1), dst);
     }
 
     bool file_exists(const std::string& name) {
@@ -27,6 +32,29 @@ namespace {
         return f.good();
     }
 
+    bool read_file(const std::string& name, std::vector<uchar>* data) {
+        std::ifstream f(name.c_str(), std::ios::binary | std::ios::ate);
+        if (!f.good()) {
+            return false;
+        }
+        data->resize(static_cast<size_t>(f.tellg()));
+        f.seekg(0);
+        return static_cast<bool>(f.read(reinterpret_cast<char*>(data->data()), data->size()));
+    }
+
+    uint64_t HashFile(const std::string& name, uint64_t seed) {
+        std::vector<uchar> data;
+        read_file(name, &data);
+        return EmbeddingsCache::Hash(data.data(), data.size(), seed);
+    }
+
+    // Embeddings depend on both the network description and its weights.
+    uint64_t HashModel(const CnnConfig& config, uint64_t seed) {
+        const std::string& xml = config.path_to_model;
+        seed = HashFile(xml, seed);
+        return HashFile(xml.substr(0, xml.find_last_of('.')) + ".bin", seed);
+    }
+
     inline char separator() {
         #ifdef _WIN32
         return '\\';
@@ -49,35 +77,130 @@ std::string EmbeddingsGallery::fr_gallery_root = "";
 const char EmbeddingsGallery::unknown_label[] = "Unknown";
 const int EmbeddingsGallery::unknown_id = TrackedObject::UNKNOWN_LABEL_IDX;
 
-RegistrationStatus EmbeddingsGallery::RegisterIdentity(const std::string& identity_label,
-                                                       const cv::Mat& image,
-                                                       int min_size_fr, bool crop_gallery,
-                                                       detection::FaceDetection& detector,
-                                                       const VectorCNN& landmarks_det,
-                                                       const VectorCNN& image_reid,
-                                                       cv::Mat& embedding) {
-    cv::Mat target = image;
-    if (crop_gallery) {
-      detector.enqueue(image);
-      detector.submitRequest();
-      detector.wait();
-      detection::DetectedObjects faces = detector.fetchResults();
-      if (faces.size() == 0) {
-        return RegistrationStatus::FAILURE_NOT_DETECTED;
-      }
-      cv::Mat face_roi = image(faces[0].rect);
-      target = face_roi;
-    }
-    if ((target.rows < min_size_fr) && (target.cols < min_size_fr)) {
-      return RegistrationStatus::FAILURE_LOW_QUALITY;
-    }
-    cv::Mat landmarks;
-    landmarks_det.Compute(target, &landmarks, cv::Size(2, 5));
-    std::vector<cv::Mat> images = {target};
-    std::vector<cv::Mat> landmarks_vec = {landmarks};
-    AlignFaces(&images, &landmarks_vec);
-    image_reid.Compute(images[0], &embedding);
-    return RegistrationStatus::SUCCESS;
+void EmbeddingsGallery::RegisterIdentities(const std::vector<cv::Mat>& images,
+                                           std::vector<cv::Mat>* embeddings,
+                                           std::vector<RegistrationStatus>* statuses) {
+    CV_Assert(landmarks_det && image_reid);
+    embeddings->assign(images.size(), cv::Mat());
+    statuses->assign(images.size(), RegistrationStatus::SUCCESS);
+
+    const size_t batch_size = static_cast<size_t>(std::max(1, std::max(landmarks_det->config().max_batch_size,
+                                                                       image_reid->config().max_batch_size)));
+    std::vector<cv::Mat> targets;
+    std::vector<size_t> target_ids;
+    auto compute_batch = [&]() {
+        if (targets.empty()) {
+            return;
+        }
+        std::vector<cv::Mat> landmarks, batch_embeddings;
+        landmarks_det->Compute(targets, &landmarks, cv::Size(2, 5));
+        image_reid->Compute(targets.size(), [&](size_t k, cv::Mat& input) {
+            AlignFace(targets[k], landmarks[k], &input);
+        }, &batch_embeddings);
+        for (size_t k = 0; k < target_ids.size(); k++) {
+            (*embeddings)[target_ids[k]] = batch_embeddings[k];
+        }
+        targets.clear();
+        target_ids.clear();
+    };
+
+    if (crop_gallery && !images.empty()) {
+        detector->enqueue(images[0]);
+        detector->submitRequest();
+    }
+    for (size_t i = 0; i < images.size(); i++) {
+        cv::Mat target = images[i];
+        if (crop_gallery) {
+            detector->wait();
+            detection::DetectedObjects faces = detector->fetchResults();
+            // The next image is being detected while the current batch is embedded.
+            if (i + 1 < images.size()) {
+                detector->enqueue(images[i + 1]);
+                detector->submitRequest();
+            }
+            if (faces.size() == 0) {
+                (*statuses)[i] = RegistrationStatus::FAILURE_NOT_DETECTED;
+                continue;
+            }
+            target = images[i](faces[0].rect);
+        }
+        if ((target.rows < min_size_fr) && (target.cols < min_size_fr)) {
+            (*statuses)[i] = RegistrationStatus::FAILURE_LOW_QUALITY;
+            continue;
+        }
+        targets.push_back(target);
+        target_ids.push_back(i);
+        if (targets.size() == batch_size) {
+            compute_batch();
+        }
+    }
+    compute_batch();
+}
+
+void EmbeddingsGallery::ComputeEmbeddings(const std::vector<std::string>& paths,
+                                          std::vector<cv::Mat>* embeddings,
+                                          std::vector<RegistrationStatus>* statuses) {
+    embeddings->assign(paths.size(), cv::Mat());
+    statuses->assign(paths.size(), RegistrationStatus::FAILURE_NOT_LOADED);
+
+    // Images are loaded in chunks to bound the memory taken by decoded images.
+    for (size_t begin = 0; begin < paths.size(); begin += kRegistrationChunk) {
+        const size_t count = std::min(kRegistrationChunk, paths.size() - begin);
+        std::vector<std::vector<uchar>> files(count);
+        std::vector<uint64_t> hashes(count, 0);
+        cv::parallel_for_(cv::Range(0, static_cast<int>(count)), [&](const cv::Range& range) {
+            for (int k = range.start; k < range.end; k++) {
+                if (read_file(paths[begin + k], &files[k]) && cache) {
+                    hashes[k] = EmbeddingsCache::Hash(files[k].data(), files[k].size());
+                }
+            }
+        });
+
+        std::vector<size_t> misses;
+        for (size_t k = 0; k < count; k++) {
+            if (files[k].empty()) {
+                continue;
+            }
+            if (cache && cache->Find(paths[begin + k], hashes[k], &(*embeddings)[begin + k])) {
+                (*statuses)[begin + k] = RegistrationStatus::SUCCESS;
+                continue;
+            }
+            misses.push_back(k);
+        }
+
+        std::vector<cv::Mat> images(misses.size());
+        cv::parallel_for_(cv::Range(0, static_cast<int>(misses.size())), [&](const cv::Range& range) {
+            for (int m = range.start; m < range.end; m++) {
+                images[m] = cv::imdecode(files[misses[m]], cv::IMREAD_COLOR);
+                std::vector<uchar>().swap(files[misses[m]]);
+            }
+        });
+
+        std::vector<cv::Mat> decoded;
+        std::vector<size_t> decoded_ids;
+        for (size_t m = 0; m < misses.size(); m++) {
+            if (!images[m].empty()) {
+                decoded.push_back(images[m]);
+                decoded_ids.push_back(begin + misses[m]);
+            }
+        }
+        images.clear();
+
+        std::vector<cv::Mat> decoded_embeddings;
+        std::vector<RegistrationStatus> decoded_statuses;
+        RegisterIdentities(decoded, &decoded_embeddings, &decoded_statuses);
+        for (size_t m = 0; m < decoded_ids.size(); m++) {
+            const size_t idx = decoded_ids[m];
+            (*statuses)[idx] = decoded_statuses[m];
+            if (decoded_statuses[m] != RegistrationStatus::SUCCESS) {
+                continue;
+            }
+            (*embeddings)[idx] = decoded_embeddings[m];
+            if (cache) {
+                cache->Put(paths[idx], hashes[idx - begin], decoded_embeddings[m]);
+            }
+        }
+    }
 }
 
 EmbeddingsGallery::EmbeddingsGallery(const std::string& ids_list,
@@ -85,22 +208,48 @@ EmbeddingsGallery::EmbeddingsGallery(const std::string& ids_list,
                                      bool crop_gallery, const detection::DetectorConfig &detector_config,
                                      const VectorCNN& landmarks_det,
                                      const VectorCNN& image_reid,
-                                     bool use_greedy_matcher)
+                                     bool use_greedy_matcher,
+                                     int ann_min_gallery_size,
+                                     int ann_top_k,
+                                     const std::string& cache_path)
     : reid_threshold(threshold),
-      use_greedy_matcher(use_greedy_matcher) {
+      use_greedy_matcher(use_greedy_matcher),
+      ann_min_gallery_size(ann_min_gallery_size),
+      ann_top_k(std::max(1, ann_top_k)),
+      min_size_fr(min_size_fr),
+      crop_gallery(crop_gallery),
+      landmarks_det(&landmarks_det),
+      image_reid(&image_reid) {
+    if (crop_gallery) {
+        detection::DetectorConfig async_config = detector_config;
+        async_config.is_async = true;
+        detector.reset(new detection::FaceDetection(async_config));
+    }
+
+    if (!cache_path.empty()) {
+        uint64_t model_hash = HashModel(landmarks_det.config(), EmbeddingsCache::kHashSeed);
+        model_hash = HashModel(image_reid.config(), model_hash);
+        model_hash = EmbeddingsCache::Hash(&min_size_fr, sizeof(min_size_fr), model_hash);
+        if (crop_gallery) {
+            const float det_params[] = {detector_config.confidence_threshold,
+                                        detector_config.increase_scale_x,
+                                        detector_config.increase_scale_y};
+            model_hash = HashModel(detector_config, model_hash);
+            model_hash = EmbeddingsCache::Hash(det_params, sizeof(det_params), model_hash);
+        }
+        cache.reset(new EmbeddingsCache(cache_path, model_hash));
+    }
+
     if (ids_list.empty()) {
         return;
     }
 
-    detection::FaceDetection detector(detector_config);
-
     cv::FileStorage fs(ids_list, cv::FileStorage::Mode::READ);
     cv::FileNode fn = fs.root();
-    int id = 0;
+    std::vector<std::string> labels, paths;
     for (cv::FileNodeIterator fit = fn.begin(); fit != fn.end(); ++fit) {
         cv::FileNode item = *fit;
         std::string label = item.name();
-        std::vector<cv::Mat> embeddings;
 
         // Please, note that the case when there are more than one image in gallery
         // for a person might not work properly with the current implementation
@@ -115,57 +264,221 @@ EmbeddingsGallery::EmbeddingsGallery(const std::string& ids_list,
             } else {
                 path = folder_name(ids_list) + separator() + item[i].string();
             }
+            labels.push_back(label);
+            paths.push_back(path);
+        }
+    }
+
+    std::vector<cv::Mat> embeddings;
+    std::vector<RegistrationStatus> statuses;
+    ComputeEmbeddings(paths, &embeddings, &statuses);
+    for (size_t i = 0; i < paths.size(); i++) {
+        CV_Assert(statuses[i] != RegistrationStatus::FAILURE_NOT_LOADED);
+        if (statuses[i] == RegistrationStatus::SUCCESS) {
+            identities.emplace_back(std::vector<cv::Mat>{embeddings[i]}, labels[i],
+                                    static_cast<int>(identities.size()));
+            identities.back().image_paths = {paths[i]};
+        }
+    }
 
-            cv::Mat image = cv::imread(path);
-            CV_Assert(!image.empty());
-            cv::Mat emb;
-            RegistrationStatus status = RegisterIdentity(label, image, min_size_fr, crop_gallery,  detector, landmarks_det, image_reid, emb);
-            if (status == RegistrationStatus::SUCCESS) {
-                embeddings.push_back(emb);
-                idx_to_id.push_back(id);
-                identities.emplace_back(embeddings, label, id);
-                ++id;
+    if (cache) {
+        cache->Flush();
+    }
+    RebuildMatrix();
+}
+
+EmbeddingsGallery::EmbeddingsGallery(const std::vector<GalleryObject>& identities,
+                                     double threshold,
+                                     bool use_greedy_matcher,
+                                     int ann_min_gallery_size,
+                                     int ann_top_k)
+    : reid_threshold(threshold),
+      identities(identities),
+      use_greedy_matcher(use_greedy_matcher),
+      ann_min_gallery_size(ann_min_gallery_size),
+      ann_top_k(std::max(1, ann_top_k)),
+      min_size_fr(0),
+      crop_gallery(false),
+      landmarks_det(nullptr),
+      image_reid(nullptr) {
+    RebuildMatrix();
+}
+
+RegistrationStatus EmbeddingsGallery::AddIdentity(const std::string& label, const std::string& image_path) {
+    std::string path = image_path;
+    if (!file_exists(path)) {
+        path = EmbeddingsGallery::fr_gallery_root + image_path;
+    }
+
+    std::vector<cv::Mat> embeddings;
+    std::vector<RegistrationStatus> statuses;
+    ComputeEmbeddings({path}, &embeddings, &statuses);
+    if (statuses[0] != RegistrationStatus::SUCCESS) {
+        return statuses[0];
+    }
+
+    // A label keeps its id, so tracks already labeled with it stay labeled.
+    auto it = std::find_if(identities.begin(), identities.end(),
+                           [&label](const GalleryObject& o){return o.label == label;});
+    if (it != identities.end()) {
+        ReleaseImages(*it, path);
+        it->embeddings = {embeddings[0]};
+    } else {
+        identities.emplace_back(std::vector<cv::Mat>{embeddings[0]}, label, static_cast<int>(identities.size()));
+        it = identities.end() - 1;
+    }
+    it->image_paths = {path};
+
+    if (cache) {
+        cache->Flush();
+    }
+    RebuildMatrix();
+    return RegistrationStatus::SUCCESS;
+}
+
+bool EmbeddingsGallery::RemoveIdentity(const std::string& label) {
+    bool removed = false;
+    for (auto& identity : identities) {
+        if (identity.label == label && !identity.embeddings.empty()) {
+            ReleaseImages(identity);
+            identity.embeddings.clear();
+            identity.image_paths.clear();
+            removed = true;
+        }
+    }
+    if (removed) {
+        if (cache) {
+            cache->Flush();
+        }
+        RebuildMatrix();
+    }
+    return removed;
+}
+
+// Marks the cached embeddings of the images of an identity unused, so that the
+// next flush drops them, except the kept one and those other identities use.
+void EmbeddingsGallery::ReleaseImages(const GalleryObject& identity, const std::string& kept_path) {
+    if (!cache) {
+        return;
+    }
+    for (const auto& path : identity.image_paths) {
+        bool shared = path == kept_path ||
+                std::any_of(identities.begin(), identities.end(), [&](const GalleryObject& o) {
+                    return &o != &identity && !o.embeddings.empty() &&
+                           std::find(o.image_paths.begin(), o.image_paths.end(), path) != o.image_paths.end();
+                });
+        if (!shared) {
+            cache->Release(path);
+        }
+    }
+}
+
+void EmbeddingsGallery::RebuildMatrix() {
+    // Removed identities keep their slots with no embeddings, so ids stay stable.
+    gallery_embeddings.release();
+    idx_to_id.clear();
+    for (const auto& identity : identities) {
+        for (const auto& emb : identity.embeddings) {
+            gallery_embeddings.push_back(cv::Mat(1, static_cast<int>(emb.total()), CV_32F));
+            NormalizeEmbedding(emb, gallery_embeddings.row(gallery_embeddings.rows - 1));
+            idx_to_id.push_back(identity.id);
+        }
+    }
+    BuildIndex();
+}
+
+void EmbeddingsGallery::BuildIndex() {
+    ann_index.release();
+    if (ann_min_gallery_size <= 0 || gallery_embeddings.rows < ann_min_gallery_size) {
+        return;
+    }
+    ann_index = cv::makePtr<cv::flann::Index>(gallery_embeddings,
+                                              cv::flann::KMeansIndexParams(kAnnBranching));
+}
+
+cv::Mat EmbeddingsGallery::ComputeDistances(const cv::Mat& queries, std::vector<int>* columns) const {
+    columns->clear();
+    cv::Mat distances;
+
+    if (!ann_index) {
+        // Cosine distances for all pairs at once: 1 - Q * G^T over L2-normalized rows.
+        cv::gemm(queries, gallery_embeddings, -1.0, cv::noArray(), 0.0, distances, cv::GEMM_2_T);
+        distances += 1.0;
+        distances = cv::max(distances, 0.0);
+        columns->resize(distances.cols);
+        for (int j = 0; j < distances.cols; j++) {
+            (*columns)[j] = j;
+        }
+        return distances;
+    }
+
+    // Only the top-k gallery candidates of every query take part in the assignment.
+    // For L2-normalized vectors the squared L2 distance is twice the cosine distance.
+    const int k = std::min(ann_top_k, gallery_embeddings.rows);
+    cv::Mat knn_idx, knn_dist;
+    ann_index->knnSearch(queries, knn_idx, knn_dist, k, cv::flann::SearchParams(kAnnChecks));
+
+    columns->assign(knn_idx.begin<int>(), knn_idx.end<int>());
+    columns->erase(std::remove(columns->begin(), columns->end(), -1), columns->end());
+    std::sort(columns->begin(), columns->end());
+    columns->erase(std::unique(columns->begin(), columns->end()), columns->end());
+
+    distances.create(queries.rows, std::max<int>(1, static_cast<int>(columns->size())), CV_32F);
+    distances.setTo(kMaxReidDistance);
+    for (int i = 0; i < queries.rows; i++) {
+        for (int n = 0; n < k; n++) {
+            int idx = knn_idx.at<int>(i, n);
+            if (idx < 0) {
+                continue;
             }
+            auto col = std::lower_bound(columns->begin(), columns->end(), idx) - columns->begin();
+            distances.at<float>(i, static_cast<int>(col)) =
+                    std::min(kMaxReidDistance, std::max(0.0f, 0.5f * knn_dist.at<float>(i, n)));
         }
     }
+    return distances;
 }
 
 std::vector<int> EmbeddingsGallery::GetIDsByEmbeddings(const std::vector<cv::Mat>& embeddings) const {
     if (embeddings.empty() || idx_to_id.empty())
         return std::vector<int>(embeddings.size(), unknown_id);
 
-    cv::Mat distances(static_cast<int>(embeddings.size()), static_cast<int>(idx_to_id.size()), CV_32F);
-
-    for (int i = 0; i < distances.rows; i++) {
-        int k = 0;
-        for (size_t j = 0; j < identities.size(); j++) {
-            for (const auto& reference_emb : identities[j].embeddings) {
-                distances.at<float>(i, k) = ComputeReidDistance(embeddings[i], reference_emb);
-                k++;
-            }
-        }
+    cv::Mat queries(static_cast<int>(embeddings.size()), gallery_embeddings.cols, CV_32F);
+    for (int i = 0; i < queries.rows; i++) {
+        NormalizeEmbedding(embeddings[i], queries.row(i));
     }
-    KuhnMunkres matcher(use_greedy_matcher);
-    auto matched_idx = matcher.Solve(distances);
+
+    std::vector<int> columns;
+    cv::Mat distances = ComputeDistances(queries, &columns);
+
+    // The solver workspaces are kept per thread between frames, so that galleries
+    // shared by threads stay reentrant. Queries change every frame, so there is no
+    // warm start hint.
+    thread_local KuhnMunkres exact_matcher(false), greedy_matcher(true);
+    thread_local std::vector<size_t> matched_idx;
+    matched_idx.clear();
+    (use_greedy_matcher ? greedy_matcher : exact_matcher).Solve(distances, &matched_idx);
     std::vector<int> output_ids;
     for (auto col_idx : matched_idx) {
-        if (distances.at<float>(output_ids.size(), col_idx) > reid_threshold)
+        if (col_idx >= columns.size() ||
+            distances.at<float>(output_ids.size(), col_idx) > reid_threshold)
             output_ids.push_back(unknown_id);
         else
-            output_ids.push_back(idx_to_id[col_idx]);
+            output_ids.push_back(idx_to_id[columns[col_idx]]);
     }
     return output_ids;
 }
 
 std::string EmbeddingsGallery::GetLabelByID(int id) const {
-    if (id >= 0 && id < static_cast<int>(identities.size()))
+    if (id >= 0 && id < static_cast<int>(identities.size()) && !identities[id].embeddings.empty())
         return identities[id].label;
     else
         return unknown_label;
 }
 
 size_t EmbeddingsGallery::size() const {
-    return identities.size();
+    return std::count_if(identities.begin(), identities.end(),
+                         [](const GalleryObject& o){return !o.embeddings.empty();});
 }
 
 std::vector<std::string> EmbeddingsGallery::GetIDToLabelMap() const  {
@@ -179,5 +492,5 @@ std::vector<std::string> EmbeddingsGallery::GetIDToLabelMap() const  {
 
 bool EmbeddingsGallery::LabelExists(const std::string& label) const {
     return identities.end() != std::find_if(identities.begin(), identities.end(),
-                                        [label](const GalleryObject& o){return o.label == label;});
+                                        [label](const GalleryObject& o){return o.label == label && !o.embeddings.empty();});
 }
@@ -0,0 +1,223 @@
+#include "shards.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+
+namespace {
+
+float IoU(const cv::Rect& r1, const cv::Rect& r2) {
+    const int intersection = (r1 & r2).area();
+    const int area_union = r1.area() + r2.area() - intersection;
+    return area_union > 0 ? static_cast<float>(intersection) / area_union : 0.f;
+}
+
+// Cosine distance between two sums of normalized embeddings, i.e. between
+// their means.
+float ReidDistance(const cv::Mat& e1, const cv::Mat& e2) {
+    const double norms = cv::norm(e1) * cv::norm(e2);
+    return norms > 0 ? static_cast<float>(1.0 - e1.dot(e2) / norms) : 0.f;
+}
+
+// Boxes of a track in frames [begin, end) of the video, keyed by the frame.
+std::map<int, cv::Rect> BoxesInRange(const Track& track, int first_frame, int begin, int end) {
+    std::map<int, cv::Rect> boxes;
+    for (const auto& obj : track.objects) {
+        const int frame = first_frame + static_cast<int>(obj.frame_idx);
+        if (frame >= begin && frame < end) {
+            boxes[frame] = obj.rect;
+        }
+    }
+    return boxes;
+}
+
+// Matches tracks of two shards by boxes in frames [begin, end) that both
+// shards have processed, and by reid embeddings of the tracks if both
+// have them. Returns pairs of object ids of matched tracks.
+std::vector<std::pair<int, int>> MatchTracks(const ShardResult& result1, int first_frame1,
+                                             const ShardResult& result2, int first_frame2,
+                                             int begin, int end, float min_iou,
+                                             float max_reid_distance) {
+    const auto& tracks1 = result1.face_tracks;
+    const auto& tracks2 = result2.face_tracks;
+    std::vector<std::map<int, cv::Rect>> boxes1, boxes2;
+    for (const auto& track : tracks1) {
+        boxes1.push_back(BoxesInRange(track, first_frame1, begin, end));
+    }
+    for (const auto& track : tracks2) {
+        boxes2.push_back(BoxesInRange(track, first_frame2, begin, end));
+    }
+
+    // (affinity, (index in tracks1, index in tracks2))
+    std::vector<std::pair<float, std::pair<size_t, size_t>>> candidates;
+    for (size_t i = 0; i < tracks1.size(); i++) {
+        if (boxes1[i].empty()) {
+            continue;
+        }
+        const int label1 = LabelWithMaxFrequencyInTrack(tracks1[i], std::numeric_limits<int>::max());
+        const auto embedding1 = result1.face_track_embeddings.find(tracks1[i].first_object.object_id);
+        for (size_t j = 0; j < tracks2.size(); j++) {
+            if (boxes2[j].empty()) {
+                continue;
+            }
+            // Tracks of different known persons are never joined.
+            const int label2 = LabelWithMaxFrequencyInTrack(tracks2[j], std::numeric_limits<int>::max());
+            if (label1 != TrackedObject::UNKNOWN_LABEL_IDX && label2 != TrackedObject::UNKNOWN_LABEL_IDX &&
+                    label1 != label2) {
+                continue;
+            }
+            // Neither are tracks of persons who look different.
+            const auto embedding2 = result2.face_track_embeddings.find(tracks2[j].first_object.object_id);
+            if (embedding1 != result1.face_track_embeddings.end() &&
+                    embedding2 != result2.face_track_embeddings.end() &&
+                    ReidDistance(embedding1->second, embedding2->second) > max_reid_distance) {
+                continue;
+            }
+
+            float sum_iou = 0.f;
+            for (const auto& box : boxes1[i]) {
+                auto it = boxes2[j].find(box.first);
+                if (it != boxes2[j].end()) {
+                    sum_iou += IoU(box.second, it->second);
+                }
+            }
+            // Frames where only one of the tracks is seen count as no overlap.
+            const float affinity = sum_iou / std::max(boxes1[i].size(), boxes2[j].size());
+            if (affinity >= min_iou) {
+                candidates.push_back({affinity, {i, j}});
+            }
+        }
+    }
+
+    std::sort(candidates.begin(), candidates.end(),
+              [](const std::pair<float, std::pair<size_t, size_t>>& c1,
+                 const std::pair<float, std::pair<size_t, size_t>>& c2) { return c1.first > c2.first; });
+    std::vector<char> matched1(tracks1.size(), 0), matched2(tracks2.size(), 0);
+    std::vector<std::pair<int, int>> matches;
+    for (const auto& candidate : candidates) {
+        const size_t i = candidate.second.first;
+        const size_t j = candidate.second.second;
+        if (matched1[i] || matched2[j]) {
+            continue;
+        }
+        matched1[i] = matched2[j] = 1;
+        matches.emplace_back(tracks1[i].first_object.object_id, tracks2[j].first_object.object_id);
+    }
+    return matches;
+}
+
+}  // namespace
+
+std::vector<VideoShard> SplitIntoShards(const std::vector<std::string>& videos,
+                                        const std::vector<int>& frame_counts,
+                                        int num_shards, int overlap_frames) {
+    CV_Assert(videos.size() == frame_counts.size());
+    overlap_frames = std::max(overlap_frames, 0);
+    long long total_frames = 0;
+    for (int count : frame_counts) {
+        total_frames += std::max(count, 0);
+    }
+    num_shards = std::max(num_shards, 1);
+    const int shard_size = std::max(static_cast<int>((total_frames + num_shards - 1) / num_shards),
+                                    overlap_frames + 1);
+
+    std::vector<VideoShard> shards;
+    for (size_t v = 0; v < videos.size(); v++) {
+        const int num_frames = frame_counts[v];
+        // Videos of unknown length, e.g. streams, are not split.
+        const int num_pieces = num_frames > 0 ? (num_frames + shard_size - 1) / shard_size : 1;
+        const int piece_size = num_frames > 0 ? (num_frames + num_pieces - 1) / num_pieces : 0;
+        for (int i = 0; i < num_pieces; i++) {
+            const int first_frame = i * piece_size;
+            // The frame count of a container may be inexact, so the last
+            // shard goes on to the end of the video.
+            const int shard_frames = i + 1 < num_pieces
+                                     ? std::min(piece_size + overlap_frames, num_frames - first_frame)
+                                     : -1;
+            shards.push_back({videos[v], static_cast<int>(v), first_frame, shard_frames});
+        }
+    }
+    return shards;
+}
+
+void StitchShards(const std::vector<VideoShard>& shards,
+                  const std::vector<ShardResult>& results,
+                  float min_iou, float max_reid_distance,
+                  std::vector<Track>* face_tracks,
+                  std::vector<std::map<int, int>>* face_obj_id_to_action_maps) {
+    CV_Assert(shards.size() == results.size());
+    face_tracks->clear();
+    face_obj_id_to_action_maps->clear();
+
+    std::map<int, TrackedObjects> track_objects;  // by the stitched track id
+    std::map<int, int> prev_ids;  // object id in the previous shard -> stitched track id
+    int next_id = 0;
+    int own_begin = 0;
+    int prev_end = 0;
+    for (size_t k = 0; k < shards.size(); k++) {
+        const auto& shard = shards[k];
+        const auto& result = results[k];
+        const int shard_end = shard.first_frame + static_cast<int>(result.face_obj_id_to_action_maps.size());
+
+        // A shard that stopped early leaves a gap before the next one, the
+        // frames of the gap have no faces.
+        for (; own_begin < shard.first_frame; own_begin++) {
+            face_obj_id_to_action_maps->emplace_back();
+        }
+
+        // Frames of the overlap with the next shard are split in halves.
+        int own_end = std::max(own_begin, shard_end);
+        if (k + 1 < shards.size()) {
+            own_end = std::max(own_begin, std::min(shard_end, (shards[k + 1].first_frame + shard_end) / 2));
+        }
+
+        std::map<int, int> ids;
+        if (k > 0) {
+            const auto matches = MatchTracks(results[k - 1], shards[k - 1].first_frame,
+                                             result, shard.first_frame,
+                                             shard.first_frame, prev_end, min_iou, max_reid_distance);
+            for (const auto& match : matches) {
+                ids[match.second] = prev_ids.at(match.first);
+            }
+        }
+
+        for (const auto& track : result.face_tracks) {
+            const int object_id = track.first_object.object_id;
+            if (ids.count(object_id) == 0) {
+                ids[object_id] = next_id++;
+            }
+            const int id = ids[object_id];
+            for (const auto& obj : track.objects) {
+                const int frame = shard.first_frame + static_cast<int>(obj.frame_idx);
+                if (frame < own_begin || frame >= own_end) {
+                    continue;
+                }
+                TrackedObject stitched = obj;
+                stitched.object_id = id;
+                stitched.frame_idx = frame;
+                track_objects[id].push_back(stitched);
+            }
+        }
+
+        for (int frame = own_begin; frame < own_end; frame++) {
+            std::map<int, int> actions;
+            for (const auto& kv : result.face_obj_id_to_action_maps[frame - shard.first_frame]) {
+                auto it = ids.find(kv.first);
+                if (it != ids.end()) {
+                    actions[it->second] = kv.second;
+                }
+            }
+            face_obj_id_to_action_maps->push_back(std::move(actions));
+        }
+
+        prev_ids = std::move(ids);
+        own_begin = own_end;
+        prev_end = shard_end;
+    }
+
+    for (const auto& kv : track_objects) {
+        if (!kv.second.empty()) {
+            face_tracks->emplace_back(kv.second);
+        }
+    }
+}
@@ -10,199 +10,321 @@
 #include <memory>
 #include <vector>
 #include <tuple>
-#include <set>
+#include <cmath>
 #include "logger.hpp"
 
 const int TrackedObject::UNKNOWN_LABEL_IDX = -1;
 
+namespace {
+
+const size_t kFreeSlot = static_cast<size_t>(-1);
+
+void SetBit(std::vector<uint64_t> *bits, size_t idx, bool value) {
+    const uint64_t mask = uint64_t(1) << (idx % 64);
+    if (value) {
+        (*bits)[idx / 64] |= mask;
+    } else {
+        (*bits)[idx / 64] &= ~mask;
+    }
+}
+
+// Calls func for every index that is set in bits and not set in excluded.
+template <typename Func>
+void ForEachSetBit(const std::vector<uint64_t> &bits, const std::vector<uint64_t> &excluded, Func func) {
+    for (size_t w = 0; w < bits.size(); w++) {
+        uint64_t word = bits[w] & ~excluded[w];
+        for (size_t b = 0; word; b++, word >>= 1) {
+            if (word & 1) {
+                func(w * 64 + b);
+            }
+        }
+    }
+}
+
+template <typename Func>
+void ForEachSetBit(const std::vector<uint64_t> &bits, Func func) {
+    for (size_t w = 0; w < bits.size(); w++) {
+        uint64_t word = bits[w];
+        for (size_t b = 0; word; b++, word >>= 1) {
+            if (word & 1) {
+                func(w * 64 + b);
+            }
+        }
+    }
+}
+
+// Puts objects evicted from the history of a track back in front of it.
+void UnspillObjects(Track *track) {
+    if (track->spilled_objects.empty()) {
+        return;
+    }
+    TrackHistory objects;
+    for (const auto &obj : track->spilled_objects) {
+        objects.push_back(obj);
+    }
+    for (const auto &obj : track->objects) {
+        objects.push_back(obj);
+    }
+    track->objects = std::move(objects);
+    TrackedObjects().swap(track->spilled_objects);
+}
+
+}  // namespace
+
 class KuhnMunkres::Impl {
 public:
-    explicit Impl(bool greedy) : n_(), greedy_(greedy) {}
+    explicit Impl(bool greedy) : greedy_(greedy) {}
 
-    std::vector<size_t> Solve(const cv::Mat &dissimilarity_matrix) {
+    void Solve(const cv::Mat &dissimilarity_matrix, std::vector<size_t> *assignment) {
         CV_Assert(dissimilarity_matrix.type() == CV_32F);
         double min_val;
         cv::minMaxLoc(dissimilarity_matrix, &min_val);
         CV_Assert(min_val >= 0);
 
-        n_ = std::max(dissimilarity_matrix.rows, dissimilarity_matrix.cols);
-        dm_ = cv::Mat(n_, n_, CV_32F, cv::Scalar(0));
-        marked_ = cv::Mat(n_, n_, CV_8S, cv::Scalar(0));
-        points_ = std::vector<cv::Point>(n_ * 2);
-
-        dissimilarity_matrix.copyTo(dm_(
-                                        cv::Rect(0, 0, dissimilarity_matrix.cols, dissimilarity_matrix.rows)));
-
-        is_row_visited_ = std::vector<int>(n_, 0);
-        is_col_visited_ = std::vector<int>(n_, 0);
-
-        Run();
-
-        std::vector<size_t> results(dissimilarity_matrix.rows, -1);
-        for (int i = 0; i < dissimilarity_matrix.rows; i++) {
-            const auto ptr = marked_.ptr<char>(i);
-            for (int j = 0; j < dissimilarity_matrix.cols; j++) {
-                if (ptr[j] == kStar) {
-                    results[i] = j;
+        const int rows = dissimilarity_matrix.rows;
+        const int cols = dissimilarity_matrix.cols;
+
+        // The solver assigns every row of a rows <= cols problem, so taller
+        // problems are solved transposed.
+        transposed_ = !greedy_ && rows > cols;
+        nr_ = transposed_ ? cols : rows;
+        nc_ = transposed_ ? rows : cols;
+        cost_.resize(static_cast<size_t>(nr_) * nc_);
+        for (int i = 0; i < rows; i++) {
+            const auto ptr = dissimilarity_matrix.ptr<float>(i);
+            for (int j = 0; j < cols; j++) {
+                if (transposed_) {
+                    cost_[static_cast<size_t>(j) * nc_ + i] = ptr[j];
+                } else {
+                    cost_[static_cast<size_t>(i) * nc_ + j] = ptr[j];
                 }
             }
         }
-        return results;
-    }
-
-    void TrySimpleCase() {
-        auto is_row_visited = std::vector<int>(n_, 0);
-        auto is_col_visited = std::vector<int>(n_, 0);
 
-        for (int row = 0; row < n_; row++) {
-            auto ptr = dm_.ptr<float>(row);
-            auto marked_ptr = marked_.ptr<char>(row);
-            auto min_val = *std::min_element(ptr, ptr + n_);
-            for (int col = 0; col < n_; col++) {
-                ptr[col] -= min_val;
-                if (ptr[col] == 0 && !is_col_visited[col] && !is_row_visited[row]) {
-                    marked_ptr[col] = kStar;
-                    is_col_visited[col] = 1;
-                    is_row_visited[row] = 1;
+        col4row_.assign(nr_, -1);
+        row4col_.assign(nc_, -1);
+        if (greedy_) {
+            SolveGreedy();
+        } else {
+            WarmStart(*assignment, rows, cols);
+            for (int row = 0; row < nr_; row++) {
+                if (col4row_[row] < 0) {
+                    Augment(row);
                 }
             }
         }
-    }
 
-    bool CheckIfOptimumIsFound() {
-        int count = 0;
-        for (int i = 0; i < n_; i++) {
-            const auto marked_ptr = marked_.ptr<char>(i);
-            for (int j = 0; j < n_; j++) {
-                if (marked_ptr[j] == kStar) {
-                    is_col_visited_[j] = 1;
-                    count++;
-                }
+        assignment->assign(rows, static_cast<size_t>(-1));
+        for (int row = 0; row < nr_; row++) {
+            const int col = col4row_[row];
+            if (col < 0) {
+                continue;
+            }
+            if (transposed_) {
+                (*assignment)[col] = row;
+            } else {
+                (*assignment)[row] = col;
             }
         }
-
-        return count >= n_;
     }
 
-    cv::Point FindUncoveredMinValPos() {
-        auto min_val = std::numeric_limits<float>::max();
-        cv::Point min_val_pos(-1, -1);
-        for (int i = 0; i < n_; i++) {
-            if (!is_row_visited_[i]) {
-                auto dm_ptr = dm_.ptr<float>(i);
-                for (int j = 0; j < n_; j++) {
-                    if (!is_col_visited_[j] && dm_ptr[j] < min_val) {
-                        min_val = dm_ptr[j];
-                        min_val_pos = cv::Point(j, i);
-                    }
+    void NearestHint(const cv::Mat &dissimilarity_matrix, std::vector<size_t> *hint) {
+        const int rows = dissimilarity_matrix.rows;
+        const int cols = dissimilarity_matrix.cols;
+        row4col_.assign(cols, -1);
+        shortest_.assign(cols, std::numeric_limits<double>::infinity());
+        hint->assign(rows, static_cast<size_t>(-1));
+        for (int i = 0; i < rows; i++) {
+            const auto ptr = dissimilarity_matrix.ptr<float>(i);
+            float row_min = std::numeric_limits<float>::infinity();
+            for (int j = 0; j < cols; j++) {
+                if (ptr[j] < row_min) {
+                    row_min = ptr[j];
+                    (*hint)[i] = j;
                 }
+                if (ptr[j] < shortest_[j]) {
+                    shortest_[j] = ptr[j];
+                    row4col_[j] = i;
+                }
+            }
+        }
+        for (int i = 0; i < rows; i++) {
+            if ((*hint)[i] < static_cast<size_t>(cols) && row4col_[(*hint)[i]] != i) {
+                (*hint)[i] = static_cast<size_t>(-1);
             }
         }
-        return min_val_pos;
     }
 
-    void UpdateDissimilarityMatrix(float val) {
-        for (int i = 0; i < n_; i++) {
-            auto dm_ptr = dm_.ptr<float>(i);
-            for (int j = 0; j < n_; j++) {
-                if (is_row_visited_[i]) dm_ptr[j] += val;
-                if (!is_col_visited_[j]) dm_ptr[j] -= val;
+private:
+    float Cost(int row, int col) const { return cost_[static_cast<size_t>(row) * nc_ + col]; }
+
+    // Every row takes its cheapest column that no earlier row took, rows are
+    // left unassigned only once all columns are taken.
+    void SolveGreedy() {
+        for (int row = 0; row < nr_; row++) {
+            int best = -1;
+            for (int col = 0; col < nc_; col++) {
+                if (row4col_[col] < 0 && (best < 0 || Cost(row, col) < Cost(row, best))) {
+                    best = col;
+                }
+            }
+            if (best >= 0) {
+                col4row_[row] = best;
+                row4col_[best] = row;
             }
         }
     }
 
-    int FindInRow(int row, int what) {
-        for (int j = 0; j < n_; j++) {
-            if (marked_.at<char>(row, j) == what) {
-                return j;
+    // Starts from zero column potentials and row potentials of the row
+    // minima, which are feasible duals. The pairs of the hint that are tight
+    // with respect to them, i.e. the cheapest of their row, are kept, so only
+    // the other rows have to be augmented.
+    void WarmStart(const std::vector<size_t> &hint, int rows, int cols) {
+        v_.assign(nc_, 0.0);
+        u_.resize(nr_);
+
+        if (static_cast<int>(hint.size()) == rows) {
+            for (int i = 0; i < rows; i++) {
+                if (hint[i] >= static_cast<size_t>(cols)) {
+                    continue;
+                }
+                const int row = transposed_ ? static_cast<int>(hint[i]) : i;
+                const int col = transposed_ ? i : static_cast<int>(hint[i]);
+                if (col4row_[row] < 0 && row4col_[col] < 0) {
+                    col4row_[row] = col;
+                    row4col_[col] = row;
+                }
             }
         }
-        return -1;
-    }
 
-    int FindInCol(int col, int what) {
-        for (int i = 0; i < n_; i++) {
-            if (marked_.at<char>(i, col) == what) {
-                return i;
+        for (int row = 0; row < nr_; row++) {
+            u_[row] = MinReducedCost(row);
+            const int col = col4row_[row];
+            if (col >= 0 && Cost(row, col) - v_[col] > u_[row] + kTightEps) {
+                col4row_[row] = -1;
+                row4col_[col] = -1;
             }
         }
-        return -1;
     }
 
-    void Run() {
-        TrySimpleCase();
+    double MinReducedCost(int row) const {
+        double min_val = std::numeric_limits<double>::infinity();
+        for (int col = 0; col < nc_; col++) {
+            min_val = std::min(min_val, Cost(row, col) - v_[col]);
+        }
+        return min_val;
+    }
 
-        if (greedy_)
-            return;
+    // Shortest augmenting path from the row to a free column (Jonker-Volgenant).
+    void Augment(int cur_row) {
+        shortest_.assign(nc_, std::numeric_limits<double>::infinity());
+        path_.assign(nc_, -1);
+        visited_row_.assign(nr_, 0);
+        visited_col_.assign(nc_, 0);
+        remaining_.resize(nc_);
+        for (int it = 0; it < nc_; it++) {
+            remaining_[it] = nc_ - it - 1;
+        }
 
-        while (!CheckIfOptimumIsFound()) {
-            while (true) {
-                auto point = FindUncoveredMinValPos();
-                auto min_val = dm_.at<float>(point.y, point.x);
-                if (min_val > 0) {
-                    UpdateDissimilarityMatrix(min_val);
-                } else {
-                    marked_.at<char>(point.y, point.x) = kPrime;
-                    int col = FindInRow(point.y, kStar);
-                    if (col >= 0) {
-                        is_row_visited_[point.y] = 1;
-                        is_col_visited_[col] = 0;
-                    } else {
-                        int count = 0;
-                        points_[count] = point;
-
-                        while (true) {
-                            int row = FindInCol(points_[count].x, kStar);
-                            if (row >= 0) {
-                                count++;
-                                points_[count] = cv::Point(points_[count - 1].x, row);
-                                int col = FindInRow(points_[count].y, kPrime);
-                                count++;
-                                points_[count] = cv::Point(col, points_[count - 1].y);
-                            } else {
-                                break;
-                            }
-                        }
-
-                        for (int i = 0; i < count + 1; i++) {
-                            auto &mark = marked_.at<char>(points_[i].y, points_[i].x);
-                            mark = mark == kStar ? 0 : kStar;
-                        }
-
-                        is_row_visited_ = std::vector<int>(n_, 0);
-                        is_col_visited_ = std::vector<int>(n_, 0);
-
-                        marked_.setTo(0, marked_ == kPrime);
-                        break;
-                    }
+        int num_remaining = nc_;
+        double min_val = 0;
+        int sink = -1;
+        int row = cur_row;
+        while (sink < 0) {
+            visited_row_[row] = 1;
+            int index = -1;
+            double lowest = std::numeric_limits<double>::infinity();
+            for (int it = 0; it < num_remaining; it++) {
+                const int col = remaining_[it];
+                const double reduced = min_val + Cost(row, col) - u_[row] - v_[col];
+                if (reduced < shortest_[col]) {
+                    path_[col] = row;
+                    shortest_[col] = reduced;
+                }
+                if (shortest_[col] < lowest || (shortest_[col] == lowest && row4col_[col] < 0)) {
+                    lowest = shortest_[col];
+                    index = it;
                 }
             }
-        }
-    }
 
-private:
-    static constexpr int kStar = 1;
-    static constexpr int kPrime = 2;
+            min_val = lowest;
+            const int col = remaining_[index];
+            if (row4col_[col] < 0) {
+                sink = col;
+            } else {
+                row = row4col_[col];
+            }
+            visited_col_[col] = 1;
+            remaining_[index] = remaining_[--num_remaining];
+        }
 
-    cv::Mat dm_;
-    cv::Mat marked_;
-    std::vector<cv::Point> points_;
+        u_[cur_row] += min_val;
+        for (int i = 0; i < nr_; i++) {
+            if (visited_row_[i] && i != cur_row) {
+                u_[i] += min_val - shortest_[col4row_[i]];
+            }
+        }
+        for (int j = 0; j < nc_; j++) {
+            if (visited_col_[j]) {
+                v_[j] -= min_val - shortest_[j];
+            }
+        }
 
-    std::vector<int> is_row_visited_;
-    std::vector<int> is_col_visited_;
+        int col = sink;
+        while (true) {
+            const int i = path_[col];
+            row4col_[col] = i;
+            std::swap(col4row_[i], col);
+            if (i == cur_row) {
+                break;
+            }
+        }
+    }
 
-    int n_;
+    static constexpr double kTightEps = 1e-9;
+
+    // Workspace is kept between calls, so a solver that sees problems of
+    // similar size every frame does not allocate.
+    std::vector<float> cost_;
+    std::vector<double> u_;
+    std::vector<double> v_;
+    std::vector<double> shortest_;
+    std::vector<int> path_;
+    std::vector<int> col4row_;
+    std::vector<int> row4col_;
+    std::vector<int> remaining_;
+    std::vector<char> visited_row_;
+    std::vector<char> visited_col_;
+
+    int nr_ = 0;
+    int nc_ = 0;
+    bool transposed_ = false;
     bool greedy_;
 };
 
 KuhnMunkres::KuhnMunkres(bool greedy) : impl_(std::make_shared<Impl>(greedy)) {}
 
 std::vector<size_t> KuhnMunkres::Solve(const cv::Mat &dissimilarity_matrix) {
+    std::vector<size_t> assignment;
+    Solve(dissimilarity_matrix, &assignment);
+    return assignment;
+}
+
+void KuhnMunkres::Solve(const cv::Mat &dissimilarity_matrix, std::vector<size_t> *assignment) {
     CV_Assert(impl_ != nullptr);
+    CV_Assert(assignment != nullptr);
     CV_Assert(!dissimilarity_matrix.empty());
     CV_Assert(dissimilarity_matrix.type() == CV_32F);
 
-    return impl_->Solve(dissimilarity_matrix);
+    impl_->Solve(dissimilarity_matrix, assignment);
+}
+
+void KuhnMunkres::NearestHint(const cv::Mat &dissimilarity_matrix, std::vector<size_t> *hint) {
+    CV_Assert(impl_ != nullptr);
+    CV_Assert(hint != nullptr);
+    CV_Assert(dissimilarity_matrix.type() == CV_32F);
+
+    impl_->NearestHint(dissimilarity_matrix, hint);
 }
 
 cv::Point Center(const cv::Rect &rect) {
@@ -221,6 +343,7 @@ TrackerParams::TrackerParams()
       bbox_heights_range(1, 1280),
       drop_forgotten_tracks(true),
       max_num_objects_in_track(300),
+      keep_spilled_objects(false),
       averaging_window_size_for_rects(1),
       averaging_window_size_for_labels(1) {}
 
@@ -229,87 +352,154 @@ bool IsInRange(float x, float a, float b) { return a <= x && x <= b; }
 
 void Tracker::FilterDetectionsAndStore(const TrackedObjects &detections) {
     detections_.clear();
-    for (const auto &det : detections) {
+    detection_indices_.clear();
+    for (size_t i = 0; i < detections.size(); i++) {
+        const auto &det = detections[i];
         float aspect_ratio = static_cast<float>(det.rect.height) / det.rect.width;
         if (det.confidence > params_.min_det_conf &&
                 IsInRange(aspect_ratio, params_.bbox_aspect_ratios_range) &&
                 IsInRange(static_cast<float>(det.rect.height), params_.bbox_heights_range)) {
             detections_.emplace_back(det);
+            detection_indices_.push_back(i);
         }
     }
 }
 
+int Tracker::SlotOf(size_t track_id) const {
+    auto it = id_to_slot_.find(track_id);
+    return it != id_to_slot_.end() ? it->second : -1;
+}
+
+void Tracker::CollectActiveSlots(bool with_lost, std::vector<size_t> *slots) const {
+    slots->clear();
+    auto add = [&](size_t slot) { slots->push_back(slot); };
+    if (with_lost) {
+        ForEachSetBit(active_slots_, add);
+    } else {
+        ForEachSetBit(active_slots_, lost_slots_, add);
+    }
+    // Slots are reused, so the order of slots is not the order of tracks.
+    std::sort(slots->begin(), slots->end(),
+              [this](size_t a, size_t b) { return slot_to_id_[a] < slot_to_id_[b]; });
+}
+
+void Tracker::CollectActiveTrackIds(std::vector<size_t> *track_ids) const {
+    CollectActiveSlots(true, track_ids);
+    for (auto &slot : *track_ids) {
+        slot = slot_to_id_[slot];
+    }
+}
+
+bool Tracker::IsAssignmentPredicted() const {
+    if (!assignment_predicted_ || predicted_rects_.size() != detections_.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < detections_.size(); i++) {
+        if (predicted_rects_[i] != detections_[i].rect) {
+            return false;
+        }
+    }
+    return true;
+}
+
 void Tracker::SolveAssignmentProblem(
-        const std::set<size_t> &track_ids, const TrackedObjects &detections,
-        std::set<size_t> *unmatched_tracks, std::set<size_t> *unmatched_detections,
-        std::set<std::tuple<size_t, size_t, float>> *matches) {
+        const std::vector<size_t> &track_ids, const TrackedObjects &detections,
+        std::vector<size_t> *unmatched_tracks,
+        std::vector<Match> *matches) {
     CV_Assert(unmatched_tracks);
-    CV_Assert(unmatched_detections);
     unmatched_tracks->clear();
-    unmatched_detections->clear();
 
     CV_Assert(!track_ids.empty());
     CV_Assert(!detections.empty());
     CV_Assert(matches);
     matches->clear();
 
-    cv::Mat dissimilarity;
+    cv::Mat &dissimilarity = dissimilarity_;
     ComputeDissimilarityMatrix(track_ids, detections, &dissimilarity);
 
-    auto res = KuhnMunkres().Solve(dissimilarity);
+    // Tracks are warm started with the detections nearest to them, which
+    // they keep unless two tracks compete for a detection.
+    matcher_.NearestHint(dissimilarity, &assignment_);
+    matcher_.Solve(dissimilarity, &assignment_);
+    const auto &res = assignment_;
 
-    for (size_t i = 0; i < detections.size(); i++) {
-        unmatched_detections->insert(i);
-    }
-
-    size_t i = 0;
-    for (auto id : track_ids) {
+    for (size_t i = 0; i < track_ids.size(); i++) {
         if (res[i] < detections.size()) {
-            matches->emplace(id, res[i], 1 - dissimilarity.at<float>(i, res[i]));
+            matches->emplace_back(track_ids[i], res[i], 1 - dissimilarity.at<float>(i, res[i]));
         } else {
-            unmatched_tracks->insert(id);
+            unmatched_tracks->push_back(track_ids[i]);
         }
-        i++;
     }
 }
 
 bool Tracker::EraseTrackIfBBoxIsOutOfFrame(size_t track_id) {
-    if (tracks_.find(track_id) == tracks_.end()) return true;
-    auto c = Center(tracks_.at(track_id).back().rect);
+    const int slot = SlotOf(track_id);
+    if (slot < 0) return true;
+    auto c = Center(slots_[slot].back().rect);
     if (frame_size_ != cv::Size() &&
             (c.x < 0 || c.y < 0 || c.x > frame_size_.width ||
              c.y > frame_size_.height)) {
-        tracks_.at(track_id).lost = params_.forget_delay + 1;
-        active_track_ids_.erase(track_id);
+        slots_[slot].lost = params_.forget_delay + 1;
+        SetBit(&lost_slots_, slot, true);
+        SetBit(&active_slots_, slot, false);
         return true;
     }
     return false;
 }
 
 bool Tracker::EraseTrackIfItWasLostTooManyFramesAgo(size_t track_id) {
-    if (tracks_.find(track_id) == tracks_.end()) return true;
-    if (tracks_.at(track_id).lost > params_.forget_delay) {
-        active_track_ids_.erase(track_id);
+    const int slot = SlotOf(track_id);
+    if (slot < 0) return true;
+    if (slots_[slot].lost > params_.forget_delay) {
+        SetBit(&active_slots_, slot, false);
         return true;
     }
     return false;
 }
 
 bool Tracker::UptateLostTrackAndEraseIfItsNeeded(size_t track_id) {
-    tracks_.at(track_id).lost++;
+    const int slot = SlotOf(track_id);
+    CV_Assert(slot >= 0);
+    slots_[slot].lost++;
+    SetBit(&lost_slots_, slot, true);
     bool erased = EraseTrackIfBBoxIsOutOfFrame(track_id);
     if (!erased) erased = EraseTrackIfItWasLostTooManyFramesAgo(track_id);
     return erased;
 }
 
-void Tracker::UpdateLostTracks(const std::set<size_t> &track_ids) {
+void Tracker::UpdateLostTracks(const std::vector<size_t> &track_ids) {
     for (auto track_id : track_ids) {
         UptateLostTrackAndEraseIfItsNeeded(track_id);
     }
 }
 
+void Tracker::PredictTrackIds(const TrackedObjects &detections, std::vector<int> *track_ids) {
+    CV_Assert(track_ids);
+    track_ids->assign(detections.size(), -1);
+
+    assignment_predicted_ = false;
+    FilterDetectionsAndStore(detections);
+    CollectActiveTrackIds(&active_ids_);
+    if (active_ids_.empty() || detections_.empty()) {
+        return;
+    }
+
+    SolveAssignmentProblem(active_ids_, detections_, &unmatched_tracks_, &matches_);
+    assignment_predicted_ = true;
+    predicted_rects_.clear();
+    for (const auto &det : detections_) {
+        predicted_rects_.push_back(det.rect);
+    }
+
+    for (const auto &match : matches_) {
+        if (std::get<2>(match) > params_.affinity_thr) {
+            (*track_ids)[detection_indices_[std::get<1>(match)]] = static_cast<int>(std::get<0>(match));
+        }
+    }
+}
+
 void Tracker::Process(const cv::Mat &frame, const TrackedObjects &detections,
-                      int frame_idx) {
+                      int frame_idx, std::vector<int> *track_ids) {
     if (frame_size_ == cv::Size()) {
         frame_size_ = frame.size();
     } else {
@@ -320,119 +510,209 @@ void Tracker::Process(const cv::Mat &frame, const TrackedObjects &detections,
     for (auto &obj : detections_) {
         obj.frame_idx = frame_idx;
     }
+    detection_track_ids_.assign(detections_.size(), -1);
 
-    auto active_tracks = active_track_ids_;
+    CollectActiveTrackIds(&active_ids_);
 
-    if (!active_tracks.empty() && !detections_.empty()) {
-        std::set<size_t> unmatched_tracks, unmatched_detections;
-        std::set<std::tuple<size_t, size_t, float>> matches;
-
-        SolveAssignmentProblem(active_tracks, detections_, &unmatched_tracks,
-                               &unmatched_detections, &matches);
+    if (!active_ids_.empty() && !detections_.empty()) {
+        // Tracks have not changed since PredictTrackIds, and labels do not
+        // take part in the assignment, so its solution holds for the same boxes.
+        if (!IsAssignmentPredicted()) {
+            SolveAssignmentProblem(active_ids_, detections_, &unmatched_tracks_, &matches_);
+        }
 
-        for (const auto &match : matches) {
+        is_detection_matched_.assign(detections_.size(), 0);
+        for (const auto &match : matches_) {
             size_t track_id = std::get<0>(match);
             size_t det_id = std::get<1>(match);
             float conf = std::get<2>(match);
             if (conf > params_.affinity_thr) {
                 AppendToTrack(track_id, detections_[det_id]);
-                unmatched_detections.erase(det_id);
+                is_detection_matched_[det_id] = 1;
+                detection_track_ids_[det_id] = static_cast<int>(track_id);
             } else {
-                unmatched_tracks.insert(track_id);
+                unmatched_tracks_.push_back(track_id);
             }
         }
 
-        AddNewTracks(detections_, unmatched_detections);
-        UpdateLostTracks(unmatched_tracks);
+        AddNewTracks(detections_, is_detection_matched_);
+        UpdateLostTracks(unmatched_tracks_);
 
-        for (size_t id : active_tracks) {
+        for (size_t id : active_ids_) {
             EraseTrackIfBBoxIsOutOfFrame(id);
         }
     } else {
-        AddNewTracks(detections_);
-        UpdateLostTracks(active_tracks);
+        is_detection_matched_.assign(detections_.size(), 0);
+        AddNewTracks(detections_, is_detection_matched_);
+        UpdateLostTracks(active_ids_);
     }
 
-    if (params_.drop_forgotten_tracks) DropForgottenTracks();
-}
-
-void Tracker::DropForgottenTracks() {
-    std::unordered_map<size_t, Track> new_tracks;
-    std::set<size_t> new_active_tracks;
+    assignment_predicted_ = false;
 
-    size_t max_id = 0;
-    if (!active_track_ids_.empty())
-        max_id =
-                *std::max_element(active_track_ids_.begin(), active_track_ids_.end());
-
-    const size_t kMaxTrackID = 10000;
-    bool reassign_id = max_id > kMaxTrackID;
+    if (params_.drop_forgotten_tracks) DropForgottenTracks();
 
-    size_t counter = 0;
-    for (const auto &pair : tracks_) {
-        if (!IsTrackForgotten(pair.first)) {
-            new_tracks.emplace(reassign_id ? counter : pair.first, pair.second);
-            new_active_tracks.emplace(reassign_id ? counter : pair.first);
-            counter++;
+    if (track_ids) {
+        track_ids->assign(detections.size(), -1);
+        for (size_t i = 0; i < detections_.size(); i++) {
+            (*track_ids)[detection_indices_[i]] = detection_track_ids_[i];
         }
     }
-    tracks_.swap(new_tracks);
-    active_track_ids_.swap(new_active_tracks);
-
-    tracks_counter_ = reassign_id ? counter : tracks_counter_;
 }
 
-float Tracker::ShapeAffinity(const cv::Rect &trk, const cv::Rect &det) {
-    float w_dist = static_cast<float>(std::fabs(trk.width - det.width)) / static_cast<float>(trk.width + det.width);
-    float h_dist = static_cast<float>(std::fabs(trk.height - det.height)) / static_cast<float>(trk.height + det.height);
-    return exp(-params_.shape_affinity_w * (w_dist + h_dist));
+void Tracker::set_dropped_track_handler(std::function<void(Track &&track)> handler) {
+    dropped_track_handler_ = std::move(handler);
 }
 
-float Tracker::MotionAffinity(const cv::Rect &trk, const cv::Rect &det) {
-    float x_dist = static_cast<float>(trk.x - det.x) * (trk.x - det.x) /
-            (det.width * det.width);
-    float y_dist = static_cast<float>(trk.y - det.y) * (trk.y - det.y) /
-            (det.height * det.height);
-    return exp(-params_.motion_affinity_w * (x_dist + y_dist));
+void Tracker::DropForgottenTracks() {
+    // Track ids are not reused, so ids held by callers stay valid; only the
+    // slots of forgotten tracks go back to the free list.
+    for (size_t slot = 0; slot < slots_.size(); slot++) {
+        const size_t id = slot_to_id_[slot];
+        if (id != kFreeSlot && slots_[slot].lost > params_.forget_delay) {
+            if (dropped_track_handler_) {
+                UnspillObjects(&slots_[slot]);
+                dropped_track_handler_(std::move(slots_[slot]));
+            }
+            id_to_slot_.erase(id);
+            slot_to_id_[slot] = kFreeSlot;
+            slots_[slot].objects.clear();
+            TrackedObjects().swap(slots_[slot].spilled_objects);
+            SetBit(&active_slots_, slot, false);
+            SetBit(&lost_slots_, slot, false);
+            free_slots_.push_back(slot);
+        }
+    }
 }
 
-void Tracker::ComputeDissimilarityMatrix(const std::set<size_t> &active_tracks,
+void Tracker::ComputeDissimilarityMatrix(const std::vector<size_t> &active_tracks,
                                          const TrackedObjects &detections,
                                          cv::Mat *dissimilarity_matrix) {
-    dissimilarity_matrix->create(active_tracks.size(), detections.size(), CV_32F);
-    size_t i = 0;
+    const int num_tracks = static_cast<int>(active_tracks.size());
+    const int num_dets = static_cast<int>(detections.size());
+
+    trk_x_.clear();
+    trk_y_.clear();
+    trk_w_.clear();
+    trk_h_.clear();
     for (auto id : active_tracks) {
-        auto ptr = dissimilarity_matrix->ptr<float>(i);
-        for (size_t j = 0; j < detections.size(); j++) {
-            auto last_det = tracks_.at(id).objects.back();
-            ptr[j] = Distance(last_det, detections[j]);
+        const cv::Rect &rect = slots_[SlotOf(id)].back().rect;
+        trk_x_.push_back(static_cast<float>(rect.x));
+        trk_y_.push_back(static_cast<float>(rect.y));
+        trk_w_.push_back(static_cast<float>(rect.width));
+        trk_h_.push_back(static_cast<float>(rect.height));
+    }
+    det_x_.resize(num_dets);
+    det_y_.resize(num_dets);
+    det_w_.resize(num_dets);
+    det_h_.resize(num_dets);
+    for (int j = 0; j < num_dets; j++) {
+        const cv::Rect &rect = detections[j].rect;
+        det_x_[j] = static_cast<float>(rect.x);
+        det_y_[j] = static_cast<float>(rect.y);
+        det_w_[j] = static_cast<float>(rect.width);
+        det_h_[j] = static_cast<float>(rect.height);
+    }
+
+    // Affinity is exp(-(shape_w * shape_dist + motion_w * motion_dist)), so a
+    // pair can pass affinity_thr only if its exponent is below the gate. Both
+    // terms are not negative, so the motion term alone bounds the distance of
+    // a passing pair to |dx| <= det_w * radius. Detections are sorted by x and
+    // only those within max_det_w * radius of a track are tested, the rest
+    // keep the dissimilarity of 1 like the pairs that fail the gate.
+    const float kMinAffinity = 1e-6f;
+    const float gate = -std::log(std::max(params_.affinity_thr, kMinAffinity));
+    const float shape_w = params_.shape_affinity_w;
+    const float motion_w = params_.motion_affinity_w;
+
+    det_order_.resize(num_dets);
+    for (int j = 0; j < num_dets; j++) {
+        det_order_[j] = j;
+    }
+    std::sort(det_order_.begin(), det_order_.end(), [this](int a, int b) { return det_x_[a] < det_x_[b]; });
+    det_sorted_x_.resize(num_dets);
+    float max_det_w = 0;
+    for (int k = 0; k < num_dets; k++) {
+        det_sorted_x_[k] = det_x_[det_order_[k]];
+        max_det_w = std::max(max_det_w, det_w_[det_order_[k]]);
+    }
+    const float window = motion_w > 0 ? max_det_w * std::sqrt(gate / motion_w)
+                                      : std::numeric_limits<float>::infinity();
+
+    pair_rows_.clear();
+    pair_cols_.clear();
+    pair_exponents_.clear();
+    for (int i = 0; i < num_tracks; i++) {
+        const float tx = trk_x_[i], ty = trk_y_[i], tw = trk_w_[i], th = trk_h_[i];
+        auto begin = det_sorted_x_.begin(), end = det_sorted_x_.end();
+        if (std::isfinite(window)) {
+            begin = std::lower_bound(begin, end, tx - window);
+            end = std::upper_bound(begin, end, tx + window);
+        }
+        for (auto it = begin; it != end; ++it) {
+            const int j = det_order_[it - det_sorted_x_.begin()];
+            const float dx = tx - det_x_[j], dy = ty - det_y_[j];
+            const float motion = motion_w * (dx * dx / (det_w_[j] * det_w_[j]) +
+                                             dy * dy / (det_h_[j] * det_h_[j]));
+            if (motion > gate) {
+                continue;
+            }
+            const float shape = shape_w * (std::fabs(tw - det_w_[j]) / (tw + det_w_[j]) +
+                                           std::fabs(th - det_h_[j]) / (th + det_h_[j]));
+            if (shape + motion > gate) {
+                continue;
+            }
+            pair_rows_.push_back(i);
+            pair_cols_.push_back(j);
+            pair_exponents_.push_back(-(shape + motion));
         }
-        i++;
     }
-}
 
-void Tracker::AddNewTracks(const TrackedObjects &detections) {
-    for (size_t i = 0; i < detections.size(); i++) {
-        AddNewTrack(detections[i]);
+    dissimilarity_matrix->create(num_tracks, num_dets, CV_32F);
+    dissimilarity_matrix->setTo(1.0f);
+    if (pair_exponents_.empty()) {
+        return;
+    }
+
+    // One vectorized exp over the exponents of the candidate pairs, then
+    // dissimilarity = 1 - affinity.
+    cv::Mat exponents(1, static_cast<int>(pair_exponents_.size()), CV_32F, pair_exponents_.data());
+    cv::exp(exponents, exponents);
+    for (size_t k = 0; k < pair_exponents_.size(); k++) {
+        dissimilarity_matrix->at<float>(pair_rows_[k], pair_cols_[k]) = 1.0f - pair_exponents_[k];
     }
 }
 
 void Tracker::AddNewTracks(const TrackedObjects &detections,
-                           const std::set<size_t> &ids) {
-    for (size_t i : ids) {
-        CV_Assert(i < detections.size());
-        AddNewTrack(detections[i]);
+                           const std::vector<char> &is_matched) {
+    CV_Assert(is_matched.size() == detections.size());
+    for (size_t i = 0; i < detections.size(); i++) {
+        if (!is_matched[i]) {
+            detection_track_ids_[i] = static_cast<int>(AddNewTrack(detections[i]));
+        }
     }
 }
 
-void Tracker::AddNewTrack(const TrackedObject &detection) {
+size_t Tracker::AddNewTrack(const TrackedObject &detection) {
     auto detection_with_id = detection;
     detection_with_id.object_id = tracks_counter_;
-    tracks_.emplace(
-                std::pair<size_t, Track>(tracks_counter_, Track({detection_with_id})));
 
-    active_track_ids_.insert(tracks_counter_);
-    tracks_counter_++;
+    size_t slot;
+    if (!free_slots_.empty()) {
+        slot = free_slots_.back();
+        free_slots_.pop_back();
+        slots_[slot] = Track({detection_with_id}, HistorySize(), LabelWindowSize());
+        slot_to_id_[slot] = tracks_counter_;
+    } else {
+        slot = slots_.size();
+        slots_.emplace_back(TrackedObjects{detection_with_id}, HistorySize(), LabelWindowSize());
+        slot_to_id_.push_back(tracks_counter_);
+        active_slots_.resize((slots_.size() + 63) / 64, 0);
+        lost_slots_.resize(active_slots_.size(), 0);
+    }
+    id_to_slot_.emplace(tracks_counter_, static_cast<int>(slot));
+    SetBit(&active_slots_, slot, true);
+    SetBit(&lost_slots_, slot, false);
+    return tracks_counter_++;
 }
 
 void Tracker::AppendToTrack(size_t track_id, const TrackedObject &detection) {
@@ -441,33 +721,30 @@ void Tracker::AppendToTrack(size_t track_id, const TrackedObject &detection) {
     auto detection_with_id = detection;
     detection_with_id.object_id = track_id;
 
-    auto &track = tracks_.at(track_id);
-
-    track.objects.emplace_back(detection_with_id);
-    track.lost = 0;
-    track.length++;
+    const int slot = SlotOf(track_id);
+    auto &track = slots_[slot];
+    SetBit(&lost_slots_, slot, false);
 
-    if (params_.max_num_objects_in_track > 0) {
-        while (track.size() >
-               static_cast<size_t>(params_.max_num_objects_in_track)) {
-            track.objects.erase(track.objects.begin());
-        }
+    TrackedObject evicted;
+    if (track.Add(detection_with_id, &evicted) && params_.keep_spilled_objects) {
+        track.spilled_objects.push_back(evicted);
     }
+    track.lost = 0;
 }
 
-float Tracker::Distance(const TrackedObject &obj1, const TrackedObject &obj2) {
-    const float eps = 1e-6f;
-    float shp_aff = ShapeAffinity(obj1.rect, obj2.rect);
-    if (shp_aff < eps) return 1.0;
-
-    float mot_aff = MotionAffinity(obj1.rect, obj2.rect);
-    if (mot_aff < eps) return 1.0;
+size_t Tracker::HistorySize() const {
+    return params_.max_num_objects_in_track > 0 ?
+                static_cast<size_t>(params_.max_num_objects_in_track) : 0;
+}
 
-    return 1.0f - shp_aff * mot_aff;
+size_t Tracker::LabelWindowSize() const {
+    // The unbounded window is served by the whole track votes.
+    const int window = params_.averaging_window_size_for_labels;
+    return window > 0 && window < std::numeric_limits<int>::max() ? static_cast<size_t>(window) : 0;
 }
 
 bool Tracker::IsTrackValid(size_t id) const {
-    const auto &track = tracks_.at(id);
+    const auto &track = this->track(id);
     const auto &objects = track.objects;
     if (objects.empty()) {
         return false;
@@ -479,12 +756,18 @@ bool Tracker::IsTrackValid(size_t id) const {
 }
 
 bool Tracker::IsTrackForgotten(size_t id) const {
-    return tracks_.at(id).lost > params_.forget_delay;
+    return track(id).lost > params_.forget_delay;
 }
 
 void Tracker::Reset() {
-    active_track_ids_.clear();
-    tracks_.clear();
+    slots_.clear();
+    slot_to_id_.clear();
+    free_slots_.clear();
+    id_to_slot_.clear();
+    active_slots_.clear();
+    lost_slots_.clear();
+    assignment_.clear();
+    assignment_predicted_ = false;
 
     detections_.clear();
 
@@ -495,10 +778,11 @@ void Tracker::Reset() {
 
 TrackedObjects Tracker::TrackedDetections() const {
     TrackedObjects detections;
-    for (size_t idx : active_track_ids()) {
-        auto track = tracks().at(idx);
-        if (IsTrackValid(idx) && !track.lost) {
-            detections.emplace_back(track.objects.back());
+    std::vector<size_t> slots;
+    CollectActiveSlots(false, &slots);
+    for (size_t slot : slots) {
+        if (IsTrackValid(slot_to_id_[slot])) {
+            detections.emplace_back(slots_[slot].objects.back());
         }
     }
     return detections;
@@ -506,9 +790,12 @@ TrackedObjects Tracker::TrackedDetections() const {
 
 TrackedObjects Tracker::TrackedDetectionsWithLabels() const {
     TrackedObjects detections;
-    for (size_t idx : active_track_ids()) {
-        const auto& track = tracks().at(idx);
-        if (IsTrackValid(idx) && !track.lost) {
+    std::vector<size_t> slots;
+    CollectActiveSlots(false, &slots);
+    for (size_t slot : slots) {
+        const size_t idx = slot_to_id_[slot];
+        const auto& track = slots_[slot];
+        if (IsTrackValid(idx)) {
             TrackedObject object = track.objects.back();
             int counter = 1;
             size_t start = static_cast<int>(track.objects.size()) >= params_.averaging_window_size_for_rects ?
@@ -536,6 +823,15 @@ TrackedObjects Tracker::TrackedDetectionsWithLabels() const {
 }
 
 int LabelWithMaxFrequencyInTrack(const Track &track, int window_size) {
+    // Votes are kept up to date by the track and cover objects that were
+    // already evicted from the history.
+    if (window_size >= 0 && static_cast<size_t>(window_size) >= track.length) {
+        return track.labels.best_label();
+    }
+    if (window_size > 0 && static_cast<size_t>(window_size) == track.window_labels.window_size()) {
+        return track.window_labels.best_label();
+    }
+
     std::unordered_map<int, int> frequencies;
     int max_frequent_count = 0;
     int max_frequent_id = TrackedObject::UNKNOWN_LABEL_IDX;
@@ -569,24 +865,33 @@ std::vector<Track> UpdateTrackLabelsToBestAndFilterOutUnknowns(const std::vector
             obj.label = best_label;
         }
         new_track.first_object.label = best_label;
+        new_track.labels.Reset(best_label, static_cast<int>(new_track.length));
+        new_track.window_labels.Reset(best_label, static_cast<int>(
+            std::min(new_track.length, new_track.window_labels.window_size())));
 
         new_tracks.emplace_back(std::move(new_track));
     }
     return new_tracks;
 }
 
-const std::unordered_map<size_t, Track> &Tracker::tracks() const {
-    return tracks_;
+const Track &Tracker::track(size_t id) const {
+    const int slot = SlotOf(id);
+    CV_Assert(slot >= 0);
+    return slots_[slot];
 }
 
 std::vector<Track> Tracker::vector_tracks() const {
-    std::set<size_t> keys;
-    for (auto& cur_pair : tracks()) {
-        keys.insert(cur_pair.first);
+    std::vector<size_t> ids;
+    ids.reserve(id_to_slot_.size());
+    for (const auto &item : id_to_slot_) {
+        ids.push_back(item.first);
     }
+    std::sort(ids.begin(), ids.end());
+
     std::vector<Track> vec_tracks;
-    for (size_t k : keys) {
-        vec_tracks.push_back(tracks().at(k));
+    for (size_t id : ids) {
+        vec_tracks.push_back(slots_[id_to_slot_.at(id)]);
+        UnspillObjects(&vec_tracks.back());
     }
     return vec_tracks;
 }
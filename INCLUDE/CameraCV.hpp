@@ -10,6 +10,7 @@
 #include <Tracker.hpp>
 #include <Detector.hpp>
 #include <Geometry.hpp>
+#include <Metrics.hpp>
 
 #include <CSubject.hpp>
 
@@ -52,6 +53,14 @@ class CCamera : public NPL::CSubject<uint8_t, uint8_t>
       {
         iDetector = std::make_shared<BackgroundSubtractor>(algo);
       }
+      else if (target == "replay")
+      {
+        iDetector = std::make_shared<ReplayDetector>(algo, iSource);
+      }
+      else if (target == "synthetic" && iSource->GetSyntheticScene())
+      {
+        iDetector = std::make_shared<SyntheticDetector>(iSource->GetSyntheticScene());
+      }
       else
       {
         iDetector = std::make_shared<ObjectDetector>(target);
@@ -98,6 +107,7 @@ class CCamera : public NPL::CSubject<uint8_t, uint8_t>
       if (IsStarted())
       {
         iRunThread.join();
+        CVL_TRACE_DUMP();
       }
 
       if (iTracker)
@@ -171,6 +181,12 @@ class CCamera : public NPL::CSubject<uint8_t, uint8_t>
         iDetector->SetProperty(key, value);
         return;
       }
+      else if (key == "zones")
+      { /*
+         * lines and polygons to count, see CZones::Parse
+         */
+        if (!iTracker || !iTracker->SetZones(value)) return;
+      }
 
       CSubject<uint8_t, uint8_t>::SetProperty(key, value);
     }
@@ -190,10 +206,32 @@ class CCamera : public NPL::CSubject<uint8_t, uint8_t>
     {
       cv::Mat frame;
 
+      iMetrics = CMetricsRegistry::Get().Register(GetProperty("name"));
+
+      CMetricsRegistry::Get().StartFileDump();
+
+      iTracker->SetCounterSeries(CCounterRegistry::Get().Register(GetProperty("name")));
+
+      CCounterRegistry::Get().StartFlush();
+
+      CVL_TRACE_THREAD_NAME(GetProperty("name"));
+
+      if (GetProperty("record").size())
+      { /*
+         * detections of every frame go to the file, the "replay"
+         * target with the file as algo serves them back later
+         */
+        iRecorder = std::make_shared<CDetectionCacheWriter>(GetProperty("record"));
+      }
+
       auto started_at = std::chrono::high_resolution_clock::now();
 
       while (!GetPropertyAsBool("stop"))
       {
+        CStageTimer timer(iMetrics);
+
+        timer.Start(EStage::Read);
+
         if (!iSource->Read(frame))
         {
           if (iSource->HasEnded())
@@ -209,6 +247,8 @@ class CCamera : public NPL::CSubject<uint8_t, uint8_t>
           }
         }
 
+        timer.Start(EStage::Resize);
+
         if (frame.cols > 400)
         {
           auto scale = (float) 400 / frame.cols;
@@ -226,16 +266,24 @@ class CCamera : public NPL::CSubject<uint8_t, uint8_t>
         { /*
            * update all active trackers
            */
+          timer.Start(EStage::Track);
           auto updates = iTracker->UpdateTrackingContexts(frame);
           /*
            * run detector
            */
+          timer.Start(EStage::Detect);
           auto detections = iDetector->Detect(frame);
 
+          if (iRecorder)
+          {
+            iRecorder->Write(0, static_cast<uint32_t>(iSource->GetCurrentOffset()), ToCachedDetections(detections));
+          }
+
           FilterDetections(detections, frame);
           /*
            * Match detections with the best tracking context
            */
+          timer.Start(EStage::Match);
           iTracker->MatchDetectionWithTrackingContext(detections, frame);
           /*
            * at this point every tracking context will potentially have 
@@ -256,21 +304,25 @@ class CCamera : public NPL::CSubject<uint8_t, uint8_t>
           }
         }
 
+        timer.Start(EStage::Render);
+
         iTracker->RenderDisplacementAndPaths(frame, GetProperty("name") == "CV");
 
         {
           std::lock_guard<std::mutex> lg(iLock);
           auto finished_at = std::chrono::high_resolution_clock::now();
-          auto duration_ms = std::chrono::duration_cast<std::chrono::milliseconds>(finished_at - started_at).count();
-          auto fps = (float) iSource->GetCurrentOffset() / (float)(duration_ms / 1000);
+          auto seconds = std::chrono::duration<float>(finished_at - started_at).count();
+          auto fps = seconds > 0 ? (float) iSource->GetCurrentOffset() / seconds : 0.0f;
           cv::putText(frame, "FPS : " + std::to_string(fps), cv::Point(5, 10), 
                  cv::FONT_HERSHEY_SIMPLEX, 0.4, cv::Scalar(255, 255, 255), 1);
         }
 
         if (GetPropertyAsBool("play"))
         {
+          timer.Start(EStage::Encode);
           std::vector<uchar> buf;
           cv::imencode(".jpg", frame, buf);
+          timer.Start(EStage::Callback);
           iOnCameraEventCbk("play", "", "", buf);
         }
         else
@@ -281,6 +333,8 @@ class CCamera : public NPL::CSubject<uint8_t, uint8_t>
           }
         }
 
+        timer.Stop();
+
         if (!iSource->HandleUserInput(iTracker)) break;
 
         while (GetPropertyAsBool("pause") && !GetPropertyAsBool("stop"))
@@ -305,7 +359,11 @@ class CCamera : public NPL::CSubject<uint8_t, uint8_t>
 
     SPCDetector iDetector;
 
+    SPCDetectionCacheWriter iRecorder;
+
     TOnCameraEventCbk iOnCameraEventCbk = nullptr;
+
+    SPCMetrics iMetrics;
 };
 
 using SPCCamera = std::shared_ptr<CCamera>;
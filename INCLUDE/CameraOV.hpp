@@ -92,6 +92,7 @@ class COVCamera : public CCamera
         m_lm = GetModelHomeDir() + "landmarks-regression-retail-0009/landmarks-regression-retail-0009.xml"s;
         m_reid = GetModelHomeDir() + "face-reidentification-retail-0095/FP16/face-reidentification-retail-0095.xml"s;
         fg = GetModelHomeDir() + "fr_gallery/faces_gallery.json"s;
+        fg_cache = GetModelHomeDir() + "fr_gallery/faces_gallery.emb"s;
 
         char * argv[] =  {
          "smart_classroom_demo.exe",
@@ -99,11 +100,17 @@ class COVCamera : public CCamera
          "-m_lm", (char *) m_lm.c_str(),
          "-m_reid", (char *) m_reid.c_str(),
          "-fg", (char *) fg.c_str(),
+         "-fg_cache", (char *) fg_cache.c_str(),
          "-i", (char *)(iSource.c_str())
         };
 
         iFR.iModelHomeDir = GetModelHomeDir();
 
+        if (GetProperty("name").size())
+        {
+          iFR.iName = GetProperty("name");
+        }
+
         iFR.fr_main(sizeof(argv)/sizeof(char *), argv, &iFR);
       }
       else 
@@ -127,6 +134,8 @@ class COVCamera : public CCamera
     std::string m_reid;
 
     std::string fg;
+
+    std::string fg_cache;
 };
 
 using SPCOVCamera = std::shared_ptr<COVCamera>;
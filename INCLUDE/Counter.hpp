@@ -2,13 +2,25 @@
 #define COUNTER_HPP
 
 #include <tuple>
+#include <mutex>
+#include <atomic>
 #include <vector>
 #include <memory>
+#include <string>
 
 #include <opencv2/opencv.hpp>
 
+#include <Zones.hpp>
 #include <Geometry.hpp>
-
+#include <CounterSeries.hpp>
+
+/*
+ * Counts tracks crossing the reference line, a horizontal or vertical line
+ * through the frame centre moved by iRefDelta, and the zones of the camera.
+ * The reference line is the "ref" zone of the zone engine. Counts also go
+ * to the time series of the camera when it is set, as up, down, left and
+ * right for the reference line and zone.in, zone.out and zone.dwell.
+ */
 class CCounter
 {
   public:
@@ -28,96 +40,109 @@ class CCounter
       iTrackingContextTrail.push_back(trail);
     }
 
-    bool ProcessTrail(const std::vector<cv::Rect2d>& trail, cv::Mat m)
+    /*
+     * moves the track to the centre of the last box of its trail, returns
+     * true if it crossed a line or a polygon edge on the way
+     */
+    bool ProcessTrail(int id, const std::vector<cv::Rect2d>& trail, const cv::Mat& m)
     {
-      auto start = GetRectCenter(trail.front());
-      auto end = GetRectCenter(trail.back());
+      ApplyPendingZones();
 
-      auto [u, d, l, r] = IsPathIntersectingRefLine(start, end, m);
+      iZones.SetFrameSize(m.size());
 
-      if (u || d || l || r)
+      if (iRefZone < 0 || iRefSize != m.size())
       {
-        up += u;
-        down += d;
-        left += l;
-        right += r;
-        return true;
+        UpdateRefLine(m.size());
       }
 
-      return false;
-    }
+      auto& box = trail.back();
 
-    cv::Point GetRefStartPoint(cv::Mat& m)
-    {
-      if (iRefOrientation) // H
-      {
-        return cv::Point(0, m.rows/2 + iRefDelta);
-      }
-      else // V
+      auto& events = iZones.Update(id, cv::Point2f(box.x + box.width / 2, box.y + box.height / 2));
+
+      for (auto& e : events)
       {
-        return cv::Point(m.cols/2 + iRefDelta, 0);
+        if (e.zone != iRefZone)
+        {
+          if (iSeries)
+          {
+            auto& name = iZones.GetZones()[e.zone].name;
+            iSeries->Add(name + (e.event == EZoneEvent::In ? ".in" : e.event == EZoneEvent::Out ? ".out" : ".dwell"));
+          }
+
+          continue;
+        }
+
+        const char *series;
+
+        if (iRefOrientation)
+        {
+          if (e.event == EZoneEvent::In) { down++; series = "down"; } else { up++; series = "up"; }
+        }
+        else
+        {
+          if (e.event == EZoneEvent::In) { right++; series = "right"; } else { left++; series = "left"; }
+        }
+
+        if (iSeries) iSeries->Add(series);
       }
+
+      return events.size() > 0;
     }
 
-    cv::Point GetRefEndPoint(cv::Mat& m)
+    void RemoveTrack(int id)
     {
-      if (iRefOrientation) // H
-      {
-        return cv::Point(m.cols, m.rows/2 + iRefDelta);
-      }
-      else // V
-      {
-        return cv::Point(m.cols/2 + iRefDelta, m.rows);
-      }
+      iZones.RemoveTrack(id);
     }
 
-    void SetRefLine(int orientation, int delta)
+    void SetSeries(SPCCounterSeries series)
     {
-      iRefOrientation = orientation;
-      iRefDelta += delta;
+      iSeries = series;
     }
 
-    std::tuple<int, int, int, int> IsPathIntersectingRefLine(cv::Point start, cv::Point end, cv::Mat& m)
+    /*
+     * adds zones in the format of CZones::Parse, all of them or none. It may
+     * be called from any thread, the zones are taken by the next update of
+     * the counting thread
+     */
+    bool SetZones(const std::string& spec)
     {
-      int u = 0, d = 0, l = 0, r = 0;
+      CZones zones;
 
-      if (iRefOrientation)
-      {
-        auto refy = m.rows/2 + iRefDelta;
+      if (!zones.Parse(spec)) return false;
 
-        if ((start.y < refy) && (end.y >= refy))
-        {
-          d++;
-          //std::cout << "start-y : " << start.y << " end-y : " << end.y << ", down\n";
-        }
-        else if ((start.y > refy) && (end.y <= refy))
-        {
-          u++;
-          //std::cout << "start-y : " << start.y << " end-y : " << end.y << ", up\n";          
-        }
-      }
-      else
-      {
-        auto refx = m.cols/2 + iRefDelta;
+      std::lock_guard<std::mutex> lg(iPendingLock);
 
-        if ((start.x < refx) && (end.x >= refx))
-        {
-          r++;
-          //std::cout << "start-x : " << start.x << " end-x : " << end.x << ", right\n";
-        }
-        else if ((start.x > refx) && (end.x <= refx))
-        {
-          l++;
-          //std::cout << "start-x : " << start.x << " end-x : " << end.x << ", left\n";          
-        }
-      }
+      iPendingZones.push_back(spec);
+      iHasPendingZones = true;
+
+      return true;
+    }
+
+    const std::vector<Zone>& GetZones(void)
+    {
+      ApplyPendingZones();
 
-      return std::make_tuple(u, d, l, r);
+      return iZones.GetZones();
+    }
+
+    std::tuple<int, int, int, int> GetCounts(void)
+    {
+      return std::make_tuple(up, down, left, right);
+    }
+
+    void SetRefLine(int orientation, int delta)
+    {
+      iRefOrientation = orientation;
+      iRefDelta += delta;
+
+      if (iRefSize.area()) UpdateRefLine(iRefSize);
     }
 
     void DisplayRefLineAndCounts(cv::Mat& m)
     {
-      cv::line(m, GetRefStartPoint(m), GetRefEndPoint(m), cv::Scalar(0, 0, 255), 1);
+      ApplyPendingZones();
+
+      iZones.Render(m);
       cv::putText(m, "u : " + std::to_string(up), cv::Point(5, 30), cv::FONT_HERSHEY_SIMPLEX, 0.4, cv::Scalar(255, 0, 0), 1);
       cv::putText(m, "d : " + std::to_string(down), cv::Point(5, 50), cv::FONT_HERSHEY_SIMPLEX, 0.4, cv::Scalar(255, 0, 0), 1);
       cv::putText(m, "l : " + std::to_string(left), cv::Point(5, 70), cv::FONT_HERSHEY_SIMPLEX, 0.4, cv::Scalar(255, 0, 0), 1);
@@ -126,6 +151,47 @@ class CCounter
 
   protected:
 
+    /*
+     * zones set since the last update, on the counting thread
+     */
+    void ApplyPendingZones(void)
+    {
+      if (!iHasPendingZones) return;
+
+      std::vector<std::string> specs;
+
+      {
+        std::lock_guard<std::mutex> lg(iPendingLock);
+        specs.swap(iPendingZones);
+        iHasPendingZones = false;
+      }
+
+      for (auto& spec : specs)
+      {
+        iZones.Parse(spec);
+      }
+    }
+
+    /*
+     * a horizontal line runs left to right so that "in" is down, a vertical
+     * one bottom to top so that "in" is right
+     */
+    void UpdateRefLine(cv::Size size)
+    {
+      iRefSize = size;
+
+      if (iRefOrientation) // H
+      {
+        float y = static_cast<float>(size.height / 2 + iRefDelta) / size.height;
+        iRefZone = iZones.AddLine("ref", cv::Point2f(0, y), cv::Point2f(1, y));
+      }
+      else // V
+      {
+        float x = static_cast<float>(size.width / 2 + iRefDelta) / size.width;
+        iRefZone = iZones.AddLine("ref", cv::Point2f(x, 1), cv::Point2f(x, 0));
+      }
+    }
+
     std::vector <
       std::vector<cv::Rect2d>
     > iTrackingContextTrail;
@@ -138,8 +204,22 @@ class CCounter
     char iRefOrientation = 1; // horizontal
 
     int iRefDelta = 0; // ref line offset from baseline
+
+    CZones iZones;
+
+    std::mutex iPendingLock;
+
+    std::vector<std::string> iPendingZones; // specs set from other threads
+
+    std::atomic<bool> iHasPendingZones{false};
+
+    int iRefZone = -1;
+
+    cv::Size iRefSize;
+
+    SPCCounterSeries iSeries;
 };
 
 using SPCCounter = std::shared_ptr<CCounter>;
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,540 @@
+#ifndef COUNTERSERIES_HPP
+#define COUNTERSERIES_HPP
+
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdlib>
+#include <cstdint>
+#include <fstream>
+#include <algorithm>
+#include <condition_variable>
+
+/*
+ * Time series of the counts of a camera, such as tracks crossing a line.
+ * Every count goes to 1 second, 1 minute and 1 hour buckets at once, kept
+ * in rings of the last hour, day and month. Minute buckets are appended to
+ * a file as they close, the file is read back for older ranges.
+ *
+ * The file holds one block per flushed minute, in native byte order :
+ *
+ *  int64 minute (unix seconds), uint32 count of series, then per series
+ *  uint8 length, name, int64 count
+ */
+
+enum class EResolution
+{
+  Second,
+  Minute,
+  Hour
+};
+
+inline int64_t GetResolutionSeconds(EResolution resolution)
+{
+  return resolution == EResolution::Second ? 1 : resolution == EResolution::Minute ? 60 : 3600;
+}
+
+struct SeriesPoint
+{
+  int64_t t;      // start of the bucket in unix seconds
+  int64_t count;
+};
+
+/*
+ * buckets of a fixed width, a bucket is reused once the ring wraps
+ */
+class CBucketRing
+{
+  public:
+
+    CBucketRing(int64_t width, size_t size) : iWidth(width), iBuckets(size) {}
+
+    void Add(int64_t t, int64_t n)
+    {
+      auto start = t - t % iWidth;
+      auto& b = iBuckets[(start / iWidth) % iBuckets.size()];
+
+      if (start < b.t) return; // older than the ring
+
+      if (b.t != start)
+      {
+        b.t = start;
+        b.count = 0;
+      }
+
+      b.count += n;
+    }
+
+    /*
+     * buckets of [from, to) still in the ring, empty ones included
+     */
+    std::vector<SeriesPoint> Query(int64_t from, int64_t to) const
+    {
+      std::vector<SeriesPoint> out;
+
+      if (to <= from) return out;
+
+      auto last = (to - 1) - (to - 1) % iWidth;
+
+      from = std::max(from - from % iWidth, last - static_cast<int64_t>(iBuckets.size() - 1) * iWidth);
+
+      for (auto t = from; t < to; t += iWidth)
+      {
+        auto& b = iBuckets[(t / iWidth) % iBuckets.size()];
+
+        out.push_back({t, b.t == t ? b.count : 0});
+      }
+
+      return out;
+    }
+
+    int64_t GetWidth(void) const
+    {
+      return iWidth;
+    }
+
+    size_t GetSize(void) const
+    {
+      return iBuckets.size();
+    }
+
+  private:
+
+    int64_t iWidth;
+
+    std::vector<SeriesPoint> iBuckets;
+};
+
+class CCounterSeries
+{
+  public:
+
+    CCounterSeries(const std::string& name) : iName(name), iStartedAt(Now()) {}
+
+    const std::string& GetName(void) const
+    {
+      return iName;
+    }
+
+    /*
+     * counts before this are found only in the flushed file
+     */
+    int64_t GetStartedAt(void) const
+    {
+      return iStartedAt;
+    }
+
+    static int64_t Now(void)
+    {
+      return std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    void Add(const std::string& series, int64_t n = 1, int64_t t = Now())
+    {
+      std::lock_guard<std::mutex> lg(iLock);
+
+      auto it = iSeries.find(series);
+
+      if (it == iSeries.end())
+      {
+        it = iSeries.emplace(series, Rings()).first;
+      }
+
+      for (auto& ring : it->second.rings)
+      {
+        ring.Add(t, n);
+      }
+    }
+
+    std::vector<std::string> GetSeriesNames(void)
+    {
+      std::lock_guard<std::mutex> lg(iLock);
+
+      std::vector<std::string> names;
+
+      for (auto& s : iSeries) names.push_back(s.first);
+
+      return names;
+    }
+
+    /*
+     * counts of [from, to) in buckets of the resolution from memory, ranges
+     * older than the ring of the resolution start where the ring starts
+     */
+    std::vector<SeriesPoint> Query(const std::string& series, EResolution resolution, int64_t from, int64_t to = Now() + 1)
+    {
+      std::lock_guard<std::mutex> lg(iLock);
+
+      auto it = iSeries.find(series);
+
+      if (it == iSeries.end()) return {};
+
+      return it->second.rings[static_cast<size_t>(resolution)].Query(from, to);
+    }
+
+    /*
+     * appends the minutes closed since the last flush to the file, all
+     * minutes so far if final. Minutes flushed twice add up when read
+     */
+    bool Flush(const std::string& path, bool final = false)
+    {
+      std::lock_guard<std::mutex> fl(iFileLock);
+
+      std::map<int64_t, std::vector<std::pair<std::string, int64_t>>> minutes;
+
+      {
+        std::lock_guard<std::mutex> lg(iLock);
+
+        auto now = Now();
+        auto until = now - now % 60 + (final ? 60 : 0);
+        auto start = iStartedAt - iStartedAt % 60;
+
+        for (auto& s : iSeries)
+        {
+          auto& ring = s.second.rings[static_cast<size_t>(EResolution::Minute)];
+
+          for (auto& p : ring.Query(iFlushedUntil, until))
+          {
+            if (!p.count) continue;
+
+            minutes[p.t].emplace_back(s.first, p.count);
+
+            if (p.t == start) iFlushedAtStart[s.first] += p.count;
+          }
+        }
+
+        iFlushedUntil = std::max(iFlushedUntil, until);
+      }
+
+      if (minutes.empty()) return true;
+
+      std::ofstream file(path, std::ios::binary | std::ios::app);
+
+      if (!file) return false;
+
+      for (auto& m : minutes)
+      {
+        auto count = static_cast<uint32_t>(m.second.size());
+
+        file.write(reinterpret_cast<const char *>(&m.first), sizeof(m.first));
+        file.write(reinterpret_cast<const char *>(&count), sizeof(count));
+
+        for (auto& s : m.second)
+        {
+          auto length = static_cast<uint8_t>(std::min<size_t>(s.first.size(), 255));
+
+          file.write(reinterpret_cast<const char *>(&length), sizeof(length));
+          file.write(s.first.data(), length);
+          file.write(reinterpret_cast<const char *>(&s.second), sizeof(s.second));
+        }
+      }
+
+      return static_cast<bool>(file);
+    }
+
+    /*
+     * counts of [from, to) in minute or hour buckets from a flushed file,
+     * only buckets with counts are returned
+     */
+    static std::vector<SeriesPoint> Load(const std::string& path, const std::string& series,
+      EResolution resolution, int64_t from, int64_t to)
+    {
+      std::map<int64_t, int64_t> buckets;
+
+      auto width = GetResolutionSeconds(resolution);
+
+      std::ifstream file(path, std::ios::binary);
+
+      int64_t minute;
+      uint32_t count;
+
+      while (file.read(reinterpret_cast<char *>(&minute), sizeof(minute)) &&
+             file.read(reinterpret_cast<char *>(&count), sizeof(count)))
+      {
+        for (uint32_t i = 0; i < count; i++)
+        {
+          uint8_t length;
+          std::string name;
+          int64_t n;
+
+          if (!file.read(reinterpret_cast<char *>(&length), sizeof(length))) break;
+
+          name.resize(length);
+
+          if (!file.read(&name[0], length) ||
+              !file.read(reinterpret_cast<char *>(&n), sizeof(n))) break;
+
+          if (name == series && minute >= from && minute < to)
+          {
+            buckets[minute - minute % width] += n;
+          }
+        }
+      }
+
+      std::vector<SeriesPoint> out;
+
+      for (auto& b : buckets) out.push_back({b.first, b.second});
+
+      return out;
+    }
+
+    /*
+     * Load without the counts of the minute this series started in that it
+     * flushed itself, the file adds them to those of an earlier run of the
+     * camera while memory holds them as well
+     */
+    std::vector<SeriesPoint> LoadEarlierRuns(const std::string& path, const std::string& series,
+      EResolution resolution, int64_t from, int64_t to)
+    {
+      if (to <= from) return {};
+
+      std::lock_guard<std::mutex> fl(iFileLock);
+
+      auto out = Load(path, series, resolution, from, to);
+
+      auto start = iStartedAt - iStartedAt % 60;
+
+      if (start < from || start >= to) return out;
+
+      int64_t flushed = 0;
+
+      {
+        std::lock_guard<std::mutex> lg(iLock);
+
+        auto it = iFlushedAtStart.find(series);
+
+        if (it != iFlushedAtStart.end()) flushed = it->second;
+      }
+
+      auto bucket = start - start % GetResolutionSeconds(resolution);
+
+      for (size_t i = 0; i < out.size(); i++)
+      {
+        if (out[i].t != bucket) continue;
+
+        out[i].count -= flushed;
+
+        if (!out[i].count) out.erase(out.begin() + i);
+
+        break;
+      }
+
+      return out;
+    }
+
+  private:
+
+    struct Rings
+    {
+      std::vector<CBucketRing> rings = {
+        CBucketRing(1, 3600),     // an hour of seconds
+        CBucketRing(60, 1440),    // a day of minutes
+        CBucketRing(3600, 720)    // a month of hours
+      };
+    };
+
+    std::string iName;
+
+    int64_t iStartedAt;
+
+    std::mutex iLock;
+
+    std::mutex iFileLock; // the file against the flushed counts
+
+    std::map<std::string, Rings> iSeries;
+
+    int64_t iFlushedUntil = 0;
+
+    std::map<std::string, int64_t> iFlushedAtStart; // flushed for the minute started in
+};
+
+using SPCCounterSeries = std::shared_ptr<CCounterSeries>;
+
+class CCounterRegistry
+{
+  public:
+
+    static CCounterRegistry& Get(void)
+    {
+      static CCounterRegistry registry;
+      return registry;
+    }
+
+    ~CCounterRegistry()
+    {
+      StopFlush();
+    }
+
+    /*
+     * cameras of the same name share counts
+     */
+    SPCCounterSeries Register(const std::string& name)
+    {
+      std::lock_guard<std::mutex> lg(iLock);
+
+      auto& series = iSeries[name];
+
+      if (!series)
+      {
+        series = std::make_shared<CCounterSeries>(name);
+      }
+
+      return series;
+    }
+
+    SPCCounterSeries Find(const std::string& name)
+    {
+      std::lock_guard<std::mutex> lg(iLock);
+
+      auto it = iSeries.find(name);
+
+      return it == iSeries.end() ? nullptr : it->second;
+    }
+
+    /*
+     * file of the counts of a camera in the flush directory
+     */
+    std::string GetPath(const std::string& name)
+    {
+      std::lock_guard<std::mutex> lg(iFlushLock);
+
+      return iDirectory.empty() ? "" : iDirectory + "/" + name + ".cnt";
+    }
+
+    /*
+     * counts of [from, to) in minute or hour buckets, from the file for the
+     * part older than the ring in memory, buckets without counts are left out.
+     * The bucket this run started in adds the counts of earlier runs in the
+     * file to those in memory
+     */
+    std::vector<SeriesPoint> Query(const std::string& name, const std::string& series,
+      EResolution resolution, int64_t from, int64_t to = CCounterSeries::Now() + 1)
+    {
+      std::vector<SeriesPoint> out;
+
+      auto counts = Find(name);
+
+      if (!counts) return out;
+
+      auto width = GetResolutionSeconds(resolution);
+      auto started = counts->GetStartedAt() - counts->GetStartedAt() % width;
+
+      auto memory = counts->Query(series, resolution, std::max(from, started), to);
+
+      auto path = GetPath(name);
+
+      if (path.size() && resolution != EResolution::Second)
+      {
+        if (memory.size() && memory.front().t == started)
+        {
+          auto start = counts->GetStartedAt() - counts->GetStartedAt() % 60;
+
+          for (auto& p : counts->LoadEarlierRuns(path, series, resolution, from, std::min(to, start + 60)))
+          {
+            if (p.t == started) memory.front().count += p.count;
+            else out.push_back(p);
+          }
+        }
+        else if (memory.empty() || memory.front().t > from)
+        {
+          out = CCounterSeries::Load(path, series, resolution, from, memory.empty() ? to : memory.front().t);
+        }
+      }
+
+      for (auto& p : memory)
+      {
+        if (p.count) out.push_back(p);
+      }
+
+      return out;
+    }
+
+    /*
+     * flushes counts periodically to the directory named by the
+     * cpp-cvl-counters environment variable unless one is given, once
+     * started further calls do nothing until StopFlush
+     */
+    void StartFlush(std::string directory = "", std::chrono::milliseconds interval = std::chrono::milliseconds(60000))
+    {
+      if (directory.empty())
+      {
+        auto env = std::getenv("cpp-cvl-counters");
+        if (!env) return;
+        directory = env;
+      }
+
+      std::lock_guard<std::mutex> lg(iFlushLock);
+
+      if (iFlushThread.joinable()) return;
+
+      iDirectory = directory;
+      iStopFlush = false;
+
+      iFlushThread = std::thread([this, interval]() {
+        std::unique_lock<std::mutex> ul(iFlushLock);
+        while (!iStopFlush)
+        {
+          iFlushCondition.wait_for(ul, interval, [this]() { return iStopFlush; });
+
+          auto directory = iDirectory;
+          auto final = iStopFlush;
+
+          ul.unlock();
+          FlushAll(directory, final);
+          ul.lock();
+        }
+      });
+    }
+
+    void StopFlush(void)
+    {
+      {
+        std::lock_guard<std::mutex> lg(iFlushLock);
+        iStopFlush = true;
+      }
+
+      iFlushCondition.notify_all();
+
+      if (iFlushThread.joinable()) iFlushThread.join();
+    }
+
+  private:
+
+    CCounterRegistry() {}
+
+    void FlushAll(const std::string& directory, bool final)
+    {
+      std::vector<SPCCounterSeries> series;
+
+      {
+        std::lock_guard<std::mutex> lg(iLock);
+        for (auto& s : iSeries) series.push_back(s.second);
+      }
+
+      for (auto& s : series)
+      {
+        s->Flush(directory + "/" + s->GetName() + ".cnt", final);
+      }
+    }
+
+    std::mutex iLock;
+
+    std::map<std::string, SPCCounterSeries> iSeries;
+
+    std::string iDirectory;
+
+    std::mutex iFlushLock;
+
+    std::condition_variable iFlushCondition;
+
+    std::thread iFlushThread;
+
+    bool iStopFlush = false;
+};
+
+#endif
@@ -0,0 +1,169 @@
+#ifndef DETECTIONCACHE_HPP
+#define DETECTIONCACHE_HPP
+
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <unordered_map>
+
+/*
+ * Detections of a run kept in a file, so that trackers can be tuned by
+ * replaying them without running inference again. The file starts with a
+ * magic and holds one record per stream and frame, in native byte order :
+ *
+ *  uint32 stream, uint32 frame, uint32 count, count * CachedDetection
+ *
+ * Streams tell apart the detectors of one run, frames are the offsets of
+ * the frames in the input. A frame recorded twice keeps its first record.
+ */
+
+struct CachedDetection
+{
+  float x, y, width, height;
+  float a;        // confidence, or age
+  float b;        // confidence of the action, or gender
+  int32_t label;  // action label
+};
+
+static_assert(sizeof(CachedDetection) == 28, "CachedDetection must be packed");
+
+static const char kDetectionCacheMagic[8] = {'C', 'V', 'L', 'D', 'E', 'T', 'S', '1'};
+
+class CDetectionCacheWriter
+{
+  public:
+
+    CDetectionCacheWriter(const std::string& path) : iFile(path, std::ios::binary | std::ios::trunc)
+    {
+      iFile.write(kDetectionCacheMagic, sizeof(kDetectionCacheMagic));
+    }
+
+    ~CDetectionCacheWriter()
+    {
+      iFile.flush();
+    }
+
+    bool IsOpened(void)
+    {
+      return static_cast<bool>(iFile);
+    }
+
+    /*
+     * detectors of different threads may share a writer
+     */
+    void Write(uint32_t stream, uint32_t frame, const std::vector<CachedDetection>& detections)
+    {
+      uint32_t header[3] = {stream, frame, static_cast<uint32_t>(detections.size())};
+
+      std::lock_guard<std::mutex> lg(iLock);
+
+      iFile.write(reinterpret_cast<const char *>(header), sizeof(header));
+
+      if (detections.size())
+      {
+        iFile.write(reinterpret_cast<const char *>(detections.data()), detections.size() * sizeof(CachedDetection));
+      }
+    }
+
+  private:
+
+    std::mutex iLock;
+
+    std::ofstream iFile;
+};
+
+using SPCDetectionCacheWriter = std::shared_ptr<CDetectionCacheWriter>;
+
+/*
+ * reads the whole file at once, lookups are served from memory
+ */
+class CDetectionCacheReader
+{
+  public:
+
+    CDetectionCacheReader(const std::string& path)
+    {
+      std::ifstream file(path, std::ios::binary);
+
+      if (!file)
+      {
+        std::cout << "Cannot open the detection cache " << path << "\n";
+        return;
+      }
+
+      std::vector<char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+      if (data.size() < sizeof(kDetectionCacheMagic) ||
+          std::memcmp(data.data(), kDetectionCacheMagic, sizeof(kDetectionCacheMagic)))
+      {
+        std::cout << "Not a detection cache " << path << "\n";
+        return;
+      }
+
+      size_t pos = sizeof(kDetectionCacheMagic);
+
+      while (pos + 3 * sizeof(uint32_t) <= data.size())
+      {
+        uint32_t header[3];
+        std::memcpy(header, data.data() + pos, sizeof(header));
+        pos += sizeof(header);
+
+        auto size = header[2] * sizeof(CachedDetection);
+
+        if (pos + size > data.size()) break; // cut short by a crash
+
+        std::vector<CachedDetection> detections(header[2]);
+
+        if (size) std::memcpy(detections.data(), data.data() + pos, size);
+
+        pos += size;
+
+        iFrames.emplace(Key(header[0], header[1]), std::move(detections));
+      }
+
+      iOpened = true;
+    }
+
+    bool IsOpened(void) const
+    {
+      return iOpened;
+    }
+
+    size_t GetFrameCount(void) const
+    {
+      return iFrames.size();
+    }
+
+    /*
+     * detections of a frame, none if the frame was not recorded
+     */
+    const std::vector<CachedDetection>& Get(uint32_t stream, uint32_t frame) const
+    {
+      static const std::vector<CachedDetection> none;
+
+      auto it = iFrames.find(Key(stream, frame));
+
+      return it == iFrames.end() ? none : it->second;
+    }
+
+  private:
+
+    static uint64_t Key(uint32_t stream, uint32_t frame)
+    {
+      return (static_cast<uint64_t>(stream) << 32) | frame;
+    }
+
+    bool iOpened = false;
+
+    std::unordered_map<uint64_t, std::vector<CachedDetection>> iFrames;
+};
+
+using SPCDetectionCacheReader = std::shared_ptr<CDetectionCacheReader>;
+
+#endif
@@ -9,7 +9,11 @@
 #include <opencv2/bgsegm.hpp>
 #include <inference_engine.hpp>
 
+#include <Trace.hpp>
+#include <Source.hpp>
 #include <Geometry.hpp>
+#include <Synthetic.hpp>
+#include <DetectionCache.hpp>
 
 #include <CSubject.hpp>
 
@@ -72,6 +76,16 @@ class CDetector : public NPL::CSubject<uint8_t, uint8_t>
 
   protected:
 
+    /*
+     * runs the network on an input blob, overridden to serve recorded
+     * outputs so that Detect can be measured without models
+     */
+    virtual void Forward(const cv::Mat& blob, std::vector<cv::Mat>& out)
+    {
+      iNetwork.setInput(blob);
+      iNetwork.forward(out, iNetwork.getUnconnectedOutLayersNames());
+    }
+
     std::string iTarget;
 
     std::string iConfigFile;
@@ -95,11 +109,11 @@ class AgeGenderDetector : public CDetector
 
     virtual Detections Detect(cv::Mat& frame) override
     {
+      CVL_TRACE_SCOPE("AgeGenderDetector::Detect");
+
       auto blob = cv::dnn::blobFromImage(frame, 1, cv::Size(62, 62));
-      iNetwork.setInput(blob);
       std::vector<cv::Mat> out;
-      std::vector<cv::String> layers = iNetwork.getUnconnectedOutLayersNames();
-      iNetwork.forward(out, layers);
+      Forward(blob, out);
       return {
         {
           cv::Rect2d(), 
@@ -131,6 +145,8 @@ class FaceDetector : public CDetector
 
     virtual Detections Detect(cv::Mat& frame) override
     {
+      CVL_TRACE_SCOPE("FaceDetector::Detect");
+
       Detections out;
 
       cv::Mat inputBlob = cv::dnn::blobFromImage(
@@ -141,9 +157,11 @@ class FaceDetector : public CDetector
         false,
         false);
 
-      iNetwork.setInput(inputBlob);
+      std::vector<cv::Mat> outputs;
+
+      Forward(inputBlob, outputs);
 
-      cv::Mat detection = iNetwork.forward();
+      cv::Mat& detection = outputs[0];
 
       cv::Mat detectionMat(detection.size[2], detection.size[3], CV_32F, detection.ptr<float>());
 
@@ -242,6 +260,8 @@ class PeopleDetector : public CDetector
 
     virtual Detections Detect(cv::Mat& frame) override
     {
+      CVL_TRACE_SCOPE("PeopleDetector::Detect");
+
       Detections out;
 
       cv::Mat inputBlob = cv::dnn::blobFromImage(
@@ -253,9 +273,11 @@ class PeopleDetector : public CDetector
         false,
         CV_8U);*/
 
-      iNetwork.setInput(inputBlob);
+      std::vector<cv::Mat> outputs;
 
-      cv::Mat detection = iNetwork.forward();
+      Forward(inputBlob, outputs);
+
+      cv::Mat& detection = outputs[0];
 
       cv::Mat detectionMat(detection.size[2], detection.size[3], CV_32F, detection.ptr<float>());
 
@@ -320,6 +342,8 @@ class ObjectDetector : public CDetector
 
     virtual Detections Detect(cv::Mat& frame) override
     {
+      CVL_TRACE_SCOPE("ObjectDetector::Detect");
+
       Detections out;
 
       cv::Mat inputBlob = cv::dnn::blobFromImage(
@@ -330,9 +354,11 @@ class ObjectDetector : public CDetector
         false, 
         false);
 
-      iNetwork.setInput(inputBlob);
+      std::vector<cv::Mat> outputs;
 
-      cv::Mat detection = iNetwork.forward();
+      Forward(inputBlob, outputs);
+
+      cv::Mat& detection = outputs[0];
 
       cv::Mat detectionMat(detection.size[2], detection.size[3], CV_32F, detection.ptr<float>());
 
@@ -400,6 +426,8 @@ class BackgroundSubtractor : public CDetector
 
     virtual Detections Detect(cv::Mat& frame) override
     {
+      CVL_TRACE_SCOPE("BackgroundSubtractor::Detect");
+
       cv::Mat fgMask;
 
       std::vector<
@@ -495,6 +523,89 @@ class BackgroundSubtractor : public CDetector
 
 };
 
+/*
+ * Serves the ground truth of a synthetic source as detections, so that
+ * tracking and counting can be measured without a model
+ */
+class SyntheticDetector : public CDetector
+{
+  public:
+
+    SyntheticDetector(SPCSyntheticScene scene) : iScene(scene)
+    {
+    }
+
+    virtual Detections Detect(cv::Mat& frame) override
+    {
+      CVL_TRACE_SCOPE("SyntheticDetector::Detect");
+
+      return iScene->GetDetections();
+    }
+
+  protected:
+
+    SPCSyntheticScene iScene;
+};
+
+std::vector<CachedDetection> ToCachedDetections(const Detections& detections)
+{
+  std::vector<CachedDetection> out;
+
+  for (auto& d : detections)
+  {
+    auto& r = std::get<0>(d);
+
+    out.push_back({
+      static_cast<float>(r.x), static_cast<float>(r.y),
+      static_cast<float>(r.width), static_cast<float>(r.height),
+      std::get<1>(d), std::get<2>(d), -1});
+  }
+
+  return out;
+}
+
+Detections FromCachedDetections(const std::vector<CachedDetection>& detections)
+{
+  Detections out;
+
+  for (auto& d : detections)
+  {
+    out.emplace_back(cv::Rect2d(d.x, d.y, d.width, d.height), d.a, d.b, false);
+  }
+
+  return out;
+}
+
+/*
+ * Serves the detections recorded by a camera with the record property,
+ * by the offset of the frame in the source. Trackers and filters can be
+ * tuned on the same detections over and over without running a model
+ */
+class ReplayDetector : public CDetector
+{
+  public:
+
+    ReplayDetector(const std::string& path, SPCSource source) : iSource(source)
+    {
+      iCache = std::make_shared<CDetectionCacheReader>(path);
+
+      std::cout << "Replaying " << iCache->GetFrameCount() << " frames of detections from " << path << "\n";
+    }
+
+    virtual Detections Detect(cv::Mat& frame) override
+    {
+      CVL_TRACE_SCOPE("ReplayDetector::Detect");
+
+      return FromCachedDetections(iCache->Get(0, static_cast<uint32_t>(iSource->GetCurrentOffset())));
+    }
+
+  protected:
+
+    SPCDetectionCacheReader iCache;
+
+    SPCSource iSource;
+};
+
 class IEDetector : public CDetector
 {
   public:
@@ -545,15 +656,14 @@ class IEDetector : public CDetector
       iNetwork = iCore.LoadNetwork(network, "CPU");
     }
 
-    virtual Detections Detect(cv::Mat& frame) override
+    /*
+     * wraps the frame without a copy, the resize to the network input is
+     * done by the IE preprocessing
+     */
+    virtual void Forward(const cv::Mat& frame, std::vector<cv::Mat>& out) override
     {
-      Detections out;
-
       auto req = iNetwork.CreateInferRequest();
 
-      auto width_ = static_cast<float>(frame.cols);
-      auto height_ = static_cast<float>(frame.rows);
-
       InferenceEngine::Blob::Ptr blob = wrapMat2Blob(frame);
 
       req.SetBlob(iInputDataMap.begin()->first, blob); 
@@ -564,7 +674,25 @@ class IEDetector : public CDetector
 
       auto outputMapped = InferenceEngine::as<InferenceEngine::MemoryBlob>(output)->rmap();
 
-      const float *data = outputMapped.as<float *>();
+      out.clear();
+
+      out.push_back(cv::Mat(iMaxDetections, iObjectSize, CV_32F, outputMapped.as<float *>()).clone());
+    }
+
+    virtual Detections Detect(cv::Mat& frame) override
+    {
+      CVL_TRACE_SCOPE("IEDetector::Detect");
+
+      Detections out;
+
+      auto width_ = static_cast<float>(frame.cols);
+      auto height_ = static_cast<float>(frame.rows);
+
+      std::vector<cv::Mat> outputs;
+
+      Forward(frame, outputs);
+
+      const float *data = outputs[0].ptr<float>();
 
       for (int i = 0; i < iMaxDetections; ++i) 
 	    {
@@ -609,6 +737,15 @@ class IEDetector : public CDetector
 
   protected:
 
+    /*
+     * no network, only the layout of its output, for detectors that
+     * override Forward. The age-gender detector of faces is left to them
+     */
+    IEDetector(const std::string& target, int maxDetections, int objectSize) :
+      iMaxDetections(maxDetections), iObjectSize(objectSize), iTarget(target)
+    {
+    }
+
     InferenceEngine::Core iCore;
 
     InferenceEngine::ExecutableNetwork iNetwork;
@@ -85,8 +85,6 @@ struct TrackingContext
 
   std::vector<cv::Mat> iThumbnails;
 
-  bool iSkip = false;
-
   bool IsFrozen(void)
   {/*
     * valid only for FOV where the subject is 
@@ -0,0 +1,430 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <map>
+#include <array>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <condition_variable>
+
+#include "Trace.hpp"
+
+/*
+ * Per-stage latency metrics of camera pipelines. Every camera registers
+ * a CMetrics by its name and records the time of each stage of a frame
+ * into a lock-free histogram, snapshots can be taken at any time from
+ * any thread and dumped in the prometheus text format.
+ */
+
+enum class EStage
+{
+  Read,
+  Resize,
+  Track,
+  Detect,
+  Match,
+  Recognize,
+  Render,
+  Encode,
+  Callback,
+  Count
+};
+
+inline const char * GetStageName(EStage stage)
+{
+  static const char * names[] = {
+    "read", "resize", "track", "detect", "match",
+    "recognize", "render", "encode", "callback"
+  };
+
+  return names[static_cast<int>(stage)];
+}
+
+struct LatencySnapshot
+{
+  uint64_t count = 0;
+  uint64_t sum_us = 0;
+  uint64_t p50_us = 0;
+  uint64_t p99_us = 0;
+  uint64_t max_us = 0;
+};
+
+/*
+ * HDR style histogram of latencies in microseconds: values below 2^S are
+ * counted exactly, larger ones in 2^(S-1) buckets per power of two, which
+ * keeps the relative error of percentiles below 2^(1-S), about 6%.
+ */
+class CLatencyHistogram
+{
+  public:
+
+    CLatencyHistogram()
+    {
+      for (auto& c : iCounts) c.store(0, std::memory_order_relaxed);
+    }
+
+    void Record(uint64_t us)
+    {
+      if (us > kMaxValue) us = kMaxValue;
+
+      iCounts[BucketOf(us)].fetch_add(1, std::memory_order_relaxed);
+      iSum.fetch_add(us, std::memory_order_relaxed);
+
+      auto max = iMax.load(std::memory_order_relaxed);
+      while (us > max && !iMax.compare_exchange_weak(max, us, std::memory_order_relaxed));
+    }
+
+    LatencySnapshot Snapshot(void) const
+    {
+      LatencySnapshot s;
+
+      std::array<uint64_t, kNumBuckets> counts;
+      uint64_t total = 0;
+
+      for (size_t i = 0; i < kNumBuckets; i++)
+      {
+        counts[i] = iCounts[i].load(std::memory_order_relaxed);
+        total += counts[i];
+      }
+
+      s.count = total;
+      s.sum_us = iSum.load(std::memory_order_relaxed);
+      s.max_us = iMax.load(std::memory_order_relaxed);
+
+      if (total == 0) return s;
+
+      // ranks of the percentiles, counted from 1
+      const uint64_t p50_rank = (total + 1) / 2;
+      const uint64_t p99_rank = total - total / 100;
+
+      uint64_t seen = 0;
+
+      for (size_t i = 0; i < kNumBuckets && seen < p99_rank; i++)
+      {
+        if (!counts[i]) continue;
+
+        bool below_p50 = seen < p50_rank;
+
+        seen += counts[i];
+
+        if (below_p50 && seen >= p50_rank) s.p50_us = HighestValueOf(i);
+        if (seen >= p99_rank) s.p99_us = HighestValueOf(i);
+      }
+
+      // buckets are wider than one microsecond, the max is exact
+      if (s.p50_us > s.max_us) s.p50_us = s.max_us;
+      if (s.p99_us > s.max_us) s.p99_us = s.max_us;
+
+      return s;
+    }
+
+  private:
+
+    static const int kSubBucketBits = 5;
+    static const uint64_t kSubBuckets = 1 << kSubBucketBits;
+    static const uint64_t kHalfSubBuckets = kSubBuckets / 2;
+    static const int kMaxBits = 36; // ~19 hours
+    static const uint64_t kMaxValue = (1ULL << kMaxBits) - 1;
+    static const size_t kNumBuckets = (kMaxBits - kSubBucketBits + 2) * kHalfSubBuckets;
+
+    static size_t BucketOf(uint64_t us)
+    {
+      if (us < kSubBuckets) return static_cast<size_t>(us);
+
+      int magnitude = 0;
+
+      while ((us >> magnitude) >= kSubBuckets) magnitude++;
+
+      return static_cast<size_t>(magnitude * kHalfSubBuckets + (us >> magnitude));
+    }
+
+    static uint64_t HighestValueOf(size_t bucket)
+    {
+      if (bucket < kSubBuckets) return bucket;
+
+      int magnitude = static_cast<int>(bucket / kHalfSubBuckets) - 1;
+
+      uint64_t lowest = (bucket - magnitude * kHalfSubBuckets) << magnitude;
+
+      return lowest + (1ULL << magnitude) - 1;
+    }
+
+    std::array<std::atomic<uint64_t>, kNumBuckets> iCounts;
+
+    std::atomic<uint64_t> iSum{0};
+
+    std::atomic<uint64_t> iMax{0};
+};
+
+class CMetrics
+{
+  public:
+
+    CMetrics(const std::string& name) : iName(name) {}
+
+    const std::string& GetName(void) const
+    {
+      return iName;
+    }
+
+    void Record(EStage stage, uint64_t us)
+    {
+      iStages[static_cast<size_t>(stage)].Record(us);
+    }
+
+    LatencySnapshot Snapshot(EStage stage) const
+    {
+      return iStages[static_cast<size_t>(stage)].Snapshot();
+    }
+
+  private:
+
+    std::string iName;
+
+    std::array<CLatencyHistogram, static_cast<size_t>(EStage::Count)> iStages;
+};
+
+using SPCMetrics = std::shared_ptr<CMetrics>;
+
+/*
+ * Times consecutive stages of a frame, Start() ends the running stage.
+ * Does nothing without metrics. Stages also go to the trace timeline.
+ */
+class CStageTimer
+{
+  public:
+
+    CStageTimer(const SPCMetrics& metrics) : iMetrics(metrics.get()) {}
+
+    ~CStageTimer()
+    {
+      Stop();
+    }
+
+    void Start(EStage stage)
+    {
+      if (!iMetrics) return;
+
+      auto now = std::chrono::steady_clock::now();
+
+      if (iRunning) Record(now);
+
+      iStage = stage;
+      iStartedAt = now;
+      iRunning = true;
+    }
+
+    void Stop(void)
+    {
+      if (!iMetrics || !iRunning) return;
+
+      Record(std::chrono::steady_clock::now());
+
+      iRunning = false;
+    }
+
+  private:
+
+    void Record(std::chrono::steady_clock::time_point now)
+    {
+      auto us = std::chrono::duration_cast<std::chrono::microseconds>(now - iStartedAt).count();
+
+      iMetrics->Record(iStage, static_cast<uint64_t>(us));
+
+      CVL_TRACE_COMPLETE(GetStageName(iStage), iStartedAt, now);
+    }
+
+    CMetrics *iMetrics;
+
+    EStage iStage = EStage::Read;
+
+    bool iRunning = false;
+
+    std::chrono::steady_clock::time_point iStartedAt;
+};
+
+class CMetricsRegistry
+{
+  public:
+
+    static CMetricsRegistry& Get(void)
+    {
+      static CMetricsRegistry registry;
+      return registry;
+    }
+
+    ~CMetricsRegistry()
+    {
+      StopFileDump();
+    }
+
+    /*
+     * cameras of the same name share metrics
+     */
+    SPCMetrics Register(const std::string& name)
+    {
+      std::lock_guard<std::mutex> lg(iLock);
+
+      auto& metrics = iMetrics[name];
+
+      if (!metrics)
+      {
+        metrics = std::make_shared<CMetrics>(name);
+      }
+
+      return metrics;
+    }
+
+    std::map<std::string, std::vector<std::pair<EStage, LatencySnapshot>>> Snapshot(void)
+    {
+      std::map<std::string, std::vector<std::pair<EStage, LatencySnapshot>>> snapshot;
+
+      std::lock_guard<std::mutex> lg(iLock);
+
+      for (auto& m : iMetrics)
+      {
+        for (int i = 0; i < static_cast<int>(EStage::Count); i++)
+        {
+          auto s = m.second->Snapshot(static_cast<EStage>(i));
+
+          if (s.count)
+          {
+            snapshot[m.first].emplace_back(static_cast<EStage>(i), s);
+          }
+        }
+      }
+
+      return snapshot;
+    }
+
+    std::string ToPrometheusText(void)
+    {
+      std::ostringstream out;
+
+      out.precision(9);
+
+      auto snapshot = Snapshot();
+
+      out << "# HELP cvl_stage_latency_seconds Latency of camera pipeline stages.\n";
+      out << "# TYPE cvl_stage_latency_seconds summary\n";
+
+      for (auto& camera : snapshot)
+      {
+        for (auto& stage : camera.second)
+        {
+          auto labels = "camera=\"" + camera.first + "\",stage=\"" + GetStageName(stage.first) + "\"";
+          auto& s = stage.second;
+
+          out << "cvl_stage_latency_seconds{" << labels << ",quantile=\"0.5\"} " << s.p50_us * 1e-6 << "\n";
+          out << "cvl_stage_latency_seconds{" << labels << ",quantile=\"0.99\"} " << s.p99_us * 1e-6 << "\n";
+          out << "cvl_stage_latency_seconds_sum{" << labels << "} " << s.sum_us * 1e-6 << "\n";
+          out << "cvl_stage_latency_seconds_count{" << labels << "} " << s.count << "\n";
+        }
+      }
+
+      out << "# HELP cvl_stage_latency_max_seconds Max latency of camera pipeline stages.\n";
+      out << "# TYPE cvl_stage_latency_max_seconds gauge\n";
+
+      for (auto& camera : snapshot)
+      {
+        for (auto& stage : camera.second)
+        {
+          out << "cvl_stage_latency_max_seconds{camera=\"" << camera.first << "\",stage=\""
+              << GetStageName(stage.first) << "\"} " << stage.second.max_us * 1e-6 << "\n";
+        }
+      }
+
+      return out.str();
+    }
+
+    /*
+     * writes a temporary file and renames it, so that readers such as the
+     * node exporter textfile collector never see a partial dump
+     */
+    bool DumpToFile(const std::string& path)
+    {
+      auto tmp = path + ".tmp";
+
+      {
+        std::ofstream file(tmp, std::ios::trunc);
+        if (!file) return false;
+        file << ToPrometheusText();
+        if (!file) return false;
+      }
+
+      /* on POSIX rename replaces the old dump atomically, windows refuses to overwrite */
+#ifdef _WIN32
+      std::remove(path.c_str());
+#endif
+
+      return std::rename(tmp.c_str(), path.c_str()) == 0;
+    }
+
+    /*
+     * dumps metrics periodically to the file named by the cpp-cvl-metrics
+     * environment variable unless a path is given, once started further
+     * calls do nothing
+     */
+    void StartFileDump(std::string path = "", std::chrono::milliseconds interval = std::chrono::milliseconds(5000))
+    {
+      if (path.empty())
+      {
+        auto env = std::getenv("cpp-cvl-metrics");
+        if (!env) return;
+        path = env;
+      }
+
+      std::lock_guard<std::mutex> lg(iDumpLock);
+
+      if (iDumpThread.joinable()) return;
+
+      iDumpThread = std::thread([this, path, interval]() {
+        std::unique_lock<std::mutex> ul(iDumpLock);
+        while (!iStopDump)
+        {
+          iDumpCondition.wait_for(ul, interval, [this]() { return iStopDump; });
+          DumpToFile(path);
+        }
+      });
+    }
+
+    void StopFileDump(void)
+    {
+      {
+        std::lock_guard<std::mutex> lg(iDumpLock);
+        iStopDump = true;
+      }
+
+      iDumpCondition.notify_all();
+
+      if (iDumpThread.joinable()) iDumpThread.join();
+    }
+
+  private:
+
+    CMetricsRegistry() {}
+
+    std::mutex iLock;
+
+    std::map<std::string, SPCMetrics> iMetrics;
+
+    std::mutex iDumpLock;
+
+    std::condition_variable iDumpCondition;
+
+    std::thread iDumpThread;
+
+    bool iStopDump = false;
+};
+
+#endif
@@ -2,6 +2,7 @@
 #define SOURCE_HPP 
 
 #include <Tracker.hpp>
+#include <Synthetic.hpp>
 
 #include <opencv2/videoio.hpp>
 #include <opencv2/highgui.hpp>
@@ -12,6 +13,12 @@ class CSource
 
     CSource(const std::string& s)
     {
+      if (CSyntheticScene::IsSynthetic(s))
+      {
+        iSynthetic = std::make_shared<CSyntheticScene>(s);
+        return;
+      }
+
       iCapture = cv::VideoCapture(s.c_str());
       iCapture.set(cv::CAP_PROP_BUFFERSIZE, 3);
     }
@@ -27,14 +34,24 @@ class CSource
 
     bool isOpened(void)
     {
-      return iCapture.isOpened();
+      return iSynthetic ? true : iCapture.isOpened();
     }
 
     uint64_t GetTotalFrames(void)
     {
+      if (iSynthetic)
+      {
+        return iSynthetic->GetTotalFrames();
+      }
+
       return iCapture.get(cv::CAP_PROP_FRAME_COUNT);
     }
 
+    SPCSyntheticScene GetSyntheticScene(void)
+    {
+      return iSynthetic;
+    }
+
     uint64_t GetCurrentOffset(void)
     {
       return iCurrentOffset;
@@ -42,7 +59,14 @@ class CSource
 
     void Rewind(uint64_t offset = 0)
     {
-      iCapture.set(cv::CAP_PROP_POS_FRAMES, offset);
+      if (iSynthetic)
+      {
+        iSynthetic->Rewind(offset);
+      }
+      else
+      {
+        iCapture.set(cv::CAP_PROP_POS_FRAMES, offset);
+      }
       iCurrentOffset = 0;
     }
 
@@ -58,6 +82,19 @@ class CSource
 
     bool Read(cv::Mat& m)
     {
+      if (iSynthetic)
+      { /*
+         * synthetic scenes are replayed from the start only
+         */
+        iJump = 0;
+
+        bool fRet = iSynthetic->Read(m);
+
+        if (fRet) iCurrentOffset++;
+
+        return fRet;
+      }
+
       bool fRet = iCapture.read(m);
 
       if (fRet)
@@ -139,6 +176,8 @@ class CSource
 
     cv::VideoCapture iCapture;
 
+    SPCSyntheticScene iSynthetic;
+
     size_t iCurrentOffset = 0;
 
     int iJump = 0;
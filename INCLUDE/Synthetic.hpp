@@ -0,0 +1,406 @@
+#ifndef SYNTHETIC_HPP
+#define SYNTHETIC_HPP
+
+#include <tuple>
+#include <random>
+#include <string>
+#include <vector>
+#include <memory>
+#include <limits>
+#include <sstream>
+#include <iostream>
+
+#include <opencv2/opencv.hpp>
+
+#include <Geometry.hpp>
+
+/*
+ * Deterministic synthetic scene with ground truth, read by CSource as a
+ * virtual source named synthetic://key=value&key=value... Keys :
+ *
+ *  size=1280x720     frame size
+ *  frames=0          number of frames, 0 for an endless scene
+ *  seed=1            seed of everything random in the scene
+ *  objects=50        objects in the first frame
+ *  entry=0.5         mean number of objects entering per frame
+ *  exit=0            chance of an object to vanish inside the frame, per frame
+ *  speed=3           mean speed in pixels per frame
+ *  box=40            mean object width in pixels, objects are 1.5 times taller
+ *  pattern=vertical  paths : vertical, horizontal, mixed or diagonal
+ *  occluders=0       number of static blocks hiding objects behind them
+ *  miss=0            chance of a detection to be missed
+ *  jitter=0          max offset of detection boxes in pixels
+ *
+ * Ground truth counts are crossings of the horizontal and vertical lines
+ * through the frame centre, the reference lines of CCounter.
+ */
+
+struct SyntheticObject
+{
+  int id;
+
+  cv::Point2d center;
+
+  cv::Point2d velocity;
+
+  cv::Size2d size;
+
+  cv::Mat texture;
+
+  bool visible = true; // not hidden by an occluder
+
+  cv::Rect2d GetBox(void) const
+  {
+    return cv::Rect2d(center.x - size.width / 2, center.y - size.height / 2, size.width, size.height);
+  }
+};
+
+class CSyntheticScene
+{
+  public:
+
+    static bool IsSynthetic(const std::string& source)
+    {
+      return source.rfind("synthetic://", 0) == 0;
+    }
+
+    CSyntheticScene(const std::string& source)
+    {
+      std::stringstream ss(source.substr(std::string("synthetic://").size()));
+      std::string pair;
+
+      while (std::getline(ss, pair, '&'))
+      {
+        auto eq = pair.find('=');
+
+        if (eq == std::string::npos) continue;
+
+        SetParameter(pair.substr(0, eq), pair.substr(eq + 1));
+      }
+
+      std::mt19937 rng(iSeed);
+
+      iBackground.create(iSize, CV_8UC3);
+      cv::RNG(iSeed).fill(iBackground, cv::RNG::UNIFORM, 0, 64);
+
+      std::uniform_real_distribution<double> x(0, iSize.width), y(0, iSize.height);
+
+      for (int i = 0; i < iOccluderCount; i++)
+      {
+        cv::Rect2d occluder(x(rng), y(rng), 2 * iBoxWidth, 2 * iBoxWidth);
+        iOccluders.push_back(occluder & cv::Rect2d(0, 0, iSize.width, iSize.height));
+      }
+
+      Rewind();
+    }
+
+    uint64_t GetTotalFrames(void)
+    {
+      return iFrames ? iFrames : std::numeric_limits<uint64_t>::max();
+    }
+
+    void Rewind(uint64_t offset = 0)
+    {
+      iRng.seed(iSeed);
+      iObjects.clear();
+      iNextId = 0;
+      iStep = 0;
+      iUp = iDown = iLeft = iRight = 0;
+
+      for (int i = 0; i < iInitialCount; i++)
+      {
+        Spawn(true);
+      }
+
+      UpdateVisibility();
+
+      iOffset = offset;
+    }
+
+    bool Read(cv::Mat& m)
+    {
+      if (iFrames && iOffset >= iFrames)
+      {
+        return false;
+      }
+
+      while (iStep < iOffset)
+      {
+        Step();
+      }
+
+      Render(m);
+
+      iOffset++;
+
+      return true;
+    }
+
+    /*
+     * detections of the last frame read, with the configured misses and jitter
+     */
+    Detections GetDetections(void)
+    {
+      Detections out;
+
+      std::mt19937 rng(static_cast<uint32_t>(iSeed * 7919 + iStep));
+      std::uniform_real_distribution<double> chance(0, 1);
+      std::uniform_real_distribution<double> offset(-iJitter, iJitter);
+
+      cv::Rect2d frame(0, 0, iSize.width, iSize.height);
+
+      for (auto& o : iObjects)
+      {
+        if (!o.visible) continue;
+
+        auto box = o.GetBox();
+        auto inside = box & frame;
+
+        if (inside.area() < box.area() / 2) continue;
+
+        if (iMiss > 0 && chance(rng) < iMiss) continue;
+
+        if (iJitter > 0)
+        {
+          inside.x += offset(rng);
+          inside.y += offset(rng);
+          inside &= frame;
+        }
+
+        out.emplace_back(inside, -1.0f, -1.0f, false);
+      }
+
+      return out;
+    }
+
+    const std::vector<SyntheticObject>& GetObjects(void)
+    {
+      return iObjects;
+    }
+
+    /*
+     * up, down, left and right crossings of the centre lines so far
+     */
+    std::tuple<int, int, int, int> GetCounts(void)
+    {
+      return std::make_tuple(iUp, iDown, iLeft, iRight);
+    }
+
+  private:
+
+    void SetParameter(const std::string& key, const std::string& value)
+    {
+      if (key == "size")
+      {
+        auto x = value.find('x');
+        if (x != std::string::npos)
+        {
+          iSize = cv::Size(std::stoi(value.substr(0, x)), std::stoi(value.substr(x + 1)));
+        }
+      }
+      else if (key == "frames") iFrames = std::stoull(value);
+      else if (key == "seed") iSeed = static_cast<uint32_t>(std::stoul(value));
+      else if (key == "objects") iInitialCount = std::stoi(value);
+      else if (key == "entry") iEntryRate = std::stod(value);
+      else if (key == "exit") iExitRate = std::stod(value);
+      else if (key == "speed") iSpeed = std::stod(value);
+      else if (key == "box") iBoxWidth = std::stod(value);
+      else if (key == "pattern") iPattern = value;
+      else if (key == "occluders") iOccluderCount = std::stoi(value);
+      else if (key == "miss") iMiss = std::stod(value);
+      else if (key == "jitter") iJitter = std::stod(value);
+      else std::cout << "Unknown synthetic source key : " << key << "\n";
+    }
+
+    void Spawn(bool anywhere)
+    {
+      std::uniform_real_distribution<double> unit(0, 1);
+      std::uniform_real_distribution<double> x(0, iSize.width), y(0, iSize.height);
+
+      SyntheticObject o;
+
+      o.id = iNextId++;
+
+      auto width = iBoxWidth * (0.75 + 0.5 * unit(iRng));
+      o.size = cv::Size2d(width, 1.5 * width);
+
+      auto speed = iSpeed * (0.5 + unit(iRng));
+      auto sign = unit(iRng) < 0.5 ? -1.0 : 1.0;
+      auto drift = 0.2 * speed * (2 * unit(iRng) - 1);
+
+      auto pattern = iPattern;
+
+      if (pattern == "mixed")
+      {
+        pattern = unit(iRng) < 0.5 ? "vertical" : "horizontal";
+      }
+
+      if (pattern == "horizontal")
+      {
+        o.velocity = cv::Point2d(sign * speed, drift);
+        o.center = cv::Point2d(sign > 0 ? -o.size.width / 2 : iSize.width + o.size.width / 2, y(iRng));
+      }
+      else if (pattern == "diagonal")
+      {
+        auto sign_y = unit(iRng) < 0.5 ? -1.0 : 1.0;
+        o.velocity = cv::Point2d(sign * speed, sign_y * speed) * std::sqrt(0.5);
+        // enter through the top or bottom edge, headed across the frame
+        o.center = cv::Point2d(x(iRng), sign_y > 0 ? -o.size.height / 2 : iSize.height + o.size.height / 2);
+      }
+      else
+      {
+        o.velocity = cv::Point2d(drift, sign * speed);
+        o.center = cv::Point2d(x(iRng), sign > 0 ? -o.size.height / 2 : iSize.height + o.size.height / 2);
+      }
+
+      if (anywhere)
+      {
+        o.center = cv::Point2d(x(iRng), y(iRng));
+      }
+
+      // texture for the cv trackers to lock on
+      o.texture.create(16, 16, CV_8UC3);
+      cv::RNG(iSeed ^ (0x9e3779b9u * (o.id + 1))).fill(o.texture, cv::RNG::UNIFORM, 64, 256);
+
+      iObjects.push_back(o);
+    }
+
+    void Step(void)
+    {
+      std::uniform_real_distribution<double> unit(0, 1);
+
+      cv::Rect2d frame(0, 0, iSize.width, iSize.height);
+
+      auto cx = iSize.width / 2, cy = iSize.height / 2;
+
+      for (size_t i = iObjects.size(); i > 0; i--)
+      {
+        auto& o = iObjects[i - 1];
+
+        auto prev = o.center;
+
+        o.center += o.velocity;
+
+        if ((prev.y < cy) && (o.center.y >= cy)) iDown++;
+        else if ((prev.y > cy) && (o.center.y <= cy)) iUp++;
+
+        if ((prev.x < cx) && (o.center.x >= cx)) iRight++;
+        else if ((prev.x > cx) && (o.center.x <= cx)) iLeft++;
+
+        bool gone = !(o.GetBox() & frame).area() && IsLeaving(o);
+
+        if (gone || (iExitRate > 0 && unit(iRng) < iExitRate))
+        {
+          iObjects.erase(iObjects.begin() + (i - 1));
+        }
+      }
+
+      // poisson arrivals
+      std::poisson_distribution<int> arrivals(iEntryRate > 0 ? iEntryRate : 1);
+
+      for (int n = iEntryRate > 0 ? arrivals(iRng) : 0; n > 0; n--)
+      {
+        Spawn(false);
+      }
+
+      UpdateVisibility();
+
+      iStep++;
+    }
+
+    bool IsLeaving(const SyntheticObject& o)
+    {
+      return (o.velocity.x > 0 && o.center.x > iSize.width) || (o.velocity.x < 0 && o.center.x < 0) ||
+             (o.velocity.y > 0 && o.center.y > iSize.height) || (o.velocity.y < 0 && o.center.y < 0);
+    }
+
+    void UpdateVisibility(void)
+    {
+      for (auto& o : iObjects)
+      {
+        auto box = o.GetBox();
+
+        o.visible = true;
+
+        for (auto& occluder : iOccluders)
+        {
+          if ((box & occluder).area() > box.area() / 2)
+          {
+            o.visible = false;
+            break;
+          }
+        }
+      }
+    }
+
+    void Render(cv::Mat& m)
+    {
+      iBackground.copyTo(m);
+
+      cv::Rect frame(0, 0, iSize.width, iSize.height);
+
+      for (auto& o : iObjects)
+      {
+        cv::Rect box = o.GetBox();
+
+        auto inside = box & frame;
+
+        if (inside.empty()) continue;
+
+        cv::resize(o.texture, iSprite, box.size(), 0, 0, cv::INTER_NEAREST);
+
+        iSprite(inside - box.tl()).copyTo(m(inside));
+      }
+
+      for (auto& occluder : iOccluders)
+      {
+        cv::rectangle(m, occluder, cv::Scalar(128, 128, 128), cv::FILLED);
+      }
+    }
+
+    cv::Size iSize = cv::Size(1280, 720);
+
+    uint64_t iFrames = 0;
+
+    uint32_t iSeed = 1;
+
+    int iInitialCount = 50;
+
+    double iEntryRate = 0.5;
+
+    double iExitRate = 0;
+
+    double iSpeed = 3;
+
+    double iBoxWidth = 40;
+
+    std::string iPattern = "vertical";
+
+    int iOccluderCount = 0;
+
+    double iMiss = 0;
+
+    double iJitter = 0;
+
+    std::mt19937 iRng;
+
+    std::vector<SyntheticObject> iObjects;
+
+    std::vector<cv::Rect2d> iOccluders;
+
+    cv::Mat iBackground;
+
+    cv::Mat iSprite;
+
+    int iNextId = 0;
+
+    uint64_t iStep = 0;
+
+    uint64_t iOffset = 0;
+
+    int iUp = 0, iDown = 0, iLeft = 0, iRight = 0;
+};
+
+using SPCSyntheticScene = std::shared_ptr<CSyntheticScene>;
+
+#endif
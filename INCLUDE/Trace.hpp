@@ -0,0 +1,397 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+/*
+ * Timeline of pipeline events in the chrome trace format, which opens in
+ * chrome://tracing and ui.perfetto.dev. Tracing is compiled in with the
+ * CVL_TRACE definition and records only while the cpp-cvl-trace environment
+ * variable names the file to write. Every thread records complete events
+ * into a ring buffer of its own without locking, so the latest events are
+ * kept and threads do not contend with each other. The buffer of a thread
+ * that exits goes to the next new thread, so memory is bounded by the
+ * number of threads alive at once.
+ */
+
+#ifdef CVL_TRACE
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <fstream>
+#include <algorithm>
+
+struct TraceEvent
+{
+  const char *name;
+  int64_t ts;
+  int64_t dur;
+};
+
+class CTraceBuffer
+{
+  public:
+
+    CTraceBuffer(uint32_t tid, size_t capacity) : iTid(tid), iEvents(capacity) {}
+
+    /*
+     * called by the thread that owns the buffer only. The slot is claimed
+     * before it is overwritten, so that a concurrent GetEvents can tell
+     * which of the events it copied may be torn
+     */
+    void Add(const char *name, int64_t ts, int64_t dur)
+    {
+      auto next = iNext.load(std::memory_order_relaxed);
+      auto& slot = iEvents[next % iEvents.size()];
+
+      iClaimed.store(next + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+
+      slot.name.store(name, std::memory_order_relaxed);
+      slot.ts.store(ts, std::memory_order_relaxed);
+      slot.dur.store(dur, std::memory_order_relaxed);
+
+      iNext.store(next + 1, std::memory_order_release);
+    }
+
+    void SetName(const std::string& name)
+    {
+      std::lock_guard<std::mutex> lg(iLock);
+      iName = name;
+    }
+
+    // events in the order of recording
+    std::vector<TraceEvent> GetEvents(std::string& name, uint32_t& tid)
+    {
+      {
+        std::lock_guard<std::mutex> lg(iLock);
+        name = iName;
+      }
+
+      tid = iTid;
+
+      std::vector<TraceEvent> events;
+
+      auto end = iNext.load(std::memory_order_acquire);
+      auto begin = end - std::min<uint64_t>(end, iEvents.size());
+
+      for (auto i = begin; i < end; i++)
+      {
+        auto& slot = iEvents[i % iEvents.size()];
+        events.push_back({slot.name.load(std::memory_order_relaxed),
+          slot.ts.load(std::memory_order_relaxed), slot.dur.load(std::memory_order_relaxed)});
+      }
+
+      std::atomic_thread_fence(std::memory_order_acquire);
+
+      // the oldest events may have been overwritten while they were copied
+      auto claimed = iClaimed.load(std::memory_order_relaxed);
+
+      if (claimed > begin + iEvents.size())
+      {
+        auto torn = std::min<uint64_t>(claimed - begin - iEvents.size(), events.size());
+        events.erase(events.begin(), events.begin() + torn);
+      }
+
+      return events;
+    }
+
+  private:
+
+    struct CSlot
+    {
+      std::atomic<const char *> name;
+      std::atomic<int64_t> ts;
+      std::atomic<int64_t> dur;
+    };
+
+    std::mutex iLock;
+
+    std::string iName;
+
+    uint32_t iTid;
+
+    std::vector<CSlot> iEvents;
+
+    std::atomic<uint64_t> iNext{0};
+
+    std::atomic<uint64_t> iClaimed{0};
+};
+
+class CTracer
+{
+  public:
+
+    static CTracer& Get(void)
+    {
+      static CTracer tracer;
+      return tracer;
+    }
+
+    ~CTracer()
+    {
+      if (IsEnabled()) Dump();
+    }
+
+    bool IsEnabled(void) const
+    {
+      return iEnabled.load(std::memory_order_relaxed);
+    }
+
+    // microseconds since the tracer was created
+    int64_t ToTraceTime(std::chrono::steady_clock::time_point t) const
+    {
+      return std::chrono::duration_cast<std::chrono::microseconds>(t - iEpoch).count();
+    }
+
+    int64_t Now(void) const
+    {
+      return ToTraceTime(std::chrono::steady_clock::now());
+    }
+
+    /*
+     * the name must outlive the tracer, pass string literals only
+     */
+    void Record(const char *name, int64_t ts, int64_t dur)
+    {
+      if (!IsEnabled()) return;
+
+      GetThreadBuffer()->Add(name, ts, dur);
+    }
+
+    void SetThreadName(const std::string& name)
+    {
+      if (!IsEnabled()) return;
+
+      GetThreadBuffer()->SetName(name);
+    }
+
+    /*
+     * records into path from now on, as if cpp-cvl-trace named it
+     */
+    void Start(const std::string& path)
+    {
+      std::lock_guard<std::mutex> lg(iLock);
+      iPath = path;
+      iEnabled = true;
+    }
+
+    void Stop(void)
+    {
+      iEnabled = false;
+    }
+
+    bool Dump(void)
+    {
+      if (!IsEnabled()) return false;
+
+      std::string path;
+
+      {
+        std::lock_guard<std::mutex> lg(iLock);
+        path = iPath;
+      }
+
+      return Dump(path);
+    }
+
+    bool Dump(const std::string& path)
+    {
+      std::vector<std::shared_ptr<CTraceBuffer>> buffers;
+
+      {
+        std::lock_guard<std::mutex> lg(iLock);
+        buffers = iBuffers;
+      }
+
+      auto tmp = path + ".tmp";
+
+      {
+        std::ofstream file(tmp, std::ios::trunc);
+
+        if (!file) return false;
+
+        file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+        bool first = true;
+
+        for (auto& buffer : buffers)
+        {
+          std::string name;
+          uint32_t tid;
+
+          auto events = buffer->GetEvents(name, tid);
+
+          if (name.size())
+          {
+            file << (first ? "\n" : ",\n");
+            file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid
+                 << ",\"args\":{\"name\":\"" << Escape(name) << "\"}}";
+            first = false;
+          }
+
+          for (auto& e : events)
+          {
+            file << (first ? "\n" : ",\n");
+            file << "{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid
+                 << ",\"ts\":" << e.ts << ",\"dur\":" << e.dur << "}";
+            first = false;
+          }
+        }
+
+        file << "\n]}\n";
+
+        if (!file) return false;
+      }
+
+#ifdef _WIN32
+      std::remove(path.c_str());
+#endif
+
+      return std::rename(tmp.c_str(), path.c_str()) == 0;
+    }
+
+  private:
+
+    // events kept per thread, at 24 bytes each
+    static const size_t kEventsPerThread = 1 << 16;
+
+    CTracer() : iEpoch(std::chrono::steady_clock::now())
+    {
+      auto env = std::getenv("cpp-cvl-trace");
+
+      if (env && *env)
+      {
+        iPath = env;
+        iEnabled = true;
+      }
+    }
+
+    /*
+     * hands the buffer back to the tracer when its thread exits
+     */
+    struct CThreadBuffer
+    {
+      std::shared_ptr<CTraceBuffer> iBuffer;
+
+      ~CThreadBuffer()
+      {
+        if (iBuffer) CTracer::Get().ReleaseBuffer(iBuffer);
+      }
+    };
+
+    CTraceBuffer * GetThreadBuffer(void)
+    {
+      static thread_local CTraceBuffer *buffer = nullptr;
+
+      if (!buffer)
+      {
+        static thread_local CThreadBuffer owner;
+
+        std::lock_guard<std::mutex> lg(iLock);
+
+        if (iFreeBuffers.size())
+        {
+          owner.iBuffer = iFreeBuffers.back();
+          iFreeBuffers.pop_back();
+        }
+        else
+        {
+          size_t capacity = kEventsPerThread;
+          iBuffers.push_back(std::make_shared<CTraceBuffer>(
+            static_cast<uint32_t>(iBuffers.size() + 1), capacity));
+          owner.iBuffer = iBuffers.back();
+        }
+
+        buffer = owner.iBuffer.get();
+      }
+
+      return buffer;
+    }
+
+    /*
+     * the events of the exited thread stay in the buffer, the next thread
+     * appends to them under the same tid
+     */
+    void ReleaseBuffer(const std::shared_ptr<CTraceBuffer>& buffer)
+    {
+      std::lock_guard<std::mutex> lg(iLock);
+      iFreeBuffers.push_back(buffer);
+    }
+
+    static std::string Escape(const std::string& s)
+    {
+      std::string out;
+
+      for (auto c : s)
+      {
+        if (c == '"' || c == '\\') out += '\\';
+        if (static_cast<unsigned char>(c) >= 0x20) out += c;
+      }
+
+      return out;
+    }
+
+    std::chrono::steady_clock::time_point iEpoch;
+
+    std::atomic<bool> iEnabled{false};
+
+    std::string iPath;
+
+    std::mutex iLock;
+
+    std::vector<std::shared_ptr<CTraceBuffer>> iBuffers;
+
+    std::vector<std::shared_ptr<CTraceBuffer>> iFreeBuffers;
+};
+
+class CTraceScope
+{
+  public:
+
+    CTraceScope(const char *name) : iName(CTracer::Get().IsEnabled() ? name : nullptr)
+    {
+      if (iName) iStartedAt = CTracer::Get().Now();
+    }
+
+    ~CTraceScope()
+    {
+      if (iName)
+      {
+        auto& tracer = CTracer::Get();
+        tracer.Record(iName, iStartedAt, tracer.Now() - iStartedAt);
+      }
+    }
+
+  private:
+
+    const char *iName;
+
+    int64_t iStartedAt = 0;
+};
+
+#define CVL_TRACE_CONCAT2(a, b) a##b
+#define CVL_TRACE_CONCAT(a, b) CVL_TRACE_CONCAT2(a, b)
+
+#define CVL_TRACE_SCOPE(name) CTraceScope CVL_TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define CVL_TRACE_COMPLETE(name, started_at, finished_at) \
+  CTracer::Get().Record(name, CTracer::Get().ToTraceTime(started_at), \
+    std::chrono::duration_cast<std::chrono::microseconds>((finished_at) - (started_at)).count())
+#define CVL_TRACE_THREAD_NAME(name) CTracer::Get().SetThreadName(name)
+#define CVL_TRACE_DUMP() CTracer::Get().Dump()
+
+#else
+
+#define CVL_TRACE_SCOPE(name)
+#define CVL_TRACE_COMPLETE(name, started_at, finished_at) ((void)0)
+#define CVL_TRACE_THREAD_NAME(name) ((void)sizeof(name))
+#define CVL_TRACE_DUMP() ((void)0)
+
+#endif
+
+#endif
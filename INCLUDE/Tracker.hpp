@@ -8,6 +8,7 @@
 #include <opencv2/tracking/tracking.hpp>
 
 #include <Counter.hpp>
+#include <Trace.hpp>
 #include <Geometry.hpp>
 
 #include <CSubject.hpp>
@@ -34,8 +35,6 @@ class CTracker : public NPL::CSubject<uint8_t, uint8_t>
       }
 
       iTrackingContexts.clear();
-
-      iCounter.reset(new CCounter());
     }
 
     size_t GetContextCount(void)
@@ -48,8 +47,20 @@ class CTracker : public NPL::CSubject<uint8_t, uint8_t>
       iCounter->SetRefLine(orientation, delta);
     }
 
+    bool SetZones(const std::string& spec)
+    {
+      return iCounter->SetZones(spec);
+    }
+
+    void SetCounterSeries(SPCCounterSeries series)
+    {
+      iCounter->SetSeries(series);
+    }
+
     virtual void RenderDisplacementAndPaths(cv::Mat& m, bool isTest = true)
     {
+      CVL_TRACE_SCOPE("CTracker::RenderDisplacementAndPaths");
+
       for (auto& tc : iTrackingContexts)
       { /*
          * Displacement
@@ -90,6 +101,8 @@ class CTracker : public NPL::CSubject<uint8_t, uint8_t>
 
     virtual void MatchDetectionWithTrackingContext(Detections& detections, cv::Mat& mat)
     {
+      CVL_TRACE_SCOPE("CTracker::MatchDetectionWithTrackingContext");
+
       for (auto& t : iTrackingContexts)
       {
         int maxArea = 0;
@@ -142,6 +155,8 @@ class CTracker : public NPL::CSubject<uint8_t, uint8_t>
 
     virtual TrackingContext * AddNewTrackingContext(const cv::Mat& m, cv::Rect2d& roi)
     {
+      CVL_TRACE_SCOPE("CTracker::AddNewTrackingContext");
+
       for (auto& tc : iTrackingContexts)
       {
         if ((roi & tc.iTrail.back()).area()) return nullptr;
@@ -170,6 +185,8 @@ class CTracker : public NPL::CSubject<uint8_t, uint8_t>
 
     virtual std::vector<cv::Rect2d> UpdateTrackingContexts(cv::Mat& frame)
     {
+      CVL_TRACE_SCOPE("CTracker::UpdateTrackingContexts");
+
       if (!iTrackingContexts.size())
       {
         return {};
@@ -201,10 +218,7 @@ class CTracker : public NPL::CSubject<uint8_t, uint8_t>
 
             out.push_back(bb);
 
-            if (!tc.iSkip)
-            {
-              tc.iSkip = iCounter->ProcessTrail(tc.iTrail, frame);
-            }
+            iCounter->ProcessTrail(static_cast<int>(tc.id), tc.iTrail, frame);
           }
           else
           {
@@ -236,6 +250,8 @@ class CTracker : public NPL::CSubject<uint8_t, uint8_t>
 
     virtual void SaveAndPurgeTrackingContext(TrackingContext& tc)
     {
+      iCounter->RemoveTrack(static_cast<int>(tc.id));
+
       OnEvent(std::ref(tc));
 
       if (iPurgedContexts.size() > 5)
@@ -0,0 +1,686 @@
+#ifndef ZONES_HPP
+#define ZONES_HPP
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <memory>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <unordered_map>
+
+#include <opencv2/opencv.hpp>
+
+/*
+ * Counting zones of a camera : lines, polygons and dwell polygons. Zone
+ * points are relative to the frame size, 0,0 top left and 1,1 bottom right.
+ *
+ * Tracks report one point per update and every new segment is tested only
+ * against the zone edges in the grid cells it passes, so the cost of a
+ * frame follows the tracks that moved and not tracks times zones.
+ *
+ * Lines count "in" when a track crosses from the left to the right of the
+ * line as seen walking from its first point to its second, "out" otherwise.
+ * Polygons count tracks entering (in), leaving (out) and inside (occupancy),
+ * dwell polygons also count the tracks that stayed inside for a while. Tracks
+ * first seen inside a polygon, or lost inside it, change only the occupancy.
+ *
+ * A crossing counts once the track is kMargin pixels past the line or edge,
+ * crossing back before that cancels it. A track jittering over a line counts
+ * at most once, and one lost before it got past counts nothing.
+ */
+
+enum class EZoneType
+{
+  Line,
+  Polygon,
+  Dwell
+};
+
+enum class EZoneEvent
+{
+  In,
+  Out,
+  Dwell
+};
+
+struct ZoneCounts
+{
+  int in = 0;
+  int out = 0;
+  int occupancy = 0;
+  int dwells = 0;
+};
+
+struct ZoneEvent
+{
+  int zone;
+  EZoneEvent event;
+};
+
+struct Zone
+{
+  std::string name;
+
+  EZoneType type;
+
+  std::vector<cv::Point2f> points; // relative to the frame size
+
+  std::chrono::milliseconds dwell{0};
+
+  std::vector<cv::Point2f> pixels; // points in the current frame size
+
+  ZoneCounts counts;
+};
+
+class CZones
+{
+  public:
+
+    CZones() {}
+
+    /*
+     * adds a line, a zone of the same name keeps its counts and takes the new points
+     */
+    int AddLine(const std::string& name, cv::Point2f from, cv::Point2f to)
+    {
+      return AddZone(name, EZoneType::Line, {from, to}, std::chrono::milliseconds(0));
+    }
+
+    int AddPolygon(const std::string& name, const std::vector<cv::Point2f>& points)
+    {
+      return AddZone(name, EZoneType::Polygon, points, std::chrono::milliseconds(0));
+    }
+
+    int AddDwellZone(const std::string& name, const std::vector<cv::Point2f>& points, std::chrono::milliseconds dwell)
+    {
+      return AddZone(name, EZoneType::Dwell, points, dwell);
+    }
+
+    /*
+     * zones separated by '|', each "type name [seconds] x,y x,y ..." where
+     * type is line, polygon or dwell and seconds is given for dwell only :
+     *
+     * line door 0.1,0.5 0.9,0.5|dwell queue 30 0.6,0.6 0.9,0.6 0.9,0.9
+     *
+     * a spec with an invalid zone adds none of its zones
+     */
+    bool Parse(const std::string& spec)
+    {
+      struct Parsed
+      {
+        std::string type;
+        std::string name;
+        double seconds;
+        std::vector<cv::Point2f> points;
+      };
+
+      std::vector<Parsed> parsed;
+
+      std::stringstream zones(spec);
+      std::string zone;
+
+      while (std::getline(zones, zone, '|'))
+      {
+        std::stringstream ss(zone);
+        std::string type, name, token;
+        double seconds = 0;
+
+        if (!(ss >> type >> name) || (type == "dwell" && !(ss >> seconds)))
+        {
+          std::cout << "Invalid zone : " << zone << "\n";
+          return false;
+        }
+
+        std::vector<cv::Point2f> points;
+
+        while (ss >> token)
+        {
+          float x, y;
+          char comma;
+          std::stringstream point(token);
+
+          if (!(point >> x >> comma >> y) || comma != ',')
+          {
+            std::cout << "Invalid zone point : " << token << "\n";
+            return false;
+          }
+
+          points.emplace_back(x, y);
+        }
+
+        if (!(type == "line" && points.size() == 2) &&
+            !((type == "polygon" || type == "dwell") && points.size() > 2))
+        {
+          std::cout << "Invalid zone : " << zone << "\n";
+          return false;
+        }
+
+        parsed.push_back({type, name, seconds, points});
+      }
+
+      for (auto& p : parsed)
+      {
+        if (p.type == "line")
+        {
+          AddLine(p.name, p.points[0], p.points[1]);
+        }
+        else if (p.type == "polygon")
+        {
+          AddPolygon(p.name, p.points);
+        }
+        else
+        {
+          AddDwellZone(p.name, p.points, std::chrono::milliseconds(static_cast<int64_t>(p.seconds * 1000)));
+        }
+      }
+
+      return true;
+    }
+
+    int GetZoneIndex(const std::string& name) const
+    {
+      for (size_t i = 0; i < iZones.size(); i++)
+      {
+        if (iZones[i].name == name) return static_cast<int>(i);
+      }
+
+      return -1;
+    }
+
+    const std::vector<Zone>& GetZones(void) const
+    {
+      return iZones;
+    }
+
+    /*
+     * zones are laid over the frame on the first update and whenever the
+     * frame size changes, tracks start over then
+     */
+    void SetFrameSize(cv::Size size)
+    {
+      if (size == iFrameSize && !iDirty) return;
+
+      if (size != iFrameSize)
+      { /*
+         * tracks start over, so nothing is inside the polygons
+         */
+        iTracks.clear();
+
+        for (auto& zone : iZones)
+        {
+          zone.counts.occupancy = 0;
+        }
+      }
+
+      iFrameSize = size;
+
+      BuildIndex();
+    }
+
+    /*
+     * moves a track to the point, events are valid until the next update
+     */
+    const std::vector<ZoneEvent>& Update(int id, cv::Point2f point,
+      std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now())
+    {
+      iEvents.clear();
+
+      if (!iFrameSize.area()) return iEvents;
+
+      if (iDirty) BuildIndex();
+
+      auto it = iTracks.find(id);
+
+      if (it == iTracks.end())
+      {
+        auto& track = iTracks[id];
+
+        track.last = point;
+
+        for (auto z : iCellZones[CellOf(point)])
+        { /*
+           * tracks found inside a polygon are not counted in
+           */
+          if (IsInside(iZones[z], point))
+          {
+            track.inside.push_back({z, now, false});
+            iZones[z].counts.occupancy++;
+          }
+        }
+
+        return iEvents;
+      }
+
+      auto& track = it->second;
+
+      if (point != track.last)
+      {
+        CrossEdges(track, track.last, point, now);
+        track.last = point;
+      }
+
+      for (auto& inside : track.inside)
+      {
+        auto& zone = iZones[inside.zone];
+
+        if (zone.type == EZoneType::Dwell && !inside.dwelled && (now - inside.since) >= zone.dwell)
+        {
+          inside.dwelled = true;
+          zone.counts.dwells++;
+          iEvents.push_back({inside.zone, EZoneEvent::Dwell});
+        }
+      }
+
+      return iEvents;
+    }
+
+    /*
+     * a lost track leaves the polygons it was inside without counting out,
+     * crossings it had not got past are dropped
+     */
+    void RemoveTrack(int id)
+    {
+      auto it = iTracks.find(id);
+
+      if (it == iTracks.end()) return;
+
+      for (auto& inside : it->second.inside)
+      {
+        iZones[inside.zone].counts.occupancy--;
+      }
+
+      iTracks.erase(it);
+    }
+
+    void Render(cv::Mat& m)
+    {
+      for (auto& zone : iZones)
+      {
+        std::vector<cv::Point> points(zone.pixels.begin(), zone.pixels.end());
+
+        if (points.empty()) continue;
+
+        auto color = zone.type == EZoneType::Line ? cv::Scalar(0, 0, 255) : cv::Scalar(0, 255, 255);
+
+        cv::polylines(m, points, zone.type != EZoneType::Line, color, 1);
+
+        auto text = zone.name + " " + std::to_string(zone.counts.in) + "/" + std::to_string(zone.counts.out);
+
+        if (zone.type != EZoneType::Line) text += " " + std::to_string(zone.counts.occupancy);
+        if (zone.type == EZoneType::Dwell) text += " " + std::to_string(zone.counts.dwells);
+
+        cv::putText(m, text, points[0] + cv::Point(2, -4), cv::FONT_HERSHEY_SIMPLEX, 0.35, color, 1);
+      }
+    }
+
+  private:
+
+    static const int kCellSize = 32;
+
+    static constexpr float kMargin = 8.0f; // pixels past a line or edge before a crossing counts
+
+    struct Inside
+    {
+      int zone;
+      std::chrono::steady_clock::time_point since;
+      bool dwelled;
+    };
+
+    struct Pending
+    {
+      int zone;
+      int side; // 1 for in, -1 for out
+    };
+
+    struct Track
+    {
+      cv::Point2f last;
+      std::vector<Inside> inside;
+      std::vector<Pending> pending; // crossings not yet kMargin past
+    };
+
+    struct Edge
+    {
+      int zone;
+      cv::Point2f from;
+      cv::Point2f to;
+    };
+
+    int AddZone(const std::string& name, EZoneType type, const std::vector<cv::Point2f>& points, std::chrono::milliseconds dwell)
+    {
+      auto index = GetZoneIndex(name);
+
+      if (index < 0)
+      {
+        index = static_cast<int>(iZones.size());
+        iZones.emplace_back();
+      }
+      else
+      {
+        for (auto& t : iTracks)
+        {
+          auto& pending = t.second.pending;
+          pending.erase(std::remove_if(pending.begin(), pending.end(),
+            [index](const Pending& p) { return p.zone == index; }), pending.end());
+        }
+
+        if (iZones[index].type != EZoneType::Line || type != EZoneType::Line)
+        { /*
+           * tracks inside the old polygon are not inside the new one
+           */
+          for (auto& t : iTracks)
+          {
+            auto& inside = t.second.inside;
+            inside.erase(std::remove_if(inside.begin(), inside.end(),
+              [index](const Inside& i) { return i.zone == index; }), inside.end());
+          }
+
+          iZones[index].counts.occupancy = 0;
+        }
+      }
+
+      auto& zone = iZones[index];
+
+      zone.name = name;
+      zone.type = type;
+      zone.points = points;
+      zone.dwell = dwell;
+
+      iDirty = true;
+
+      return index;
+    }
+
+    void BuildIndex(void)
+    {
+      iDirty = false;
+
+      iCols = std::max(1, (iFrameSize.width + kCellSize - 1) / kCellSize);
+      iRows = std::max(1, (iFrameSize.height + kCellSize - 1) / kCellSize);
+
+      iEdges.clear();
+      iCellEdges.assign(iCols * iRows, {});
+      iCellZones.assign(iCols * iRows, {});
+
+      for (size_t z = 0; z < iZones.size(); z++)
+      {
+        auto& zone = iZones[z];
+
+        zone.pixels.clear();
+
+        for (auto& p : zone.points)
+        {
+          zone.pixels.emplace_back(p.x * iFrameSize.width, p.y * iFrameSize.height);
+        }
+
+        auto n = zone.pixels.size();
+        auto edges = zone.type == EZoneType::Line ? n - 1 : n;
+
+        for (size_t i = 0; i < edges; i++)
+        {
+          Edge edge = {static_cast<int>(z), zone.pixels[i], zone.pixels[(i + 1) % n]};
+
+          auto e = static_cast<int>(iEdges.size());
+
+          iEdges.push_back(edge);
+
+          ForEachCell(edge.from, edge.to, [this, e](int cell) { iCellEdges[cell].push_back(e); });
+        }
+
+        if (zone.type != EZoneType::Line)
+        { /*
+           * cells under the bounds of a polygon, to find the polygons of new tracks
+           */
+          auto bounds = cv::boundingRect(zone.pixels);
+
+          auto c0 = ClampCol(bounds.x), c1 = ClampCol(bounds.x + bounds.width);
+          auto r0 = ClampRow(bounds.y), r1 = ClampRow(bounds.y + bounds.height);
+
+          for (int r = r0; r <= r1; r++)
+          {
+            for (int c = c0; c <= c1; c++)
+            {
+              iCellZones[r * iCols + c].push_back(static_cast<int>(z));
+            }
+          }
+        }
+      }
+
+      iEdgeStamps.assign(iEdges.size(), 0);
+      iZoneStamps.assign(iZones.size(), 0);
+      iStamp = 0;
+    }
+
+    /*
+     * cells a segment passes, points outside the frame go to the border cells
+     */
+    template <typename F>
+    void ForEachCell(cv::Point2f from, cv::Point2f to, F f)
+    {
+      auto c0 = ClampCol(std::min(from.x, to.x)), c1 = ClampCol(std::max(from.x, to.x));
+      auto r0 = ClampRow(std::min(from.y, to.y)), r1 = ClampRow(std::max(from.y, to.y));
+
+      for (int r = r0; r <= r1; r++)
+      {
+        for (int c = c0; c <= c1; c++)
+        {
+          if (c0 == c1 || r0 == r1 || SegmentHitsCell(from, to, c, r))
+          {
+            f(r * iCols + c);
+          }
+        }
+      }
+    }
+
+    bool SegmentHitsCell(cv::Point2f from, cv::Point2f to, int c, int r)
+    {
+      cv::Rect cell(c * kCellSize - 1, r * kCellSize - 1, kCellSize + 2, kCellSize + 2);
+
+      cv::Point p1(cvRound(from.x), cvRound(from.y)), p2(cvRound(to.x), cvRound(to.y));
+
+      return cv::clipLine(cell, p1, p2);
+    }
+
+    void CrossEdges(Track& track, cv::Point2f from, cv::Point2f to, std::chrono::steady_clock::time_point now)
+    {
+      if (++iStamp == 0)
+      {
+        std::fill(iEdgeStamps.begin(), iEdgeStamps.end(), 0);
+        std::fill(iZoneStamps.begin(), iZoneStamps.end(), 0);
+        iStamp = 1;
+      }
+
+      iCrossedPolygons.clear();
+
+      ForEachCell(from, to, [&](int cell) {
+
+        for (auto e : iCellEdges[cell])
+        {
+          if (iEdgeStamps[e] == iStamp) continue;
+
+          iEdgeStamps[e] = iStamp;
+
+          auto& edge = iEdges[e];
+          auto& zone = iZones[edge.zone];
+
+          int side = Crossing(from, to, edge.from, edge.to);
+
+          if (!side) continue;
+
+          if (zone.type == EZoneType::Line)
+          {
+            SetPending(track, edge.zone, side);
+          }
+          else if (iZoneStamps[edge.zone] != iStamp)
+          {
+            iZoneStamps[edge.zone] = iStamp;
+            iCrossedPolygons.push_back(edge.zone);
+          }
+        }
+      });
+
+      /*
+       * a segment may cross several edges of a polygon, where it ends decides
+       */
+      for (auto z : iCrossedPolygons)
+      {
+        bool inside = IsInside(iZones[z], to);
+
+        bool was = std::any_of(track.inside.begin(), track.inside.end(), [z](const Inside& i) { return i.zone == z; });
+
+        SetPending(track, z, inside == was ? 0 : inside ? 1 : -1);
+      }
+
+      for (size_t i = track.pending.size(); i > 0; i--)
+      {
+        auto p = track.pending[i - 1];
+
+        if (p.side * Distance(iZones[p.zone], to) < kMargin) continue;
+
+        track.pending.erase(track.pending.begin() + (i - 1));
+
+        Count(track, p, now);
+      }
+    }
+
+    /*
+     * a crossing of the zone to the side, 0 for a polygon the track ends up
+     * as it was, cancels a pending crossing the other way
+     */
+    void SetPending(Track& track, int zone, int side)
+    {
+      auto it = std::find_if(track.pending.begin(), track.pending.end(), [zone](const Pending& p) { return p.zone == zone; });
+
+      if (it != track.pending.end())
+      {
+        if (it->side != side) track.pending.erase(it);
+      }
+      else if (side)
+      {
+        track.pending.push_back({zone, side});
+      }
+    }
+
+    void Count(Track& track, const Pending& p, std::chrono::steady_clock::time_point now)
+    {
+      auto& zone = iZones[p.zone];
+
+      if (zone.type != EZoneType::Line)
+      {
+        if (p.side > 0)
+        {
+          track.inside.push_back({p.zone, now, false});
+          zone.counts.occupancy++;
+        }
+        else
+        {
+          track.inside.erase(std::find_if(track.inside.begin(), track.inside.end(),
+            [&p](const Inside& i) { return i.zone == p.zone; }));
+          zone.counts.occupancy--;
+        }
+      }
+
+      if (p.side > 0)
+      {
+        zone.counts.in++;
+        iEvents.push_back({p.zone, EZoneEvent::In});
+      }
+      else
+      {
+        zone.counts.out++;
+        iEvents.push_back({p.zone, EZoneEvent::Out});
+      }
+    }
+
+    /*
+     * distance of the point from a line, positive to its right, or from the
+     * edges of a polygon, positive inside
+     */
+    static double Distance(const Zone& zone, cv::Point2f point)
+    {
+      if (zone.type != EZoneType::Line)
+      {
+        return cv::pointPolygonTest(zone.pixels, point, true);
+      }
+
+      auto a = zone.pixels[0], b = zone.pixels[1];
+      auto length = cv::norm(b - a);
+
+      return length > 0 ? (b - a).cross(point - a) / length : 0;
+    }
+
+    /*
+     * 1 if the segment from-to crosses the edge a-b to its right side, -1 to
+     * its left side, 0 if it does not cross. Ending on the edge is a crossing,
+     * starting on it is not, so a track on the edge is counted once.
+     */
+    static int Crossing(cv::Point2f from, cv::Point2f to, cv::Point2f a, cv::Point2f b)
+    {
+      auto s0 = (b - a).cross(from - a);
+      auto s1 = (b - a).cross(to - a);
+
+      int side = 0;
+
+      if (s0 < 0 && s1 >= 0) side = 1;
+      else if (s0 > 0 && s1 <= 0) side = -1;
+
+      if (!side) return 0;
+
+      auto t0 = (to - from).cross(a - from);
+      auto t1 = (to - from).cross(b - from);
+
+      return (t0 * t1 <= 0) ? side : 0;
+    }
+
+    bool IsInside(const Zone& zone, cv::Point2f point)
+    {
+      return zone.type != EZoneType::Line && cv::pointPolygonTest(zone.pixels, point, false) >= 0;
+    }
+
+    int CellOf(cv::Point2f point)
+    {
+      return ClampRow(point.y) * iCols + ClampCol(point.x);
+    }
+
+    int ClampCol(float x)
+    {
+      return std::min(std::max(static_cast<int>(x) / kCellSize, 0), iCols - 1);
+    }
+
+    int ClampRow(float y)
+    {
+      return std::min(std::max(static_cast<int>(y) / kCellSize, 0), iRows - 1);
+    }
+
+    std::vector<Zone> iZones;
+
+    cv::Size iFrameSize;
+
+    bool iDirty = false;
+
+    int iCols = 1, iRows = 1;
+
+    std::vector<Edge> iEdges;
+
+    std::vector<std::vector<int>> iCellEdges; // edges passing each cell
+
+    std::vector<std::vector<int>> iCellZones; // polygons over each cell
+
+    std::vector<uint32_t> iEdgeStamps; // edges tested by the current segment
+
+    std::vector<uint32_t> iZoneStamps;
+
+    uint32_t iStamp = 0;
+
+    std::vector<int> iCrossedPolygons;
+
+    std::unordered_map<int, Track> iTracks;
+
+    std::vector<ZoneEvent> iEvents;
+};
+
+using SPCZones = std::shared_ptr<CZones>;
+
+#endif